@@ -0,0 +1,408 @@
+// ======================================================================
+// ral - Roger Allen's Lisp via https://github.com/kanaka/mal
+// Copyright(C) 2020 Roger Allen
+//
+// bigint.cpp - arbitrary precision integers
+//
+// ======================================================================
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "bigint.h"
+#include <algorithm>
+#include <functional>
+
+typedef std::vector<uint32_t> RalMag;
+
+// below this many limbs Karatsuba costs more than it saves
+const size_t RAL_KARATSUBA_LIMBS = 32;
+
+// ================================================================================
+// Magnitudes
+// ================================================================================
+static void trim(RalMag &a)
+{
+    while (!a.empty() && (a.back() == 0)) {
+        a.pop_back();
+    }
+}
+
+static int compareMag(const RalMag &a, const RalMag &b)
+{
+    if (a.size() != b.size()) {
+        return (a.size() < b.size()) ? -1 : 1;
+    }
+    for (size_t i = a.size(); i-- > 0;) {
+        if (a[i] != b[i]) {
+            return (a[i] < b[i]) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static RalMag addMag(const RalMag &a, const RalMag &b)
+{
+    const RalMag &lo = (a.size() < b.size()) ? a : b;
+    const RalMag &hi = (a.size() < b.size()) ? b : a;
+    RalMag r(hi.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < hi.size(); i++) {
+        uint64_t t = (uint64_t)hi[i] + (i < lo.size() ? lo[i] : 0) + carry;
+        r[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    r[hi.size()] = (uint32_t)carry;
+    trim(r);
+    return r;
+}
+
+// a - b, for a >= b
+static RalMag subMag(const RalMag &a, const RalMag &b)
+{
+    RalMag r(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        int64_t t = (int64_t)a[i] - (i < b.size() ? b[i] : 0) - borrow;
+        borrow = (t < 0) ? 1 : 0;
+        r[i] = (uint32_t)(t + (borrow << 32));
+    }
+    trim(r);
+    return r;
+}
+
+// r[shift..] += a
+static void addShifted(RalMag &r, const RalMag &a, size_t shift)
+{
+    if (r.size() < a.size() + shift + 1) {
+        r.resize(a.size() + shift + 1, 0);
+    }
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < a.size(); i++) {
+        uint64_t t = (uint64_t)r[i + shift] + a[i] + carry;
+        r[i + shift] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    for (i += shift; carry != 0; i++) {
+        if (i == r.size()) {
+            r.push_back(0);
+        }
+        uint64_t t = (uint64_t)r[i] + carry;
+        r[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+}
+
+static RalMag schoolbookMul(const uint32_t *a, size_t na, const uint32_t *b,
+                            size_t nb)
+{
+    RalMag r(na + nb, 0);
+    for (size_t i = 0; i < na; i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < nb; j++) {
+            uint64_t t = (uint64_t)a[i] * b[j] + r[i + j] + carry;
+            r[i + j] = (uint32_t)t;
+            carry = t >> 32;
+        }
+        r[i + nb] = (uint32_t)carry;
+    }
+    trim(r);
+    return r;
+}
+
+// Karatsuba: with a = a1 B + a0 & b = b1 B + b0, a b is
+// z2 B^2 + z1 B + z0 where z0 = a0 b0, z2 = a1 b1 &
+// z1 = (a0 + a1)(b0 + b1) - z0 - z2, so 3 half size products instead of 4.
+static RalMag mulMag(const uint32_t *a, size_t na, const uint32_t *b,
+                     size_t nb)
+{
+    if ((na < RAL_KARATSUBA_LIMBS) || (nb < RAL_KARATSUBA_LIMBS)) {
+        return schoolbookMul(a, na, b, nb);
+    }
+    size_t half = std::max(na, nb) / 2;
+    auto split = [half](const uint32_t *x, size_t nx, RalMag &lo, RalMag &hi) {
+        lo.assign(x, x + std::min(half, nx));
+        if (nx > half) {
+            hi.assign(x + half, x + nx);
+        }
+        trim(lo);
+    };
+    RalMag a0, a1, b0, b1;
+    split(a, na, a0, a1);
+    split(b, nb, b0, b1);
+    auto z0 = mulMag(a0.data(), a0.size(), b0.data(), b0.size());
+    auto z2 = mulMag(a1.data(), a1.size(), b1.data(), b1.size());
+    auto sa = addMag(a0, a1);
+    auto sb = addMag(b0, b1);
+    auto z1 = subMag(subMag(mulMag(sa.data(), sa.size(), sb.data(), sb.size()),
+                            z0),
+                     z2);
+    RalMag r = z0;
+    addShifted(r, z1, half);
+    addShifted(r, z2, 2 * half);
+    trim(r);
+    return r;
+}
+
+// a / d for a single limb d, returning the remainder
+static RalMag divSmall(const RalMag &a, uint32_t d, uint32_t &rem)
+{
+    RalMag q(a.size());
+    uint64_t r = 0;
+    for (size_t i = a.size(); i-- > 0;) {
+        uint64_t t = (r << 32) | a[i];
+        q[i] = (uint32_t)(t / d);
+        r = t % d;
+    }
+    trim(q);
+    rem = (uint32_t)r;
+    return q;
+}
+
+static int leadingZeros(uint32_t x)
+{
+    int n = 0;
+    for (; (x & 0x80000000u) == 0; x <<= 1) {
+        n++;
+    }
+    return n;
+}
+
+// u / v by Knuth's algorithm D, for v with 2 or more limbs
+static RalMag divMag(const RalMag &u, const RalMag &v)
+{
+    if (compareMag(u, v) < 0) {
+        return RalMag();
+    }
+    size_t n = v.size();
+    size_t m = u.size();
+    // normalize so the top limb of v has its high bit set
+    int s = leadingZeros(v[n - 1]);
+    RalMag vn(n), un(m + 1);
+    for (size_t i = n - 1; i > 0; i--) {
+        vn[i] = (v[i] << s) | (s ? (uint32_t)((uint64_t)v[i - 1] >> (32 - s)) : 0);
+    }
+    vn[0] = v[0] << s;
+    un[m] = s ? (uint32_t)((uint64_t)u[m - 1] >> (32 - s)) : 0;
+    for (size_t i = m - 1; i > 0; i--) {
+        un[i] = (u[i] << s) | (s ? (uint32_t)((uint64_t)u[i - 1] >> (32 - s)) : 0);
+    }
+    un[0] = u[0] << s;
+
+    const uint64_t base = (uint64_t)1 << 32;
+    RalMag q(m - n + 1, 0);
+    for (size_t j = m - n + 1; j-- > 0;) {
+        // estimate the quotient limb from the top two limbs
+        uint64_t num = ((uint64_t)un[j + n] << 32) | un[j + n - 1];
+        uint64_t qhat = num / vn[n - 1];
+        uint64_t rhat = num % vn[n - 1];
+        while ((qhat >= base) ||
+               (qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2]))) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >= base) {
+                break;
+            }
+        }
+        // un -= qhat * vn
+        int64_t k = 0;
+        int64_t t;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t p = qhat * vn[i];
+            t = (int64_t)un[i + j] - k - (int64_t)(p & 0xffffffff);
+            un[i + j] = (uint32_t)t;
+            k = (int64_t)(p >> 32) - (t >> 32);
+        }
+        t = (int64_t)un[j + n] - k;
+        un[j + n] = (uint32_t)t;
+        q[j] = (uint32_t)qhat;
+        if (t < 0) {
+            // the estimate was one too many, so add vn back
+            q[j]--;
+            uint64_t carry = 0;
+            for (size_t i = 0; i < n; i++) {
+                uint64_t sum = (uint64_t)un[i + j] + vn[i] + carry;
+                un[i + j] = (uint32_t)sum;
+                carry = sum >> 32;
+            }
+            un[j + n] += (uint32_t)carry;
+        }
+    }
+    trim(q);
+    return q;
+}
+
+// ================================================================================
+// RalBig
+// ================================================================================
+RalBig::RalBig() : neg_(false) {}
+
+RalBig::RalBig(int64_t i) : neg_(i < 0)
+{
+    // negate as unsigned so INT64_MIN works
+    uint64_t u = neg_ ? (~(uint64_t)i + 1) : (uint64_t)i;
+    while (u != 0) {
+        mag_.push_back((uint32_t)u);
+        u >>= 32;
+    }
+}
+
+RalBig RalBig::parse(const std::string &s)
+{
+    RalBig r;
+    size_t i = 0;
+    bool neg = false;
+    if ((s.size() > 0) && ((s[0] == '-') || (s[0] == '+'))) {
+        neg = (s[0] == '-');
+        i = 1;
+    }
+    // 9 digits at a time
+    for (; i < s.size(); i += 9) {
+        size_t len = std::min((size_t)9, s.size() - i);
+        uint32_t chunk = 0;
+        uint32_t scale = 1;
+        for (size_t j = i; j < i + len; j++) {
+            chunk = chunk * 10 + (uint32_t)(s[j] - '0');
+            scale *= 10;
+        }
+        uint64_t carry = chunk;
+        for (auto &limb : r.mag_) {
+            uint64_t t = (uint64_t)limb * scale + carry;
+            limb = (uint32_t)t;
+            carry = t >> 32;
+        }
+        if (carry != 0) {
+            r.mag_.push_back((uint32_t)carry);
+        }
+    }
+    trim(r.mag_);
+    r.neg_ = neg && !r.isZero();
+    return r;
+}
+
+std::string RalBig::str() const
+{
+    if (isZero()) {
+        return "0";
+    }
+    std::vector<uint32_t> chunks; // 9 digits each, least significant first
+    RalMag a = mag_;
+    while (!a.empty()) {
+        uint32_t rem;
+        a = divSmall(a, 1000000000u, rem);
+        chunks.push_back(rem);
+    }
+    std::string s = neg_ ? "-" : "";
+    s += std::to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+        auto digits = std::to_string(chunks[i]);
+        s += std::string(9 - digits.size(), '0') + digits;
+    }
+    return s;
+}
+
+bool RalBig::fitsInt64() const
+{
+    if (mag_.size() <= 1) {
+        return true;
+    }
+    if (mag_.size() > 2) {
+        return false;
+    }
+    uint64_t u = ((uint64_t)mag_[1] << 32) | mag_[0];
+    return neg_ ? (u <= ((uint64_t)1 << 63)) : (u < ((uint64_t)1 << 63));
+}
+
+int64_t RalBig::toInt64() const
+{
+    uint64_t u = 0;
+    for (size_t i = mag_.size(); i-- > 0;) {
+        u = (u << 32) | mag_[i];
+    }
+    return neg_ ? (int64_t)(~u + 1) : (int64_t)u;
+}
+
+double RalBig::toDouble() const
+{
+    double d = 0.0;
+    for (size_t i = mag_.size(); i-- > 0;) {
+        d = d * 4294967296.0 + mag_[i];
+    }
+    return neg_ ? -d : d;
+}
+
+size_t RalBig::hash() const
+{
+    size_t h = neg_ ? 1 : 0;
+    for (auto limb : mag_) {
+        h ^= std::hash<uint32_t>()(limb) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    }
+    return h;
+}
+
+int compare(const RalBig &a, const RalBig &b)
+{
+    if (a.neg_ != b.neg_) {
+        return a.neg_ ? -1 : 1;
+    }
+    int c = compareMag(a.mag_, b.mag_);
+    return a.neg_ ? -c : c;
+}
+
+RalBig operator+(const RalBig &a, const RalBig &b)
+{
+    RalBig r;
+    if (a.neg_ == b.neg_) {
+        r.mag_ = addMag(a.mag_, b.mag_);
+        r.neg_ = a.neg_;
+    }
+    else if (compareMag(a.mag_, b.mag_) >= 0) {
+        r.mag_ = subMag(a.mag_, b.mag_);
+        r.neg_ = a.neg_;
+    }
+    else {
+        r.mag_ = subMag(b.mag_, a.mag_);
+        r.neg_ = b.neg_;
+    }
+    r.neg_ = r.neg_ && !r.isZero();
+    return r;
+}
+
+RalBig operator-(const RalBig &a, const RalBig &b)
+{
+    RalBig nb = b;
+    nb.neg_ = !b.neg_ && !b.isZero();
+    return a + nb;
+}
+
+RalBig operator*(const RalBig &a, const RalBig &b)
+{
+    RalBig r;
+    r.mag_ = mulMag(a.mag_.data(), a.mag_.size(), b.mag_.data(), b.mag_.size());
+    r.neg_ = (a.neg_ != b.neg_) && !r.isZero();
+    return r;
+}
+
+RalBig operator/(const RalBig &a, const RalBig &b)
+{
+    RalBig r;
+    if (b.mag_.size() == 1) {
+        uint32_t rem;
+        r.mag_ = divSmall(a.mag_, b.mag_[0], rem);
+    }
+    else {
+        r.mag_ = divMag(a.mag_, b.mag_);
+    }
+    r.neg_ = (a.neg_ != b.neg_) && !r.isZero();
+    return r;
+}
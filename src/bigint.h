@@ -0,0 +1,100 @@
+// ======================================================================
+// ral - Roger Allen's Lisp via https://github.com/kanaka/mal
+// Copyright(C) 2020 Roger Allen
+//
+// bigint.h - arbitrary precision integers
+//
+// ======================================================================
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The int64_t operations below return true if the result overflowed.
+#if defined(__GNUC__) || defined(__clang__)
+inline bool ralAddOverflow(int64_t a, int64_t b, int64_t *r)
+{
+    return __builtin_add_overflow(a, b, r);
+}
+inline bool ralSubOverflow(int64_t a, int64_t b, int64_t *r)
+{
+    return __builtin_sub_overflow(a, b, r);
+}
+inline bool ralMulOverflow(int64_t a, int64_t b, int64_t *r)
+{
+    return __builtin_mul_overflow(a, b, r);
+}
+#else
+inline bool ralAddOverflow(int64_t a, int64_t b, int64_t *r)
+{
+    if (((b > 0) && (a > INT64_MAX - b)) || ((b < 0) && (a < INT64_MIN - b))) {
+        return true;
+    }
+    *r = a + b;
+    return false;
+}
+inline bool ralSubOverflow(int64_t a, int64_t b, int64_t *r)
+{
+    if (((b < 0) && (a > INT64_MAX + b)) || ((b > 0) && (a < INT64_MIN + b))) {
+        return true;
+    }
+    *r = a - b;
+    return false;
+}
+inline bool ralMulOverflow(int64_t a, int64_t b, int64_t *r)
+{
+    if ((a != 0) && (b != 0)) {
+        if ((a == -1) || (b == -1)) {
+            if ((a == INT64_MIN) || (b == INT64_MIN)) {
+                return true;
+            }
+        }
+        else if (((a * b) / b) != a) {
+            return true;
+        }
+    }
+    *r = a * b;
+    return false;
+}
+#endif
+
+// ================================================================================
+// A sign & magnitude integer.  The magnitude is base 2^32 limbs, least
+// significant first, with no leading zero limbs, so zero has no limbs.
+class RalBig {
+    bool neg_;
+    std::vector<uint32_t> mag_;
+
+  public:
+    RalBig();
+    RalBig(int64_t i);
+    // s is an optional sign & decimal digits
+    static RalBig parse(const std::string &s);
+    std::string str() const;
+    bool isZero() const { return mag_.empty(); }
+    bool fitsInt64() const;
+    int64_t toInt64() const; // only if fitsInt64()
+    double toDouble() const;
+    size_t hash() const;
+    friend int compare(const RalBig &a, const RalBig &b);
+    friend RalBig operator+(const RalBig &a, const RalBig &b);
+    friend RalBig operator-(const RalBig &a, const RalBig &b);
+    friend RalBig operator*(const RalBig &a, const RalBig &b);
+    // truncates toward zero, like int64_t.  b must not be zero.
+    friend RalBig operator/(const RalBig &a, const RalBig &b);
+};
@@ -21,14 +21,30 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 // ======================================================================
 #include "core.h"
+#include "kernels.h"
+#include "native.h"
 #include "printer.h"
 #include "reader.h"
+#include <algorithm>
 #include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <cstdio>
+#include <exception>
 #include <fstream>
 #include <iostream>
+#include <random>
 #include <sstream>
+#include <thread>
+
+// mmap-array maps files where it can & reads them everywhere else
+#if defined(__unix__) || defined(__APPLE__)
+#define RAL_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // Another windows/Visual Studio compile issue
 #ifdef __linux__
@@ -39,8 +55,6 @@ bool Readline(const char *, std::string &);
 };
 #endif
 
-RalTypePtr apply(RalTypePtr mp);
-
 // ================================================================================
 // Setup ns: symbol -> function map
 // ================================================================================
@@ -49,9 +63,27 @@ const std::map<std::string, RalFunctionSignature> RalCore::ns = {
     {"-", ral_sub},
     {"*", ral_mul},
     {"/", ral_div},
-    {"sqrt", ral_sqrt_d},
-    {"sin", ral_sin_d},
-    {"cos", ral_cos_d},
+    defnative("sqrt",
+              [](RalTypePtr x) {
+                  return mapDouble(
+                      x, [](double d) { return std::sqrt(d); }, f64Sqrt);
+              }),
+    defnative("sin",
+              [](RalTypePtr x) {
+                  return mapDouble(
+                      x, [](double d) { return std::sin(d); }, f64Sin);
+              }),
+    defnative("cos",
+              [](RalTypePtr x) {
+                  return mapDouble(
+                      x, [](double d) { return std::cos(d); }, f64Cos);
+              }),
+    defnative("tan", [](double x) { return std::tan(x); }),
+    defnative("exp", [](double x) { return std::exp(x); }),
+    defnative("log", [](double x) { return std::log(x); }),
+    defnative("pow", [](double x, double y) { return std::pow(x, y); }),
+    defnative("floor", [](double x) { return std::floor(x); }),
+    defnative("ceil", [](double x) { return std::ceil(x); }),
     {"abs", ral_abs},
     {"list", ral_list},
     {"list?", ral_list_q},
@@ -68,6 +100,7 @@ const std::map<std::string, RalFunctionSignature> RalCore::ns = {
     {"println", ral_println},
     {"read-string", ral_read_string},
     {"slurp", ral_slurp},
+    {"delete-file", ral_delete_file},
     {"atom", ral_atom},
     {"atom?", ral_atom_q},
     {"deref", ral_deref},
@@ -108,7 +141,98 @@ const std::map<std::string, RalFunctionSignature> RalCore::ns = {
     {"number?", ral_number_q},
     {"seq", ral_seq},
     {"conj", ral_conj},
-    {"macro?", ral_macro_q}};
+    {"macro?", ral_macro_q},
+    {"transient", ral_transient},
+    {"conj!", ral_conj_bang},
+    {"assoc!", ral_assoc_bang},
+    {"dissoc!", ral_dissoc_bang},
+    {"persistent!", ral_persistent_bang},
+    {"disj!", ral_disj_bang},
+    {"set", ral_set},
+    {"hash-set", ral_hash_set},
+    {"set?", ral_set_q},
+    {"disj", ral_disj},
+    {"union", ral_union},
+    {"intersection", ral_intersection},
+    {"difference", ral_difference},
+    {"record-type", ral_record_type},
+    {"record", ral_record},
+    {"map->record", ral_map_to_record},
+    {"record?", ral_record_q},
+    {"sorted-map", ral_sorted_map},
+    {"sorted-map-by", ral_sorted_map_by},
+    {"sorted?", ral_sorted_q},
+    {"subseq", ral_subseq},
+    {"rsubseq", ral_rsubseq},
+    {"first-key", ral_first_key},
+    {"last-key", ral_last_key},
+    {"lazy-seq*", ral_lazy_seq_star},
+    {"lazy-seq?", ral_lazy_seq_q},
+    {"range", ral_range},
+    {"iterate", ral_iterate},
+    {"repeat", ral_repeat},
+    {"take", ral_take},
+    {"drop", ral_drop},
+    {"take-while", ral_take_while},
+    {"filter", ral_filter},
+    {"remove", ral_remove},
+    {"keep", ral_keep},
+    {"reduce", ral_reduce},
+    {"foldr", ral_foldr},
+    {"every?", ral_every_q},
+    {"some", ral_some},
+    {"partition-all", ral_partition_all},
+    {"comp", ral_comp},
+    {"transduce", ral_transduce},
+    {"into", ral_into},
+    {"sequence", ral_sequence},
+    {"memoize", ral_memoize},
+    {"memo-stats", ral_memo_stats},
+    {"compare", ral_compare},
+    {"sort", ral_sort},
+    {"sort-by", ral_sort_by},
+    {"sort-with", ral_sort_with},
+    {"f64-array", ral_f64_array},
+    {"i64-array", ral_i64_array},
+    {"array?", ral_array_q},
+    {"vec", ral_vec},
+    {"sum", ral_sum},
+    {"dot", ral_dot},
+    {"min", ral_min},
+    {"max", ral_max},
+    {"matrix", ral_matrix},
+    {"matrix?", ral_matrix_q},
+    {"identity-matrix", ral_identity_matrix},
+    {"shape", ral_shape},
+    {"mget", ral_mget},
+    {"row", ral_row},
+    {"col", ral_col},
+    {"transpose", ral_transpose},
+    {"matmul", ral_matmul},
+    {"solve", ral_solve},
+    {"rng", ral_rng},
+    {"rng?", ral_rng_q},
+    {"rand-int", ral_rand_int},
+    {"rand-double", ral_rand_double},
+    {"split", ral_split},
+    {"rand-doubles", ral_rand_doubles},
+    {"rand-ints", ral_rand_ints},
+    {"save-array", ral_save_array},
+    {"mmap-array", ral_mmap_array},
+    {"table", ral_table},
+    {"table?", ral_is_table},
+    {"table->maps", ral_table_to_maps},
+    {"columns", ral_columns},
+    {"column", ral_column},
+    {"select", ral_select},
+    {"where", ral_where},
+    {"group-by", ral_group_by},
+    {"join", ral_join},
+    {"protocol-fn", ral_protocol_fn},
+    {"multi-fn", ral_multi_fn},
+    {"add-method", ral_add_method},
+    {"extend", ral_extend},
+    {"type", ral_type}};
 
 // ================================================================================
 // CHECKS
@@ -152,195 +276,797 @@ void checkArgsOdd(const char *name, size_t num)
 }
 
 // ================================================================================
-// Core Functions
+// Lazy Seq Generators
 // ================================================================================
-enum arithmetic_type { INTEGER, DOUBLE };
-RalTypePtr ral_add(RalTypeIter begin, RalTypeIter end)
-{
-    checkArgsAtLeast("+", 1, std::distance(begin, end));
-    RalTypeIter iter = begin;
-    arithmetic_type atype = INTEGER;
-    if ((*iter)->kind() == RalKind::DOUBLE) {
-        atype = DOUBLE;
+// Calls fn over and over, as the sequence functions do.  The argument vector
+// is reused between calls and builtins are called directly, without the kind
+// check in invoke().
+class RalCaller {
+    RalTypePtr fn_;
+    const RalFunctionSignature *native_;
+    std::vector<RalTypePtr> args_;
+
+  public:
+    RalCaller(RalTypePtr fn, size_t numArgs) : fn_(fn), native_(nullptr)
+    {
+        if (fn->kind() == RalKind::FUNCTION) {
+            native_ = &std::static_pointer_cast<RalFunction>(fn)->signature();
+        }
+        args_.resize(numArgs);
     }
-    int64_t i_value;
-    double d_value;
-    if (atype == DOUBLE) {
-        d_value = (**(iter++)).asDouble();
+    RalTypePtr call()
+    {
+        if (native_ != nullptr) {
+            return (*native_)(args_.data(), args_.data() + args_.size());
+        }
+        return invoke(fn_, args_);
     }
-    else {
-        i_value = (**(iter++)).asInt();
+    RalTypePtr call(RalTypePtr a)
+    {
+        args_[0] = a;
+        return call();
     }
-    for (; iter != end;) {
-        if ((atype == INTEGER) && (*iter)->kind() == RalKind::DOUBLE) {
-            atype = DOUBLE;
-            d_value = (double)i_value;
-        }
-        if (atype == DOUBLE) {
-            d_value += (**(iter++)).asDouble();
+    RalTypePtr call(RalTypePtr a, RalTypePtr b)
+    {
+        args_[0] = a;
+        args_[1] = b;
+        return call();
+    }
+    std::vector<RalTypePtr> &args() { return args_; }
+};
+
+class RalRangeGen : public RalLazyGen {
+    bool isDouble_;
+    bool bounded_;
+    int64_t i_, iEnd_, iStep_;
+    double d_, dEnd_, dStep_;
+
+  public:
+    RalRangeGen(RalTypePtr start, RalTypePtr end, RalTypePtr step)
+        : bounded_(end != nullptr)
+    {
+        isDouble_ = (start->kind() == RalKind::DOUBLE) ||
+                    (bounded_ && (end->kind() == RalKind::DOUBLE)) ||
+                    (step->kind() == RalKind::DOUBLE);
+        if (isDouble_) {
+            d_ = start->asDouble();
+            dEnd_ = bounded_ ? end->asDouble() : 0.0;
+            dStep_ = step->asDouble();
         }
         else {
-            i_value += (**(iter++)).asInt();
+            i_ = start->asInt();
+            iEnd_ = bounded_ ? end->asInt() : 0;
+            iStep_ = step->asInt();
         }
     }
-    RalTypePtr mp;
-    if (atype == DOUBLE) {
-        mp = std::make_shared<RalDouble>(d_value);
+    bool next(std::vector<RalTypePtr> &items, size_t n) override
+    {
+        for (; n > 0; n--) {
+            if (isDouble_) {
+                if (bounded_ && (((dStep_ > 0) && (d_ >= dEnd_)) ||
+                                 ((dStep_ < 0) && (d_ <= dEnd_)))) {
+                    return false;
+                }
+                items.push_back(std::make_shared<RalDouble>(d_));
+                d_ += dStep_;
+            }
+            else {
+                if (bounded_ && (((iStep_ > 0) && (i_ >= iEnd_)) ||
+                                 ((iStep_ < 0) && (i_ <= iEnd_)))) {
+                    return false;
+                }
+                items.push_back(std::make_shared<RalInteger>(i_));
+                i_ += iStep_;
+            }
+        }
+        return true;
     }
-    else {
-        mp = std::make_shared<RalInteger>(i_value);
+};
+
+class RalIterateGen : public RalLazyGen {
+    RalCaller fn_;
+    RalTypePtr x_;
+    bool started_;
+
+  public:
+    RalIterateGen(RalTypePtr fn, RalTypePtr x)
+        : fn_(fn, 1), x_(x), started_(false)
+    {
     }
-    return mp;
-}
+    bool next(std::vector<RalTypePtr> &items, size_t n) override
+    {
+        for (; n > 0; n--) {
+            // only call fn for items that are asked for
+            if (started_) {
+                x_ = fn_.call(x_);
+            }
+            started_ = true;
+            items.push_back(x_);
+        }
+        return true;
+    }
+};
 
-// ================================================================================
-RalTypePtr ral_sub(RalTypeIter begin, RalTypeIter end)
-{
-    checkArgsAtLeast("-", 1, std::distance(begin, end));
-    RalTypeIter iter = begin;
-    arithmetic_type atype = INTEGER;
-    if ((*iter)->kind() == RalKind::DOUBLE) {
-        atype = DOUBLE;
+class RalRepeatGen : public RalLazyGen {
+    RalTypePtr x_;
+    bool bounded_;
+    int64_t remaining_;
+
+  public:
+    RalRepeatGen(RalTypePtr x, bool bounded, int64_t remaining)
+        : x_(x), bounded_(bounded), remaining_(remaining)
+    {
     }
-    int64_t i_value;
-    double d_value;
-    if (atype == DOUBLE) {
-        d_value = (**(iter++)).asDouble();
+    bool next(std::vector<RalTypePtr> &items, size_t n) override
+    {
+        for (; n > 0; n--) {
+            if (bounded_ && (remaining_ <= 0)) {
+                return false;
+            }
+            items.push_back(x_);
+            remaining_--;
+        }
+        return true;
     }
-    else {
-        i_value = (**(iter++)).asInt();
+};
+
+class RalTakeGen : public RalLazyGen {
+    RalSeqCursor cursor_;
+    int64_t remaining_;
+
+  public:
+    RalTakeGen(RalTypePtr coll, int64_t n)
+        : cursor_("take", coll), remaining_(n)
+    {
     }
-    for (; iter != end;) {
-        if ((atype == INTEGER) && (*iter)->kind() == RalKind::DOUBLE) {
-            atype = DOUBLE;
-            d_value = (double)i_value;
+    bool next(std::vector<RalTypePtr> &items, size_t n) override
+    {
+        RalTypePtr item;
+        for (; n > 0; n--) {
+            // check the count first so no extra item is realized
+            if ((remaining_ <= 0) || !cursor_.next(item)) {
+                return false;
+            }
+            items.push_back(item);
+            remaining_--;
         }
-        if (atype == DOUBLE) {
-            d_value -= (**(iter++)).asDouble();
+        return true;
+    }
+};
+
+class RalDropGen : public RalLazyGen {
+    RalSeqCursor cursor_;
+    int64_t toDrop_;
+
+  public:
+    RalDropGen(RalTypePtr coll, int64_t n) : cursor_("drop", coll), toDrop_(n)
+    {
+    }
+    bool next(std::vector<RalTypePtr> &items, size_t n) override
+    {
+        RalTypePtr item;
+        for (; toDrop_ > 0; toDrop_--) {
+            if (!cursor_.next(item)) {
+                return false;
+            }
         }
-        else {
-            i_value -= (**(iter++)).asInt();
+        for (; n > 0; n--) {
+            if (!cursor_.next(item)) {
+                return false;
+            }
+            items.push_back(item);
         }
+        return true;
     }
-    RalTypePtr mp;
-    if (atype == DOUBLE) {
-        mp = std::make_shared<RalDouble>(d_value);
+};
+
+class RalTakeWhileGen : public RalLazyGen {
+    RalCaller pred_;
+    RalSeqCursor cursor_;
+
+  public:
+    RalTakeWhileGen(RalTypePtr pred, RalTypePtr coll)
+        : pred_(pred, 1), cursor_("take-while", coll)
+    {
     }
-    else {
-        mp = std::make_shared<RalInteger>(i_value);
+    bool next(std::vector<RalTypePtr> &items, size_t n) override
+    {
+        RalTypePtr item;
+        for (; n > 0; n--) {
+            if (!cursor_.next(item) || pred_.call(item)->isNilOrFalse()) {
+                return false;
+            }
+            items.push_back(item);
+        }
+        return true;
     }
-    return mp;
+};
+
+// maps fn over one or more seqs, until the shortest one runs out
+class RalMapGen : public RalLazyGen {
+    RalCaller fn_;
+    std::vector<RalSeqCursor> cursors_;
+
+  public:
+    RalMapGen(RalTypePtr fn, RalTypeIter begin, RalTypeIter end)
+        : fn_(fn, std::distance(begin, end))
+    {
+        for (auto iter = begin; iter != end; iter++) {
+            cursors_.emplace_back("map", *iter);
+        }
+    }
+    bool next(std::vector<RalTypePtr> &items, size_t n) override
+    {
+        auto &args = fn_.args();
+        for (; n > 0; n--) {
+            for (size_t i = 0; i < cursors_.size(); i++) {
+                if (!cursors_[i].next(args[i])) {
+                    return false;
+                }
+            }
+            items.push_back(fn_.call());
+        }
+        return true;
+    }
+};
+
+// The generators below look at n input items per call, so a chunk may hold
+// fewer than n items, or none at all.
+
+// the non-nil results of calling fn on each item
+class RalKeepGen : public RalLazyGen {
+    RalCaller fn_;
+    RalSeqCursor cursor_;
+
+  public:
+    RalKeepGen(RalTypePtr fn, RalTypePtr coll) : fn_(fn, 1), cursor_("keep", coll)
+    {
+    }
+    bool next(std::vector<RalTypePtr> &items, size_t n) override
+    {
+        RalTypePtr item;
+        for (; n > 0; n--) {
+            if (!cursor_.next(item)) {
+                return false;
+            }
+            auto result = fn_.call(item);
+            if (!isNil(result)) {
+                items.push_back(result);
+            }
+        }
+        return true;
+    }
+};
+
+// filter keeps the items that pass pred, remove keeps the ones that fail
+class RalFilterGen : public RalLazyGen {
+    RalCaller pred_;
+    RalSeqCursor cursor_;
+    bool keepPassing_;
+
+  public:
+    RalFilterGen(const char *name, RalTypePtr pred, RalTypePtr coll,
+                 bool keepPassing)
+        : pred_(pred, 1), cursor_(name, coll), keepPassing_(keepPassing)
+    {
+    }
+    bool next(std::vector<RalTypePtr> &items, size_t n) override
+    {
+        RalTypePtr item;
+        for (; n > 0; n--) {
+            if (!cursor_.next(item)) {
+                return false;
+            }
+            if (pred_.call(item)->isNilOrFalse() != keepPassing_) {
+                items.push_back(item);
+            }
+        }
+        return true;
+    }
+};
+
+// ================================================================================
+// Transducer Pipelines
+// ================================================================================
+// Runs items through the stages of a transducer one at a time, so no stage
+// builds an intermediate collection.  Items that make it through every stage
+// are passed to sink.
+class RalXformRun {
+    struct StageState {
+        RalXformStage stage_;
+        std::unique_ptr<RalCaller> caller_;
+        int64_t count_;
+        bool closed_; // take & take-while stop letting items through
+        std::vector<RalTypePtr> buf_;
+    };
+    std::vector<StageState> stages_;
+    std::function<void(RalTypePtr)> sink_;
+    bool done_;
+
+  public:
+    RalXformRun(std::shared_ptr<RalTransducer> xf,
+                std::function<void(RalTypePtr)> sink)
+        : sink_(sink), done_(false)
+    {
+        for (auto &stage : xf->stages()) {
+            StageState state;
+            state.stage_ = stage;
+            if (stage.fn_ != nullptr) {
+                state.caller_.reset(new RalCaller(stage.fn_, 1));
+            }
+            state.count_ = 0;
+            state.closed_ = false;
+            stages_.push_back(std::move(state));
+        }
+    }
+    // true once no more input can get through
+    bool done() { return done_; }
+    void push(RalTypePtr item) { push(item, 0); }
+    void push(RalTypePtr item, size_t from)
+    {
+        for (size_t i = from; i < stages_.size(); i++) {
+            auto &st = stages_[i];
+            if (st.closed_) {
+                return;
+            }
+            switch (st.stage_.op_) {
+            case RalXformStage::MAP:
+                item = st.caller_->call(item);
+                break;
+            case RalXformStage::FILTER:
+                if (st.caller_->call(item)->isNilOrFalse()) {
+                    return;
+                }
+                break;
+            case RalXformStage::REMOVE:
+                if (!st.caller_->call(item)->isNilOrFalse()) {
+                    return;
+                }
+                break;
+            case RalXformStage::KEEP:
+                item = st.caller_->call(item);
+                if (isNil(item)) {
+                    return;
+                }
+                break;
+            case RalXformStage::TAKE:
+                if (st.count_ >= st.stage_.n_) {
+                    st.closed_ = done_ = true;
+                    return;
+                }
+                if (++st.count_ >= st.stage_.n_) {
+                    // this item still goes on, but nothing after it
+                    st.closed_ = done_ = true;
+                }
+                break;
+            case RalXformStage::DROP:
+                if (st.count_ < st.stage_.n_) {
+                    st.count_++;
+                    return;
+                }
+                break;
+            case RalXformStage::TAKE_WHILE:
+                if (st.caller_->call(item)->isNilOrFalse()) {
+                    st.closed_ = done_ = true;
+                    return;
+                }
+                break;
+            case RalXformStage::PARTITION_ALL: {
+                st.buf_.push_back(item);
+                if ((int64_t)st.buf_.size() < st.stage_.n_) {
+                    return;
+                }
+                item = flush(st);
+                break;
+            }
+            }
+        }
+        sink_(item);
+    }
+    // at the end of the input, partial partitions are passed on
+    void finish()
+    {
+        for (size_t i = 0; i < stages_.size(); i++) {
+            auto &st = stages_[i];
+            if ((st.stage_.op_ == RalXformStage::PARTITION_ALL) &&
+                !st.buf_.empty()) {
+                push(flush(st), i + 1);
+            }
+        }
+    }
+
+  private:
+    RalTypePtr flush(StageState &st)
+    {
+        auto mp = std::make_shared<RalList>('[');
+        mp->reserve(st.buf_.size());
+        for (auto &v : st.buf_) {
+            mp->add(v);
+        }
+        st.buf_.clear();
+        return mp;
+    }
+};
+
+// runs a transducer over a seq, for sequence
+class RalXformGen : public RalLazyGen {
+    RalSeqCursor cursor_;
+    std::vector<RalTypePtr> *out_;
+    RalXformRun run_;
+
+  public:
+    RalXformGen(std::shared_ptr<RalTransducer> xf, RalTypePtr coll)
+        : cursor_("sequence", coll), out_(nullptr),
+          run_(xf, [this](RalTypePtr item) { out_->push_back(item); })
+    {
+    }
+    bool next(std::vector<RalTypePtr> &items, size_t n) override
+    {
+        out_ = &items;
+        RalTypePtr item;
+        for (; n > 0; n--) {
+            if (run_.done() || !cursor_.next(item)) {
+                run_.finish();
+                return false;
+            }
+            run_.push(item);
+        }
+        return true;
+    }
+};
+
+// makes a single stage transducer
+RalTypePtr makeXform(RalXformStage::Op op, RalTypePtr fn, int64_t n)
+{
+    RalXformStage stage;
+    stage.op_ = op;
+    stage.fn_ = fn;
+    stage.n_ = n;
+    return std::make_shared<RalTransducer>(
+        std::vector<RalXformStage>{stage});
+}
+
+std::shared_ptr<RalTransducer> xformArg(const char *name, RalTypePtr xf)
+{
+    if (xf->kind() != RalKind::TRANSDUCER) {
+        throw RalException(std::string("'") + name +
+                           "' requires a transducer.");
+    }
+    return std::static_pointer_cast<RalTransducer>(xf);
 }
 
 // ================================================================================
-RalTypePtr ral_mul(RalTypeIter begin, RalTypeIter end)
+// Core Functions
+// ================================================================================
+template <typename Op>
+RalTypePtr arrayArithmetic(const char *name, RalTypeIter begin,
+                           RalTypeIter end);
+template <typename Op>
+RalTypePtr matrixArithmetic(const char *name, RalTypeIter begin,
+                            RalTypeIter end);
+
+// Folds the rest of the arguments into acc, in bigints until the first double
+// & in doubles from then on.
+template <typename Op>
+RalTypePtr bigArithmetic(RalBig acc, RalTypeIter iter, RalTypeIter end)
+{
+    for (; iter != end; iter++) {
+        if ((*iter)->kind() == RalKind::DOUBLE) {
+            double d_value = Op::apply(acc.toDouble(), (*iter++)->asDouble());
+            for (; iter != end; iter++) {
+                d_value = Op::apply(d_value, (*iter)->asDouble());
+            }
+            return std::make_shared<RalDouble>(d_value);
+        }
+        acc = Op::apply(acc, bigValue(*iter));
+    }
+    return makeInteger(acc);
+}
+
+// Folds the arguments with Op, in integers until the first double & in
+// doubles from then on, so each argument's kind is only checked once.  An
+// integer overflow or a BIGINT argument switches to bigints, and the result
+// goes back to an INTEGER if it fits.
+template <typename Op>
+RalTypePtr arithmetic(const char *name, RalTypeIter begin, RalTypeIter end)
 {
-    checkArgsAtLeast("*", 1, std::distance(begin, end));
+    checkArgsAtLeast(name, 1, std::distance(begin, end));
+    for (auto iter = begin; iter != end; iter++) {
+        if (isArray((*iter)->kind())) {
+            return arrayArithmetic<Op>(name, begin, end);
+        }
+        if ((*iter)->kind() == RalKind::MATRIX) {
+            return matrixArithmetic<Op>(name, begin, end);
+        }
+    }
     RalTypeIter iter = begin;
-    arithmetic_type atype = INTEGER;
-    if ((*iter)->kind() == RalKind::DOUBLE) {
-        atype = DOUBLE;
+    if ((*iter)->kind() == RalKind::BIGINT) {
+        return bigArithmetic<Op>(bigValue(*iter), iter + 1, end);
     }
-    int64_t i_value;
-    double d_value;
-    if (atype == DOUBLE) {
-        d_value = (**(iter++)).asDouble();
+    if ((*iter)->kind() != RalKind::DOUBLE) {
+        int64_t i_value = (*iter++)->asInt();
+        int64_t next;
+        for (; iter != end; iter++) {
+            auto kind = (*iter)->kind();
+            if ((kind == RalKind::DOUBLE) || (kind == RalKind::BIGINT) ||
+                Op::overflow(i_value, (*iter)->asInt(), &next)) {
+                break;
+            }
+            i_value = next;
+        }
+        if (iter == end) {
+            return std::make_shared<RalInteger>(i_value);
+        }
+        if ((*iter)->kind() != RalKind::DOUBLE) {
+            return bigArithmetic<Op>(RalBig(i_value), iter, end);
+        }
+        double d_value = Op::apply((double)i_value, (*iter++)->asDouble());
+        for (; iter != end; iter++) {
+            d_value = Op::apply(d_value, (*iter)->asDouble());
+        }
+        return std::make_shared<RalDouble>(d_value);
     }
-    else {
-        i_value = (**(iter++)).asInt();
+    double d_value = (*iter++)->asDouble();
+    for (; iter != end; iter++) {
+        d_value = Op::apply(d_value, (*iter)->asDouble());
+    }
+    return std::make_shared<RalDouble>(d_value);
+}
+
+// apply works on doubles & RalBigs.  overflow sets *r to a op b & returns
+// false, or returns true if that does not fit in an int64_t.
+struct RalAddOp {
+    static constexpr RalKernelOp kernel = RalKernelOp::ADD;
+    template <typename T> static T apply(const T &a, const T &b)
+    {
+        return a + b;
+    }
+    static bool overflow(int64_t a, int64_t b, int64_t *r)
+    {
+        return ralAddOverflow(a, b, r);
+    }
+};
+struct RalSubOp {
+    static constexpr RalKernelOp kernel = RalKernelOp::SUB;
+    template <typename T> static T apply(const T &a, const T &b)
+    {
+        return a - b;
     }
-    for (; iter != end;) {
-        if ((atype == INTEGER) && (*iter)->kind() == RalKind::DOUBLE) {
-            atype = DOUBLE;
-            d_value = (double)i_value;
+    static bool overflow(int64_t a, int64_t b, int64_t *r)
+    {
+        return ralSubOverflow(a, b, r);
+    }
+};
+struct RalMulOp {
+    static constexpr RalKernelOp kernel = RalKernelOp::MUL;
+    template <typename T> static T apply(const T &a, const T &b)
+    {
+        return a * b;
+    }
+    static bool overflow(int64_t a, int64_t b, int64_t *r)
+    {
+        return ralMulOverflow(a, b, r);
+    }
+};
+struct RalDivOp {
+    static constexpr RalKernelOp kernel = RalKernelOp::DIV;
+    static double apply(double a, double b) { return a / b; }
+    static RalBig apply(const RalBig &a, const RalBig &b)
+    {
+        if (b.isZero()) {
+            throw RalException("'/' integer division by zero.");
+        }
+        return a / b;
+    }
+    static bool overflow(int64_t a, int64_t b, int64_t *r)
+    {
+        if (b == 0) {
+            throw RalException("'/' integer division by zero.");
+        }
+        if ((a == INT64_MIN) && (b == -1)) {
+            return true;
         }
-        if (atype == DOUBLE) {
-            d_value *= (**(iter++)).asDouble();
+        *r = a / b;
+        return false;
+    }
+};
+
+void checkDivisors(const char *name, const int64_t *b, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (b[i] == 0) {
+            throw RalException(std::string("'") + name +
+                               "' integer division by zero.");
+        }
+    }
+}
+
+// acc = acc op x, or x op acc when left is true
+void arrayScalar(const char *name, RalKernelOp op,
+                 std::shared_ptr<RalArray> acc, RalTypePtr x, bool left)
+{
+    size_t n = acc->size();
+    if (acc->elem() == RalArray::F64) {
+        if (left) {
+            f64ScalarLeft(op, acc->f64(), x->asDouble(), n);
         }
         else {
-            i_value *= (**(iter++)).asInt();
+            f64Scalar(op, acc->f64(), x->asDouble(), n);
         }
+        return;
     }
-    RalTypePtr mp;
-    if (atype == DOUBLE) {
-        mp = std::make_shared<RalDouble>(d_value);
+    int64_t b = x->asInt();
+    if (op == RalKernelOp::DIV) {
+        if (left) {
+            checkDivisors(name, acc->i64(), n);
+        }
+        else {
+            checkDivisors(name, &b, 1);
+        }
     }
-    else {
-        mp = std::make_shared<RalInteger>(i_value);
+    bool ok = left ? i64ScalarLeft(op, acc->i64(), b, n)
+                   : i64Scalar(op, acc->i64(), b, n);
+    if (!ok) {
+        throw RalException(std::string("'") + name +
+                           "' integer overflow in an i64 array.");
     }
-    return mp;
 }
 
-// ================================================================================
-RalTypePtr ral_div(RalTypeIter begin, RalTypeIter end)
+// acc = acc op b, item by item
+void arrayArray(const char *name, RalKernelOp op,
+                std::shared_ptr<RalArray> acc, std::shared_ptr<RalArray> b)
 {
-    checkArgsAtLeast("/", 1, std::distance(begin, end));
-    RalTypeIter iter = begin;
-    arithmetic_type atype = INTEGER;
-    if ((*iter)->kind() == RalKind::DOUBLE) {
-        atype = DOUBLE;
+    size_t n = acc->size();
+    if (acc->elem() == RalArray::I64) {
+        if (op == RalKernelOp::DIV) {
+            checkDivisors(name, b->i64(), n);
+        }
+        if (!i64Binary(op, acc->i64(), b->i64(), n)) {
+            throw RalException(std::string("'") + name +
+                               "' integer overflow in an i64 array.");
+        }
     }
-    int64_t i_value;
-    double d_value;
-    if (atype == DOUBLE) {
-        d_value = (**(iter++)).asDouble();
+    else if (b->elem() == RalArray::F64) {
+        f64Binary(op, acc->f64(), b->f64(), n);
     }
     else {
-        i_value = (**(iter++)).asInt();
+        RalArray converted(RalArray::F64, b);
+        f64Binary(op, acc->f64(), converted.f64(), n);
+    }
+}
+
+// Arithmetic with at least one typed array.  Numbers are broadcast across the
+// arrays, which must all be the same length.  The result is an i64 array
+// unless there is a double or an f64 array anywhere in the arguments.
+template <typename Op>
+RalTypePtr arrayArithmetic(const char *name, RalTypeIter begin,
+                           RalTypeIter end)
+{
+    if (std::distance(begin, end) == 1) {
+        return *begin;
     }
-    for (; iter != end;) {
-        if ((atype == INTEGER) && (*iter)->kind() == RalKind::DOUBLE) {
-            atype = DOUBLE;
-            d_value = (double)i_value;
+    auto elem = RalArray::I64;
+    std::shared_ptr<RalArray> sized;
+    for (auto iter = begin; iter != end; iter++) {
+        auto kind = (*iter)->kind();
+        if (isArray(kind)) {
+            auto a = std::static_pointer_cast<RalArray>(*iter);
+            if ((sized != nullptr) && (a->size() != sized->size())) {
+                throw RalException(std::string("'") + name +
+                                   "' requires arrays of the same length.");
+            }
+            sized = a;
+        }
+        if ((kind == RalKind::DOUBLE) || (kind == RalKind::F64_ARRAY)) {
+            elem = RalArray::F64;
         }
-        if (atype == DOUBLE) {
-            d_value /= (**(iter++)).asDouble();
+        else if ((kind != RalKind::INTEGER) && (kind != RalKind::I64_ARRAY)) {
+            throw RalException(std::string("'") + name +
+                               "' requires numbers or typed arrays.");
+        }
+    }
+    // the numbers before the first array fold into one on its left
+    auto iter = begin;
+    while (!isArray((*iter)->kind())) {
+        iter++;
+    }
+    RalTypePtr left;
+    if (iter != begin) {
+        left = arithmetic<Op>(name, begin, iter);
+    }
+    auto acc = std::make_shared<RalArray>(
+        elem, std::static_pointer_cast<RalArray>(*iter++));
+    if (left != nullptr) {
+        arrayScalar(name, Op::kernel, acc, left, true);
+    }
+    for (; iter != end; iter++) {
+        if (isArray((*iter)->kind())) {
+            arrayArray(name, Op::kernel, acc,
+                       std::static_pointer_cast<RalArray>(*iter));
         }
         else {
-            i_value /= (**(iter++)).asInt();
+            arrayScalar(name, Op::kernel, acc, *iter, false);
         }
     }
-    RalTypePtr mp;
-    if (atype == DOUBLE) {
-        mp = std::make_shared<RalDouble>(d_value);
+    return acc;
+}
+
+// Arithmetic with at least one matrix, item by item.  Numbers are broadcast
+// across the matrices, which must all be the same shape.
+template <typename Op>
+RalTypePtr matrixArithmetic(const char *name, RalTypeIter begin,
+                            RalTypeIter end)
+{
+    if (std::distance(begin, end) == 1) {
+        return *begin;
     }
-    else {
-        mp = std::make_shared<RalInteger>(i_value);
+    std::shared_ptr<RalMatrix> shaped;
+    for (auto iter = begin; iter != end; iter++) {
+        auto kind = (*iter)->kind();
+        if (kind == RalKind::MATRIX) {
+            auto m = std::static_pointer_cast<RalMatrix>(*iter);
+            if ((shaped != nullptr) && ((m->rows() != shaped->rows()) ||
+                                        (m->cols() != shaped->cols()))) {
+                throw RalException(std::string("'") + name +
+                                   "' requires matrices of the same shape.");
+            }
+            shaped = m;
+        }
+        else if ((kind != RalKind::INTEGER) && (kind != RalKind::DOUBLE)) {
+            throw RalException(std::string("'") + name +
+                               "' requires numbers or matrices.");
+        }
     }
-    return mp;
+    // the numbers before the first matrix fold into one on its left
+    auto iter = begin;
+    while ((*iter)->kind() != RalKind::MATRIX) {
+        iter++;
+    }
+    RalTypePtr left;
+    if (iter != begin) {
+        left = arithmetic<Op>(name, begin, iter);
+    }
+    auto acc = std::static_pointer_cast<RalMatrix>(*iter++)->copy();
+    if (left != nullptr) {
+        f64ScalarLeft(Op::kernel, acc->data(), left->asDouble(), acc->size());
+    }
+    for (; iter != end; iter++) {
+        if ((*iter)->kind() == RalKind::MATRIX) {
+            auto b = std::static_pointer_cast<RalMatrix>(*iter);
+            if (!b->isContiguous()) {
+                b = b->copy();
+            }
+            f64Binary(Op::kernel, acc->data(), b->data(), acc->size());
+        }
+        else {
+            f64Scalar(Op::kernel, acc->data(), (*iter)->asDouble(),
+                      acc->size());
+        }
+    }
+    return acc;
+}
+
+RalTypePtr ral_add(RalTypeIter begin, RalTypeIter end)
+{
+    return arithmetic<RalAddOp>("+", begin, end);
 }
 
 // ================================================================================
-RalTypePtr ral_sqrt_d(RalTypeIter begin, RalTypeIter end)
+RalTypePtr ral_sub(RalTypeIter begin, RalTypeIter end)
 {
-    checkArgsEqual("sqrt", 1, std::distance(begin, end));
-    RalTypeIter iter = begin;
-    double value = (**(iter++)).asDouble();
-    value = sqrt(value);
-    RalTypePtr mp = std::make_shared<RalDouble>(value);
-    return mp;
+    return arithmetic<RalSubOp>("-", begin, end);
 }
 
 // ================================================================================
-RalTypePtr ral_sin_d(RalTypeIter begin, RalTypeIter end)
+RalTypePtr ral_mul(RalTypeIter begin, RalTypeIter end)
 {
-    checkArgsEqual("sin", 1, std::distance(begin, end));
-    RalTypeIter iter = begin;
-    double value = (**(iter++)).asDouble();
-    value = sin(value);
-    RalTypePtr mp = std::make_shared<RalDouble>(value);
-    return mp;
+    return arithmetic<RalMulOp>("*", begin, end);
 }
 
 // ================================================================================
-RalTypePtr ral_cos_d(RalTypeIter begin, RalTypeIter end)
+RalTypePtr ral_div(RalTypeIter begin, RalTypeIter end)
 {
-    checkArgsEqual("cos", 1, std::distance(begin, end));
-    RalTypeIter iter = begin;
-    double value = (**(iter++)).asDouble();
-    value = cos(value);
-    RalTypePtr mp = std::make_shared<RalDouble>(value);
-    return mp;
+    return arithmetic<RalDivOp>("/", begin, end);
 }
 
 // ================================================================================
@@ -348,14 +1074,32 @@ RalTypePtr ral_abs(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual("abs", 1, std::distance(begin, end));
     RalTypeIter iter = begin;
-    arithmetic_type atype = INTEGER;
-    if ((*iter)->kind() == RalKind::DOUBLE) {
-        atype = DOUBLE;
+    if (isArray((*iter)->kind())) {
+        auto a = std::static_pointer_cast<RalArray>(*iter);
+        auto mp = std::make_shared<RalArray>(a->elem(), a);
+        if (mp->elem() == RalArray::F64) {
+            f64Abs(mp->f64(), mp->size());
+        }
+        else if (!i64Abs(mp->i64(), mp->size())) {
+            throw RalException("'abs' integer overflow in an i64 array.");
+        }
+        return mp;
     }
+    if ((*iter)->kind() == RalKind::MATRIX) {
+        auto mp = std::static_pointer_cast<RalMatrix>(*iter)->copy();
+        f64Abs(mp->data(), mp->size());
+        return mp;
+    }
+    if ((*iter)->kind() == RalKind::BIGINT) {
+        auto value = bigValue(*iter);
+        return (compare(value, RalBig(0)) < 0) ? makeInteger(RalBig(0) - value)
+                                               : *iter;
+    }
+    bool isDouble = (*iter)->kind() == RalKind::DOUBLE;
     int64_t i_value;
     double d_value;
     RalTypePtr mp;
-    if (atype == DOUBLE) {
+    if (isDouble) {
         d_value = (**(iter++)).asDouble();
         d_value = abs(d_value);
         mp = std::make_shared<RalDouble>(d_value);
@@ -390,6 +1134,41 @@ RalTypePtr ral_list_q(RalTypeIter begin, RalTypeIter end)
 RalTypePtr ral_empty_q(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsAtLeast("empty?", 1, std::distance(begin, end));
+    if ((**begin).kind() == RalKind::SET) {
+        return std::static_pointer_cast<RalSet>(*begin)->size() == 0
+                   ? std::make_shared<RalConstant>("true")
+                   : std::make_shared<RalConstant>("false");
+    }
+    if ((**begin).kind() == RalKind::SORTED_MAP) {
+        return std::static_pointer_cast<RalSortedMap>(*begin)->size() == 0
+                   ? std::make_shared<RalConstant>("true")
+                   : std::make_shared<RalConstant>("false");
+    }
+    if ((**begin).kind() == RalKind::RECORD) {
+        return std::static_pointer_cast<RalRecord>(*begin)->size() == 0
+                   ? std::make_shared<RalConstant>("true")
+                   : std::make_shared<RalConstant>("false");
+    }
+    if ((**begin).kind() == RalKind::LAZY_SEQ) {
+        return std::static_pointer_cast<RalLazySeq>(*begin)->isEmpty()
+                   ? std::make_shared<RalConstant>("true")
+                   : std::make_shared<RalConstant>("false");
+    }
+    if (isArray((**begin).kind())) {
+        return std::static_pointer_cast<RalArray>(*begin)->size() == 0
+                   ? std::make_shared<RalConstant>("true")
+                   : std::make_shared<RalConstant>("false");
+    }
+    if ((**begin).kind() == RalKind::MATRIX) {
+        return std::static_pointer_cast<RalMatrix>(*begin)->size() == 0
+                   ? std::make_shared<RalConstant>("true")
+                   : std::make_shared<RalConstant>("false");
+    }
+    if ((**begin).kind() == RalKind::TABLE) {
+        return std::static_pointer_cast<RalTable>(*begin)->rows() == 0
+                   ? std::make_shared<RalConstant>("true")
+                   : std::make_shared<RalConstant>("false");
+    }
     return (**begin).isEmptyList() ? std::make_shared<RalConstant>("true")
                                    : std::make_shared<RalConstant>("false");
 }
@@ -400,25 +1179,63 @@ RalTypePtr ral_count(RalTypeIter begin, RalTypeIter end)
     if ((**begin).kind() == RalKind::LIST) {
         return std::static_pointer_cast<RalList>(*begin)->count();
     }
-    RalTypePtr mp = std::make_shared<RalInteger>(0);
-    return mp;
+    else if ((**begin).kind() == RalKind::SET) {
+        auto n = std::static_pointer_cast<RalSet>(*begin)->size();
+        return std::make_shared<RalInteger>((int64_t)n);
+    }
+    else if ((**begin).kind() == RalKind::SORTED_MAP) {
+        auto n = std::static_pointer_cast<RalSortedMap>(*begin)->size();
+        return std::make_shared<RalInteger>((int64_t)n);
+    }
+    else if ((**begin).kind() == RalKind::RECORD) {
+        auto n = std::static_pointer_cast<RalRecord>(*begin)->size();
+        return std::make_shared<RalInteger>((int64_t)n);
+    }
+    else if ((**begin).kind() == RalKind::LAZY_SEQ) {
+        auto n = std::static_pointer_cast<RalLazySeq>(*begin)->size();
+        return std::make_shared<RalInteger>((int64_t)n);
+    }
+    else if (isArray((**begin).kind())) {
+        auto n = std::static_pointer_cast<RalArray>(*begin)->size();
+        return std::make_shared<RalInteger>((int64_t)n);
+    }
+    else if ((**begin).kind() == RalKind::MATRIX) {
+        auto n = std::static_pointer_cast<RalMatrix>(*begin)->rows();
+        return std::make_shared<RalInteger>((int64_t)n);
+    }
+    else if ((**begin).kind() == RalKind::TABLE) {
+        auto n = std::static_pointer_cast<RalTable>(*begin)->rows();
+        return std::make_shared<RalInteger>((int64_t)n);
+    }
+    else if ((**begin).kind() == RalKind::TRANSIENT) {
+        auto coll = std::static_pointer_cast<RalTransient>(*begin)->coll("count");
+        if (coll->kind() == RalKind::MAP) {
+            auto n = std::static_pointer_cast<RalMap>(coll)->size();
+            return std::make_shared<RalInteger>((int64_t)n);
+        }
+        else if (coll->kind() == RalKind::SET) {
+            auto n = std::static_pointer_cast<RalSet>(coll)->size();
+            return std::make_shared<RalInteger>((int64_t)n);
+        }
+        return std::static_pointer_cast<RalList>(coll)->count();
+    }
+    RalTypePtr mp = std::make_shared<RalInteger>(0);
+    return mp;
 }
 // ================================================================================
 // =: compare the first two parameters and return true if they are the same type
 // and contain the same value. In the case of equal length lists, each element
 // of the list should be compared for equality and if they are the same return
-// true, otherwise false.
+// true, otherwise false.  Lazy seqs are equal to lists with the same items.
 RalTypePtr ral_equal(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsAtLeast("=", 2, std::distance(begin, end));
     RalTypeIter iter = begin;
     auto a = (*iter++);
+    RalTypeEqual eq;
     for (; iter != end; iter++) {
         auto b = (*iter);
-        if (a->kind() != b->kind()) {
-            return std::make_shared<RalConstant>("false");
-        }
-        if (!(a->equal(b))) {
+        if (!eq(a, b)) {
             return std::make_shared<RalConstant>("false");
         }
     }
@@ -429,18 +1246,21 @@ RalTypePtr ral_lt(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual("<", 2, std::distance(begin, end));
     RalTypeIter iter = begin;
-    arithmetic_type atype = INTEGER;
-    if (((**(iter)).kind() == RalKind::DOUBLE) ||
-        ((**(iter + 1)).kind() == RalKind::DOUBLE)) {
-        atype = DOUBLE;
-    }
+    bool isDouble = ((**(iter)).kind() == RalKind::DOUBLE) ||
+                    ((**(iter + 1)).kind() == RalKind::DOUBLE);
     RalTypePtr mp;
-    if (atype == DOUBLE) {
+    if (isDouble) {
         double a = (*iter++)->asDouble();
         double b = (*iter)->asDouble();
         mp = (a < b) ? std::make_shared<RalConstant>("true")
                      : std::make_shared<RalConstant>("false");
     }
+    else if (((**(iter)).kind() == RalKind::BIGINT) ||
+             ((**(iter + 1)).kind() == RalKind::BIGINT)) {
+        int c = compare(bigValue(*iter), bigValue(*(iter + 1)));
+        mp = (c < 0) ? std::make_shared<RalConstant>("true")
+                     : std::make_shared<RalConstant>("false");
+    }
     else {
         int64_t a = (*iter++)->asInt();
         int64_t b = (*iter)->asInt();
@@ -455,18 +1275,21 @@ RalTypePtr ral_le(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual("<=", 2, std::distance(begin, end));
     RalTypeIter iter = begin;
-    arithmetic_type atype = INTEGER;
-    if (((**(iter)).kind() == RalKind::DOUBLE) ||
-        ((**(iter + 1)).kind() == RalKind::DOUBLE)) {
-        atype = DOUBLE;
-    }
+    bool isDouble = ((**(iter)).kind() == RalKind::DOUBLE) ||
+                    ((**(iter + 1)).kind() == RalKind::DOUBLE);
     RalTypePtr mp;
-    if (atype == DOUBLE) {
+    if (isDouble) {
         double a = (*iter++)->asDouble();
         double b = (*iter)->asDouble();
         mp = (a <= b) ? std::make_shared<RalConstant>("true")
                       : std::make_shared<RalConstant>("false");
     }
+    else if (((**(iter)).kind() == RalKind::BIGINT) ||
+             ((**(iter + 1)).kind() == RalKind::BIGINT)) {
+        int c = compare(bigValue(*iter), bigValue(*(iter + 1)));
+        mp = (c <= 0) ? std::make_shared<RalConstant>("true")
+                      : std::make_shared<RalConstant>("false");
+    }
     else {
         int64_t a = (*iter++)->asInt();
         int64_t b = (*iter)->asInt();
@@ -481,18 +1304,21 @@ RalTypePtr ral_gt(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual(">", 2, std::distance(begin, end));
     RalTypeIter iter = begin;
-    arithmetic_type atype = INTEGER;
-    if (((**(iter)).kind() == RalKind::DOUBLE) ||
-        ((**(iter + 1)).kind() == RalKind::DOUBLE)) {
-        atype = DOUBLE;
-    }
+    bool isDouble = ((**(iter)).kind() == RalKind::DOUBLE) ||
+                    ((**(iter + 1)).kind() == RalKind::DOUBLE);
     RalTypePtr mp;
-    if (atype == DOUBLE) {
+    if (isDouble) {
         double a = (*iter++)->asDouble();
         double b = (*iter)->asDouble();
         mp = (a > b) ? std::make_shared<RalConstant>("true")
                      : std::make_shared<RalConstant>("false");
     }
+    else if (((**(iter)).kind() == RalKind::BIGINT) ||
+             ((**(iter + 1)).kind() == RalKind::BIGINT)) {
+        int c = compare(bigValue(*iter), bigValue(*(iter + 1)));
+        mp = (c > 0) ? std::make_shared<RalConstant>("true")
+                     : std::make_shared<RalConstant>("false");
+    }
     else {
         int64_t a = (*iter++)->asInt();
         int64_t b = (*iter)->asInt();
@@ -507,18 +1333,21 @@ RalTypePtr ral_ge(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual(">=", 2, std::distance(begin, end));
     RalTypeIter iter = begin;
-    arithmetic_type atype = INTEGER;
-    if (((**(iter)).kind() == RalKind::DOUBLE) ||
-        ((**(iter + 1)).kind() == RalKind::DOUBLE)) {
-        atype = DOUBLE;
-    }
+    bool isDouble = ((**(iter)).kind() == RalKind::DOUBLE) ||
+                    ((**(iter + 1)).kind() == RalKind::DOUBLE);
     RalTypePtr mp;
-    if (atype == DOUBLE) {
+    if (isDouble) {
         double a = (*iter++)->asDouble();
         double b = (*iter)->asDouble();
         mp = (a >= b) ? std::make_shared<RalConstant>("true")
                       : std::make_shared<RalConstant>("false");
     }
+    else if (((**(iter)).kind() == RalKind::BIGINT) ||
+             ((**(iter + 1)).kind() == RalKind::BIGINT)) {
+        int c = compare(bigValue(*iter), bigValue(*(iter + 1)));
+        mp = (c >= 0) ? std::make_shared<RalConstant>("true")
+                      : std::make_shared<RalConstant>("false");
+    }
     else {
         int64_t a = (*iter++)->asInt();
         int64_t b = (*iter)->asInt();
@@ -626,6 +1455,18 @@ RalTypePtr ral_slurp(RalTypeIter begin, RalTypeIter end)
     return std::make_shared<RalString>(s);
 }
 
+// ================================================================================
+// delete-file: takes a file name (string), deletes the file and returns nil
+RalTypePtr ral_delete_file(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("delete-file", 1, std::distance(begin, end));
+    std::string filename = (*begin)->str(false);
+    if (std::remove(filename.c_str()) != 0) {
+        throw RalException("cannot delete file: " + filename);
+    }
+    return std::make_shared<RalConstant>("nil");
+}
+
 // ================================================================================
 RalTypePtr ral_atom(RalTypeIter begin, RalTypeIter end)
 {
@@ -671,26 +1512,32 @@ RalTypePtr ral_swap(RalTypeIter begin, RalTypeIter end)
     auto atom = *(iter++);
     auto atom_val = std::static_pointer_cast<RalAtom>(atom)->value();
     auto fn = *(iter++);
-    // create a list to apply
-    auto fnp = std::make_shared<RalList>('(');
-    std::static_pointer_cast<RalList>(fnp)->add(fn);
-    std::static_pointer_cast<RalList>(fnp)->add(atom_val);
-    for (; iter != end; iter++) {
-        std::static_pointer_cast<RalList>(fnp)->add(*iter);
-    }
-    RalTypePtr result = apply(fnp);
+    // call (fn atom_val args...), with the args on the stack when they fit
+    RalArgBuffer args(1 + (end - iter));
+    args[0] = atom_val;
+    std::copy(iter, end, args.begin() + 1);
+    RalTypePtr result = invoke(fn, args.begin(), args.end());
     return std::static_pointer_cast<RalAtom>(atom)->set(result);
 }
 
 // ================================================================================
 // cons: this function takes a list as its second parameter and returns a new
-// list that has the first argument prepended to it.
+// list that has the first argument prepended to it.  Consing onto a lazy seq
+// returns a lazy seq that does not realize the original.
 RalTypePtr ral_cons(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual("cons", 2, std::distance(begin, end));
     auto iter = begin;
     auto first = *(iter++);
     auto list = *(iter++);
+    if (list->kind() == RalKind::LAZY_SEQ) {
+        auto cell = std::make_shared<RalLazyCell>();
+        cell->items_.push_back(first);
+        cell->next_ = std::make_shared<RalLazyCell>();
+        cell->next_->tail_ = list;
+        cell->realized_ = true;
+        return std::make_shared<RalLazySeq>(cell, 0);
+    }
     auto cons = std::make_shared<RalList>('(');
     std::static_pointer_cast<RalList>(cons)->add(first);
     size_t size = std::static_pointer_cast<RalList>(list)->size();
@@ -705,7 +1552,16 @@ RalTypePtr ral_cons(RalTypeIter begin, RalTypeIter end)
 // list that is a concatenation of all the list parameters.
 RalTypePtr ral_concat(RalTypeIter begin, RalTypeIter end)
 {
+    // the result is private until returned, so build it in place at its
+    // final size.
     auto list = std::make_shared<RalList>('(');
+    size_t total = 0;
+    for (auto iter = begin; iter != end; iter++) {
+        if ((*iter)->kind() == RalKind::LIST) {
+            total += std::static_pointer_cast<RalList>(*iter)->size();
+        }
+    }
+    list->reserve(total);
     for (auto iter = begin; iter != end; iter++) {
         switch ((*iter)->kind()) {
         case RalKind::LIST: {
@@ -716,6 +1572,15 @@ RalTypePtr ral_concat(RalTypeIter begin, RalTypeIter end)
             }
             break;
         }
+        case RalKind::LAZY_SEQ: {
+            auto lz = std::static_pointer_cast<RalLazySeq>(*iter);
+            RalSeqCursor cursor("concat", lz);
+            RalTypePtr item;
+            while (cursor.next(item)) {
+                list->add(item);
+            }
+            break;
+        }
         default:
             throw RalException("meta not implemented for this type");
         }
@@ -740,6 +1605,40 @@ RalTypePtr ral_nth(RalTypeIter begin, RalTypeIter end)
         }
         return std::static_pointer_cast<RalList>(list)->get(index);
     }
+    else if (list->kind() == RalKind::LAZY_SEQ) {
+        auto index = arg->asInt();
+        auto item = (index < 0) ? nullptr
+                                : std::static_pointer_cast<RalLazySeq>(list)->nth(
+                                      (size_t)index);
+        if (item == nullptr) {
+            throw RalIndexOutOfRange();
+        }
+        return item;
+    }
+    else if (isArray(list->kind())) {
+        auto a = std::static_pointer_cast<RalArray>(list);
+        auto index = arg->asInt();
+        if ((index < 0) || (index >= (int64_t)a->size())) {
+            throw RalIndexOutOfRange();
+        }
+        return a->get((size_t)index);
+    }
+    else if (list->kind() == RalKind::MATRIX) {
+        auto m = std::static_pointer_cast<RalMatrix>(list);
+        auto index = arg->asInt();
+        if ((index < 0) || (index >= (int64_t)m->rows())) {
+            throw RalIndexOutOfRange();
+        }
+        return m->row((size_t)index);
+    }
+    else if (list->kind() == RalKind::TABLE) {
+        auto t = std::static_pointer_cast<RalTable>(list);
+        auto index = arg->asInt();
+        if ((index < 0) || (index >= (int64_t)t->rows())) {
+            throw RalIndexOutOfRange();
+        }
+        return t->row((size_t)index);
+    }
     throw RalIndexOutOfRange();
 }
 
@@ -754,17 +1653,24 @@ RalTypePtr ral_first(RalTypeIter begin, RalTypeIter end)
     if (arg->kind() == RalKind::LIST) {
         return std::static_pointer_cast<RalList>(arg)->get(0);
     }
+    else if (arg->kind() == RalKind::LAZY_SEQ) {
+        return std::static_pointer_cast<RalLazySeq>(arg)->first();
+    }
     return std::make_shared<RalConstant>("nil");
 }
 
 // ================================================================================
 // rest: this function takes a list (or vector) as its argument and returns a
 // new list containing all the elements except the first. If the list (or
-// vector) is empty or is nil then () (empty list) is returned.
+// vector) is empty or is nil then () (empty list) is returned.  The rest of a
+// lazy seq is a lazy seq that shares its realized items.
 RalTypePtr ral_rest(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual("rest", 1, std::distance(begin, end));
     auto arg = *begin;
+    if (arg->kind() == RalKind::LAZY_SEQ) {
+        return std::static_pointer_cast<RalLazySeq>(arg)->rest();
+    }
     auto rest = std::make_shared<RalList>('(');
     if (arg->kind() == RalKind::LIST) {
         size_t size = std::static_pointer_cast<RalList>(arg)->size();
@@ -782,7 +1688,7 @@ RalTypePtr ral_rest(RalTypeIter begin, RalTypeIter end)
 RalTypePtr ral_throw(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual("throw", 1, std::distance(begin, end));
-    throw RalException((*begin)->str(false));
+    throw RalException(*begin);
     return nullptr;
 }
 
@@ -798,47 +1704,68 @@ RalTypePtr ral_throw(RalTypeIter begin, RalTypeIter end)
 RalTypePtr ral_apply(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsAtLeast("apply", 2, std::distance(begin, end));
-    auto iter = begin;
-    auto fn_list = std::make_shared<RalList>('(');
-    // add the fn
-    std::static_pointer_cast<RalList>(fn_list)->add(*iter++);
-    // add any params in the middle
-    int64_t middle_size = end - begin - 2;
-    if (middle_size > 0) {
-        // create one list from items + final list
-        for (int64_t i = 0; i < middle_size; i++) {
-            std::static_pointer_cast<RalList>(fn_list)->add(*iter++);
+    auto fn = *begin;
+    auto last = *(end - 1);
+    std::shared_ptr<RalList> lastList;
+    if (last->kind() == RalKind::LIST) {
+        lastList = std::static_pointer_cast<RalList>(last);
+    }
+    else {
+        // any other seq is copied; the cursor throws for a non-seq
+        lastList = std::make_shared<RalList>('(');
+        RalSeqCursor cursor("apply", last);
+        RalTypePtr item;
+        while (cursor.next(item)) {
+            lastList->add(item);
         }
     }
-    // add params in the final list
-    auto last = *iter++;
-    for (size_t i = 0; i < std::static_pointer_cast<RalList>(last)->size();
-         i++) {
-        auto item = std::static_pointer_cast<RalList>(last)->get(i);
-        std::static_pointer_cast<RalList>(fn_list)->add(item);
+    size_t middleSize = end - begin - 2;
+    if (middleSize == 0) {
+        // the final list's items are already an argument span
+        return invoke(fn, lastList->data(), lastList->data() + lastList->size());
     }
-    // run that function
-    return apply(fn_list);
+    // the params in the middle, then the params in the final list
+    RalArgBuffer args(middleSize + lastList->size());
+    std::copy(begin + 1, end - 1, args.begin());
+    std::copy(lastList->data(), lastList->data() + lastList->size(),
+              args.begin() + middleSize);
+    return invoke(fn, args.begin(), args.end());
 }
 
 // ================================================================================
-// map: takes a function and a list (or vector) and evaluates the function
-// against every element of the list (or vector) one at a time and returns
-// the results as a list.
+// map: takes a function and one or more lists (or vectors) and evaluates the
+// function against the elements of the lists (or vectors) one at a time and
+// returns the results as a list.  With several lists, the function gets one
+// argument from each and the result is as long as the shortest list.  Given a
+// lazy seq, the result is a lazy seq that calls the function as its items are
+// realized.  (map f) returns a transducer.
 RalTypePtr ral_map(RalTypeIter begin, RalTypeIter end)
 {
-    checkArgsEqual("map", 2, std::distance(begin, end));
-    auto iter = begin;
-    auto fn = *iter++;
-    auto list = *iter++;
+    if (std::distance(begin, end) == 1) {
+        return makeXform(RalXformStage::MAP, *begin, 0);
+    }
+    checkArgsAtLeast("map", 2, std::distance(begin, end));
+    auto fn = *begin;
+    size_t num_items = SIZE_MAX;
+    for (auto iter = begin + 1; iter != end; iter++) {
+        if ((*iter)->kind() == RalKind::LAZY_SEQ) {
+            return makeLazySeq(std::make_shared<RalMapGen>(fn, begin + 1, end));
+        }
+        if ((*iter)->kind() == RalKind::LIST) {
+            num_items = std::min(
+                num_items, std::static_pointer_cast<RalList>(*iter)->size());
+        }
+    }
+    std::vector<RalTypePtr> items;
+    if (num_items != SIZE_MAX) {
+        items.reserve(num_items);
+    }
+    RalMapGen gen(fn, begin + 1, end);
+    gen.next(items, SIZE_MAX);
     auto result = std::make_shared<RalList>('(');
-    auto num_items = std::static_pointer_cast<RalList>(list)->size();
-    for (size_t i = 0; i < num_items; i++) {
-        auto fn_list = std::make_shared<RalList>('(');
-        std::static_pointer_cast<RalList>(fn_list)->add(fn);
-        auto item = std::static_pointer_cast<RalList>(list)->get(i);
-        std::static_pointer_cast<RalList>(fn_list)->add(item);
-        std::static_pointer_cast<RalList>(result)->add(apply(fn_list));
+    result->reserve(items.size());
+    for (auto &item : items) {
+        result->add(item);
     }
     return result;
 }
@@ -944,11 +1871,12 @@ RalTypePtr ral_vector_q(RalTypeIter begin, RalTypeIter end)
 
 // ================================================================================
 // sequential?: takes a single argument and returns true (ral true value) if it
-// is a list or a vector, otherwise returns false (ral false value).
+// is a list, a vector or a lazy seq, otherwise returns false (ral false value).
 RalTypePtr ral_sequential_q(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual("sequential?", 1, std::distance(begin, end));
-    return ((*begin)->isList() || (*begin)->isVector())
+    return ((*begin)->isList() || (*begin)->isVector() ||
+            ((*begin)->kind() == RalKind::LAZY_SEQ))
                ? std::make_shared<RalConstant>("true")
                : std::make_shared<RalConstant>("false");
 }
@@ -961,6 +1889,8 @@ RalTypePtr ral_sequential_q(RalTypeIter begin, RalTypeIter end)
 RalTypePtr ral_hash_map(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEven("hash-map", std::distance(begin, end));
+    // mp is not shared with anyone until it is returned, so it is safe to
+    // add to it in place just like a transient.
     auto mp = std::make_shared<RalMap>();
     for (auto iter = begin; iter != end; iter++) {
         auto keyp = *iter++;
@@ -973,11 +1903,16 @@ RalTypePtr ral_hash_map(RalTypeIter begin, RalTypeIter end)
 
 // ================================================================================
 // map?: takes a single argument and returns true (ral true value) if the
-// argument is a hash-map, otherwise returns false (ral false value).
+// argument is a hash-map (or sorted-map or record), otherwise returns false
+// (ral false value).
 RalTypePtr ral_map_q(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual("map?", 1, std::distance(begin, end));
-    std::string s = (*begin)->kind() == RalKind::MAP ? "true" : "false";
+    std::string s = ((*begin)->kind() == RalKind::MAP ||
+                     (*begin)->kind() == RalKind::SORTED_MAP ||
+                     (*begin)->kind() == RalKind::RECORD)
+                        ? "true"
+                        : "false";
     return std::make_shared<RalConstant>(s);
 }
 
@@ -992,6 +1927,24 @@ RalTypePtr ral_assoc(RalTypeIter begin, RalTypeIter end)
     checkArgsAtLeast("assoc", 3, std::distance(begin, end));
     checkArgsOdd("assoc", std::distance(begin, end));
     auto iter = begin;
+    if ((*iter)->kind() == RalKind::SORTED_MAP) {
+        // shares all of the unchanged tree nodes with the original
+        auto smp = std::make_shared<RalSortedMap>(
+            std::static_pointer_cast<RalSortedMap>(*iter++));
+        for (; iter != end; iter++) {
+            auto keyp = *iter++;
+            smp->add(keyp, *iter);
+        }
+        return smp;
+    }
+    if ((*iter)->kind() == RalKind::RECORD) {
+        auto rp = *iter++;
+        for (; iter != end; iter++) {
+            auto keyp = *iter++;
+            rp = std::static_pointer_cast<RalRecord>(rp)->assoc(keyp, *iter);
+        }
+        return rp;
+    }
     auto mp =
         std::make_shared<RalMap>(std::static_pointer_cast<RalMap>(*iter++));
     for (; iter != end; iter++) {
@@ -1007,11 +1960,32 @@ RalTypePtr ral_assoc(RalTypeIter begin, RalTypeIter end)
 // dissoc: takes a hash-map and a list of keys to remove from the hash-map.
 // Again, note that the original hash-map is unchanged and a new hash-map with
 // the keys removed is returned. Key arguments that do not exist in the hash-map
-// are ignored.
+// are ignored.  Removing a field from a record returns a hash-map.
 RalTypePtr ral_dissoc(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsAtLeast("dissoc", 2, std::distance(begin, end));
     auto iter = begin;
+    if ((*iter)->kind() == RalKind::SORTED_MAP) {
+        auto smp = std::make_shared<RalSortedMap>(
+            std::static_pointer_cast<RalSortedMap>(*iter++));
+        for (; iter != end; iter++) {
+            smp->remove(*iter);
+        }
+        return smp;
+    }
+    if ((*iter)->kind() == RalKind::RECORD) {
+        auto rp = *iter++;
+        for (; iter != end; iter++) {
+            if (rp->kind() == RalKind::RECORD) {
+                rp = std::static_pointer_cast<RalRecord>(rp)->dissoc(*iter);
+            }
+            else {
+                // dissoc already made a new hash-map for us
+                std::static_pointer_cast<RalMap>(rp)->remove(*iter);
+            }
+        }
+        return rp;
+    }
     auto mp =
         std::make_shared<RalMap>(std::static_pointer_cast<RalMap>(*iter++));
     for (; iter != end; iter++) {
@@ -1033,6 +2007,15 @@ RalTypePtr ral_get(RalTypeIter begin, RalTypeIter end)
     if (hash_map->kind() == RalKind::MAP) {
         return std::static_pointer_cast<RalMap>(hash_map)->get(key);
     }
+    else if (hash_map->kind() == RalKind::SET) {
+        return std::static_pointer_cast<RalSet>(hash_map)->get(key);
+    }
+    else if (hash_map->kind() == RalKind::SORTED_MAP) {
+        return std::static_pointer_cast<RalSortedMap>(hash_map)->get(key);
+    }
+    else if (hash_map->kind() == RalKind::RECORD) {
+        return std::static_pointer_cast<RalRecord>(hash_map)->get(key);
+    }
     else {
         return std::make_shared<RalConstant>("nil");
     }
@@ -1047,6 +2030,21 @@ RalTypePtr ral_contains_q(RalTypeIter begin, RalTypeIter end)
     auto iter = begin;
     auto hashmap = *iter++;
     auto key = *iter;
+    if (hashmap->kind() == RalKind::SET) {
+        return std::static_pointer_cast<RalSet>(hashmap)->contains(key)
+                   ? std::make_shared<RalConstant>("true")
+                   : std::make_shared<RalConstant>("false");
+    }
+    else if (hashmap->kind() == RalKind::SORTED_MAP) {
+        return std::static_pointer_cast<RalSortedMap>(hashmap)->hasKey(key)
+                   ? std::make_shared<RalConstant>("true")
+                   : std::make_shared<RalConstant>("false");
+    }
+    else if (hashmap->kind() == RalKind::RECORD) {
+        return std::static_pointer_cast<RalRecord>(hashmap)->hasKey(key)
+                   ? std::make_shared<RalConstant>("true")
+                   : std::make_shared<RalConstant>("false");
+    }
     return std::static_pointer_cast<RalMap>(hashmap)->hasKey(key)
                ? std::make_shared<RalConstant>("true")
                : std::make_shared<RalConstant>("false");
@@ -1058,6 +2056,12 @@ RalTypePtr ral_contains_q(RalTypeIter begin, RalTypeIter end)
 RalTypePtr ral_keys(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual("keys", 1, std::distance(begin, end));
+    if ((*begin)->kind() == RalKind::SORTED_MAP) {
+        return std::static_pointer_cast<RalSortedMap>(*begin)->getKeys();
+    }
+    if ((*begin)->kind() == RalKind::RECORD) {
+        return std::static_pointer_cast<RalRecord>(*begin)->getKeys();
+    }
     return std::static_pointer_cast<RalMap>(*begin)->getKeys();
 }
 
@@ -1067,6 +2071,12 @@ RalTypePtr ral_keys(RalTypeIter begin, RalTypeIter end)
 RalTypePtr ral_vals(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual("vals", 1, std::distance(begin, end));
+    if ((*begin)->kind() == RalKind::SORTED_MAP) {
+        return std::static_pointer_cast<RalSortedMap>(*begin)->getVals();
+    }
+    if ((*begin)->kind() == RalKind::RECORD) {
+        return std::static_pointer_cast<RalRecord>(*begin)->getVals();
+    }
     return std::static_pointer_cast<RalMap>(*begin)->getVals();
 }
 
@@ -1111,6 +2121,9 @@ RalTypePtr ral_meta(RalTypeIter begin, RalTypeIter end)
     case RalKind::LAMBDA:
     case RalKind::LIST:
     case RalKind::MAP:
+    case RalKind::SET:
+    case RalKind::SORTED_MAP:
+    case RalKind::RECORD:
         return fn->getMeta();
     default:
         throw RalException("meta not implemented for this type");
@@ -1132,8 +2145,14 @@ RalTypePtr ral_with_meta(RalTypeIter begin, RalTypeIter end)
     RalTypePtr mp;
     switch (fn->kind()) {
     case RalKind::FUNCTION:
-        mp = std::make_shared<RalFunction>(
-            std::static_pointer_cast<RalFunction>(fn));
+        if (auto memo = std::dynamic_pointer_cast<RalMemoFunction>(fn)) {
+            // keep access to the cache for memo-stats
+            mp = std::make_shared<RalMemoFunction>(memo);
+        }
+        else {
+            mp = std::make_shared<RalFunction>(
+                std::static_pointer_cast<RalFunction>(fn));
+        }
         mp->setMeta(meta);
         break;
     case RalKind::LAMBDA:
@@ -1149,6 +2168,19 @@ RalTypePtr ral_with_meta(RalTypeIter begin, RalTypeIter end)
         mp = std::make_shared<RalMap>(std::static_pointer_cast<RalMap>(fn));
         mp->setMeta(meta);
         break;
+    case RalKind::SET:
+        mp = std::make_shared<RalSet>(std::static_pointer_cast<RalSet>(fn));
+        mp->setMeta(meta);
+        break;
+    case RalKind::SORTED_MAP:
+        mp = std::make_shared<RalSortedMap>(
+            std::static_pointer_cast<RalSortedMap>(fn));
+        mp->setMeta(meta);
+        break;
+    case RalKind::RECORD:
+        mp = std::make_shared<RalRecord>(std::static_pointer_cast<RalRecord>(fn));
+        mp->setMeta(meta);
+        break;
     default:
         throw RalException("with-meta not implemented for this type");
     }
@@ -1165,7 +2197,8 @@ RalTypePtr ral_fn_q(RalTypeIter begin, RalTypeIter end)
         condition =
             !(std::static_pointer_cast<RalLambda>(*begin)->get_is_macro());
     }
-    else if ((*begin)->kind() == RalKind::FUNCTION) {
+    else if (((*begin)->kind() == RalKind::FUNCTION) ||
+             ((*begin)->kind() == RalKind::MULTI_FN)) {
         condition = true;
     }
     std::string s = condition ? "true" : "false";
@@ -1186,7 +2219,7 @@ RalTypePtr ral_string_q(RalTypeIter begin, RalTypeIter end)
 RalTypePtr ral_number_q(RalTypeIter begin, RalTypeIter end)
 {
     checkArgsEqual("number?", 1, std::distance(begin, end));
-    std::string s = (*begin)->kind() == RalKind::INTEGER ? "true" : "false";
+    std::string s = isInteger((*begin)->kind()) ? "true" : "false";
     return std::make_shared<RalConstant>(s);
 }
 
@@ -1229,6 +2262,47 @@ RalTypePtr ral_seq(RalTypeIter begin, RalTypeIter end)
         }
         return mp;
     }
+    case RalKind::SET: {
+        auto sp = std::static_pointer_cast<RalSet>(*begin);
+        if (sp->size() == 0) {
+            return std::make_shared<RalConstant>("nil");
+        }
+        return sp->getItems();
+    }
+    case RalKind::SORTED_MAP: {
+        auto smp = std::static_pointer_cast<RalSortedMap>(*begin);
+        if (smp->size() == 0) {
+            return std::make_shared<RalConstant>("nil");
+        }
+        return smp->getEntries();
+    }
+    case RalKind::LAZY_SEQ: {
+        // only the first item needs to be realized
+        if (std::static_pointer_cast<RalLazySeq>(*begin)->isEmpty()) {
+            return std::make_shared<RalConstant>("nil");
+        }
+        return *begin;
+    }
+    case RalKind::F64_ARRAY:
+    case RalKind::I64_ARRAY: {
+        auto a = std::static_pointer_cast<RalArray>(*begin);
+        if (a->size() == 0) {
+            return std::make_shared<RalConstant>("nil");
+        }
+        auto mp = std::make_shared<RalList>('(');
+        mp->reserve(a->size());
+        for (size_t i = 0; i < a->size(); i++) {
+            mp->add(a->get(i));
+        }
+        return mp;
+    }
+    case RalKind::TABLE: {
+        auto t = std::static_pointer_cast<RalTable>(*begin);
+        if (t->rows() == 0) {
+            return std::make_shared<RalConstant>("nil");
+        }
+        return t->toMaps('(');
+    }
     case RalKind::CONSTANT:
         if ((*begin)->str(true) == "nil") {
             return std::make_shared<RalConstant>("nil");
@@ -1279,6 +2353,13 @@ RalTypePtr ral_conj(RalTypeIter begin, RalTypeIter end)
             return mp;
         }
     }
+    case RalKind::SET: {
+        auto mp = std::make_shared<RalSet>(std::static_pointer_cast<RalSet>(first));
+        for (; iter != end; iter++) {
+            mp->add(*iter);
+        }
+        return mp;
+    }
     default:
         throw RalException("conj not implemented for this type");
     }
@@ -1296,3 +2377,2613 @@ RalTypePtr ral_macro_q(RalTypeIter begin, RalTypeIter end)
             : "false";
     return std::make_shared<RalConstant>(s);
 }
+
+// ================================================================================
+// transient: takes a vector or hash-map and returns a transient copy of it that
+// can be modified in place by conj!, assoc! and dissoc!.
+RalTypePtr ral_transient(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("transient", 1, std::distance(begin, end));
+    return std::make_shared<RalTransient>(*begin);
+}
+
+// ================================================================================
+// helper to check the first argument of the transient functions
+std::shared_ptr<RalTransient> transientArg(const char *name, RalTypePtr mp)
+{
+    if (mp->kind() != RalKind::TRANSIENT) {
+        throw RalException(std::string("'") + name +
+                           "' requires a transient as the first parameter.");
+    }
+    return std::static_pointer_cast<RalTransient>(mp);
+}
+
+// ================================================================================
+// conj!: adds items to the end of a transient vector or to a transient set, or
+// [key value] pairs to a transient hash-map.  Returns the transient.
+RalTypePtr ral_conj_bang(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsAtLeast("conj!", 2, std::distance(begin, end));
+    auto iter = begin;
+    auto tp = transientArg("conj!", *iter++);
+    auto coll = tp->coll("conj!");
+    if (coll->kind() == RalKind::MAP) {
+        auto mp = std::static_pointer_cast<RalMap>(coll);
+        for (; iter != end; iter++) {
+            if (!(*iter)->isVector() ||
+                std::static_pointer_cast<RalList>(*iter)->size() != 2) {
+                throw RalException(
+                    "'conj!' on a hash-map requires [key value] vectors.");
+            }
+            auto pair = std::static_pointer_cast<RalList>(*iter);
+            mp->add(pair->get(0)->asMapKey(), pair->get(1));
+        }
+    }
+    else if (coll->kind() == RalKind::SET) {
+        auto sp = std::static_pointer_cast<RalSet>(coll);
+        for (; iter != end; iter++) {
+            sp->add(*iter);
+        }
+    }
+    else {
+        auto lp = std::static_pointer_cast<RalList>(coll);
+        for (; iter != end; iter++) {
+            lp->add(*iter);
+        }
+    }
+    return tp;
+}
+
+// ================================================================================
+// assoc!: like assoc, but updates the transient hash-map in place.  For a
+// transient vector the keys are indices (up to one past the end).
+RalTypePtr ral_assoc_bang(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsAtLeast("assoc!", 3, std::distance(begin, end));
+    checkArgsOdd("assoc!", std::distance(begin, end));
+    auto iter = begin;
+    auto tp = transientArg("assoc!", *iter++);
+    auto coll = tp->coll("assoc!");
+    if (coll->kind() == RalKind::SET) {
+        throw RalException("'assoc!' requires a transient vector or hash-map.");
+    }
+    for (; iter != end; iter++) {
+        auto keyp = *iter++;
+        auto valuep = *iter;
+        if (coll->kind() == RalKind::MAP) {
+            std::static_pointer_cast<RalMap>(coll)->add(keyp->asMapKey(),
+                                                        valuep);
+        }
+        else {
+            auto index = keyp->asInt();
+            if (index < 0) {
+                throw RalIndexOutOfRange();
+            }
+            std::static_pointer_cast<RalList>(coll)->set(index, valuep);
+        }
+    }
+    return tp;
+}
+
+// ================================================================================
+// dissoc!: like dissoc, but updates the transient hash-map in place.
+RalTypePtr ral_dissoc_bang(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsAtLeast("dissoc!", 2, std::distance(begin, end));
+    auto iter = begin;
+    auto tp = transientArg("dissoc!", *iter++);
+    auto coll = tp->coll("dissoc!");
+    if (coll->kind() != RalKind::MAP) {
+        throw RalException("'dissoc!' requires a transient hash-map.");
+    }
+    for (; iter != end; iter++) {
+        std::static_pointer_cast<RalMap>(coll)->remove(*iter);
+    }
+    return tp;
+}
+
+// ================================================================================
+// persistent!: returns the collection built by the transient.  The transient
+// cannot be used after this.
+RalTypePtr ral_persistent_bang(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("persistent!", 1, std::distance(begin, end));
+    return transientArg("persistent!", *begin)->persistent();
+}
+
+// ================================================================================
+// disj!: removes items from a transient set in place.  Returns the transient.
+RalTypePtr ral_disj_bang(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsAtLeast("disj!", 2, std::distance(begin, end));
+    auto iter = begin;
+    auto tp = transientArg("disj!", *iter++);
+    auto coll = tp->coll("disj!");
+    if (coll->kind() != RalKind::SET) {
+        throw RalException("'disj!' requires a transient set.");
+    }
+    for (; iter != end; iter++) {
+        std::static_pointer_cast<RalSet>(coll)->remove(*iter);
+    }
+    return tp;
+}
+
+// ================================================================================
+// helper to check for set arguments
+std::shared_ptr<RalSet> setArg(const char *name, RalTypePtr mp)
+{
+    if (mp->kind() != RalKind::SET) {
+        throw RalException(std::string("'") + name + "' requires sets.");
+    }
+    return std::static_pointer_cast<RalSet>(mp);
+}
+
+// ================================================================================
+// set: takes a list, vector, set or nil and returns a set of its items.
+RalTypePtr ral_set(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("set", 1, std::distance(begin, end));
+    auto coll = *begin;
+    auto mp = std::make_shared<RalSet>();
+    switch (coll->kind()) {
+    case RalKind::LIST: {
+        auto lp = std::static_pointer_cast<RalList>(coll);
+        for (size_t i = 0; i < lp->size(); i++) {
+            mp->add(lp->get(i));
+        }
+        return mp;
+    }
+    case RalKind::SET:
+        return coll;
+    case RalKind::CONSTANT:
+        if (coll->str(true) == "nil") {
+            return mp;
+        }
+        break;
+    default:
+        break;
+    }
+    throw RalException("set not implemented for this type");
+}
+
+// ================================================================================
+// hash-set: returns a set containing the arguments.  This is the functional form
+// of the #{} reader literal syntax.
+RalTypePtr ral_hash_set(RalTypeIter begin, RalTypeIter end)
+{
+    auto mp = std::make_shared<RalSet>();
+    for (auto iter = begin; iter != end; iter++) {
+        mp->add(*iter);
+    }
+    return mp;
+}
+
+// ================================================================================
+// set?: takes a single argument and returns true (ral true value) if the
+// argument is a set, otherwise returns false (ral false value).
+RalTypePtr ral_set_q(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("set?", 1, std::distance(begin, end));
+    std::string s = (*begin)->kind() == RalKind::SET ? "true" : "false";
+    return std::make_shared<RalConstant>(s);
+}
+
+// ================================================================================
+// disj: takes a set and items to remove from it.  Like dissoc, the original set
+// is unchanged and a new set is returned.
+RalTypePtr ral_disj(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsAtLeast("disj", 1, std::distance(begin, end));
+    auto iter = begin;
+    auto mp = std::make_shared<RalSet>(setArg("disj", *iter++));
+    for (; iter != end; iter++) {
+        mp->remove(*iter);
+    }
+    return mp;
+}
+
+// ================================================================================
+// union: returns a set of the items in any of the sets.  Starts from a copy of
+// the largest set so the fewest items need to be inserted.
+RalTypePtr ral_union(RalTypeIter begin, RalTypeIter end)
+{
+    if (begin == end) {
+        return std::make_shared<RalSet>();
+    }
+    auto largest = begin;
+    for (auto iter = begin; iter != end; iter++) {
+        if (setArg("union", *iter)->size() >
+            std::static_pointer_cast<RalSet>(*largest)->size()) {
+            largest = iter;
+        }
+    }
+    auto mp =
+        std::make_shared<RalSet>(std::static_pointer_cast<RalSet>(*largest));
+    for (auto iter = begin; iter != end; iter++) {
+        if (iter != largest) {
+            mp->unionWith(std::static_pointer_cast<RalSet>(*iter));
+        }
+    }
+    return mp;
+}
+
+// ================================================================================
+// intersection: returns a set of the items in all of the sets.  Starts from a
+// copy of the smallest set since the result cannot be any larger.
+RalTypePtr ral_intersection(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsAtLeast("intersection", 1, std::distance(begin, end));
+    auto smallest = begin;
+    for (auto iter = begin; iter != end; iter++) {
+        if (setArg("intersection", *iter)->size() <
+            std::static_pointer_cast<RalSet>(*smallest)->size()) {
+            smallest = iter;
+        }
+    }
+    auto mp =
+        std::make_shared<RalSet>(std::static_pointer_cast<RalSet>(*smallest));
+    for (auto iter = begin; iter != end; iter++) {
+        if (iter != smallest) {
+            mp->intersectWith(std::static_pointer_cast<RalSet>(*iter));
+        }
+    }
+    return mp;
+}
+
+// ================================================================================
+// difference: returns a set of the items in the first set that are not in any
+// of the other sets.
+RalTypePtr ral_difference(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsAtLeast("difference", 1, std::distance(begin, end));
+    auto iter = begin;
+    auto mp = std::make_shared<RalSet>(setArg("difference", *iter++));
+    for (; iter != end; iter++) {
+        mp->differenceWith(setArg("difference", *iter));
+    }
+    return mp;
+}
+
+// ================================================================================
+// record-type: takes a name (string or symbol) and a vector of field keywords
+// and returns a record type.  Every record made from the type stores its
+// fields in the same slot order.
+RalTypePtr ral_record_type(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("record-type", 2, std::distance(begin, end));
+    auto iter = begin;
+    auto name = *iter++;
+    if ((name->kind() != RalKind::STRING) && (name->kind() != RalKind::SYMBOL)) {
+        throw RalException("record-type requires a name string or symbol.");
+    }
+    if ((*iter)->kind() != RalKind::LIST) {
+        throw RalException("record-type requires a vector of field keywords.");
+    }
+    auto fieldList = std::static_pointer_cast<RalList>(*iter);
+    std::vector<RalTypePtr> fields;
+    for (size_t i = 0; i < fieldList->size(); i++) {
+        auto field = fieldList->get(i);
+        if (field->kind() != RalKind::KEYWORD) {
+            throw RalException("record-type fields must be keywords.");
+        }
+        for (auto &f : fields) {
+            if (f->equal(field)) {
+                throw RalException("record-type fields must be unique.");
+            }
+        }
+        fields.push_back(field);
+    }
+    return std::make_shared<RalRecordType>(name->str(false), fields);
+}
+
+std::shared_ptr<RalRecordType> recordTypeArg(const char *name, RalTypePtr rt)
+{
+    if (rt->kind() != RalKind::RECORD_TYPE) {
+        throw RalException(std::string("'") + name +
+                           "' requires a record type.");
+    }
+    return std::static_pointer_cast<RalRecordType>(rt);
+}
+
+// ================================================================================
+// record: takes a record type and one value for each of its fields, in order,
+// and returns a new record.
+RalTypePtr ral_record(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsAtLeast("record", 1, std::distance(begin, end));
+    auto iter = begin;
+    auto rt = recordTypeArg("record", *iter++);
+    checkArgsEqual("record", rt->numFields() + 1, std::distance(begin, end));
+    std::vector<RalTypePtr> slots(iter, end);
+    return std::make_shared<RalRecord>(rt, slots);
+}
+
+// ================================================================================
+// map->record: takes a record type and a hash-map and returns a new record.
+// Missing fields are nil and keys that are not fields are kept as extra keys.
+RalTypePtr ral_map_to_record(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("map->record", 2, std::distance(begin, end));
+    auto iter = begin;
+    auto rt = recordTypeArg("map->record", *iter++);
+    if ((*iter)->kind() != RalKind::MAP) {
+        throw RalException("'map->record' requires a hash-map.");
+    }
+    auto mp = std::static_pointer_cast<RalMap>(*iter);
+    std::vector<RalTypePtr> slots;
+    for (size_t i = 0; i < rt->numFields(); i++) {
+        slots.push_back(mp->get(rt->field(i)));
+    }
+    RalTypePtr rp = std::make_shared<RalRecord>(rt, slots);
+    auto keys = std::static_pointer_cast<RalList>(mp->getKeys());
+    size_t slot;
+    for (size_t i = 0; i < keys->size(); i++) {
+        if (!rt->slot(keys->get(i), slot)) {
+            rp = std::static_pointer_cast<RalRecord>(rp)->assoc(
+                keys->get(i), mp->get(keys->get(i)));
+        }
+    }
+    return rp;
+}
+
+// ================================================================================
+// record?: returns true if the argument is a record.  With a record type as
+// the second argument, only returns true for records of that type.
+RalTypePtr ral_record_q(RalTypeIter begin, RalTypeIter end)
+{
+    auto num = std::distance(begin, end);
+    if ((num != 1) && (num != 2)) {
+        throw RalException("'record?' requires 1 or 2 parameters.");
+    }
+    bool condition = (*begin)->kind() == RalKind::RECORD;
+    if (condition && (num == 2)) {
+        auto rt = recordTypeArg("record?", *(begin + 1));
+        condition = std::static_pointer_cast<RalRecord>(*begin)->type() == rt;
+    }
+    return std::make_shared<RalConstant>(condition ? "true" : "false");
+}
+
+// ================================================================================
+// sorted-map: takes key/value pairs and returns a sorted-map that keeps its keys
+// in their natural order (see compare).
+RalTypePtr ral_sorted_map(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEven("sorted-map", std::distance(begin, end));
+    auto mp = std::make_shared<RalSortedMap>(RalTypePtr(nullptr));
+    for (auto iter = begin; iter != end; iter++) {
+        auto keyp = *iter++;
+        mp->add(keyp, *iter);
+    }
+    return mp;
+}
+
+// ================================================================================
+// sorted-map-by: like sorted-map, but the keys are ordered by the comparator
+// function given as the first argument.  The comparator returns a negative,
+// zero or positive number like compare, or true when its first argument
+// should sort before its second.
+RalTypePtr ral_sorted_map_by(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsAtLeast("sorted-map-by", 1, std::distance(begin, end));
+    checkArgsOdd("sorted-map-by", std::distance(begin, end));
+    auto iter = begin;
+    auto mp = std::make_shared<RalSortedMap>(*iter++);
+    for (; iter != end; iter++) {
+        auto keyp = *iter++;
+        mp->add(keyp, *iter);
+    }
+    return mp;
+}
+
+// ================================================================================
+// sorted?: returns true if the argument is a sorted collection.
+RalTypePtr ral_sorted_q(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("sorted?", 1, std::distance(begin, end));
+    std::string s =
+        (*begin)->kind() == RalKind::SORTED_MAP ? "true" : "false";
+    return std::make_shared<RalConstant>(s);
+}
+
+// ================================================================================
+// helper for subseq & rsubseq to turn the test functions (< <= > >=) into
+// range bounds.  The tests are recognized by the builtin they call, not by
+// name, so only the real comparison functions are accepted.
+void sortedRangeBound(const char *name, RalTypePtr test, RalTypePtr key,
+                      RalTypePtr &lo, bool &loInclusive, RalTypePtr &hi,
+                      bool &hiInclusive)
+{
+    typedef RalTypePtr (*Builtin)(RalTypeIter, RalTypeIter);
+    const Builtin *fn = nullptr;
+    if (test->kind() == RalKind::FUNCTION) {
+        fn = std::static_pointer_cast<RalFunction>(test)
+                 ->signature()
+                 .target<Builtin>();
+    }
+    if ((fn != nullptr) && (*fn == ral_gt)) {
+        lo = key;
+        loInclusive = false;
+    }
+    else if ((fn != nullptr) && (*fn == ral_ge)) {
+        lo = key;
+        loInclusive = true;
+    }
+    else if ((fn != nullptr) && (*fn == ral_lt)) {
+        hi = key;
+        hiInclusive = false;
+    }
+    else if ((fn != nullptr) && (*fn == ral_le)) {
+        hi = key;
+        hiInclusive = true;
+    }
+    else {
+        throw RalException(std::string("'") + name +
+                           "' tests must be one of < <= > >=.");
+    }
+}
+
+RalTypePtr sortedRange(const char *name, RalTypeIter begin, RalTypeIter end,
+                       bool reverse)
+{
+    auto num = std::distance(begin, end);
+    if ((num != 3) && (num != 5)) {
+        throw RalException(std::string("'") + name +
+                           "' requires 3 or 5 parameters.");
+    }
+    auto iter = begin;
+    auto coll = *iter++;
+    if (coll->kind() != RalKind::SORTED_MAP) {
+        throw RalException(std::string("'") + name +
+                           "' requires a sorted-map.");
+    }
+    RalTypePtr lo = nullptr;
+    RalTypePtr hi = nullptr;
+    bool loInclusive = true;
+    bool hiInclusive = true;
+    for (; iter != end; iter += 2) {
+        sortedRangeBound(name, *iter, *(iter + 1), lo, loInclusive, hi,
+                         hiInclusive);
+    }
+    auto mp = std::static_pointer_cast<RalSortedMap>(coll)->range(
+        lo, loInclusive, hi, hiInclusive, reverse);
+    if (std::static_pointer_cast<RalList>(mp)->isEmptyList()) {
+        return std::make_shared<RalConstant>("nil");
+    }
+    return mp;
+}
+
+// ================================================================================
+// subseq: (subseq sm test key) or (subseq sm start-test start-key end-test
+// end-key) where the tests are < <= > or >=.  Returns a list of the [key value]
+// entries in range in ascending order, or nil if there are none.
+RalTypePtr ral_subseq(RalTypeIter begin, RalTypeIter end)
+{
+    return sortedRange("subseq", begin, end, false);
+}
+
+// ================================================================================
+// rsubseq: like subseq, but returns the entries in descending order.
+RalTypePtr ral_rsubseq(RalTypeIter begin, RalTypeIter end)
+{
+    return sortedRange("rsubseq", begin, end, true);
+}
+
+// ================================================================================
+// first-key: returns the smallest key in a sorted-map, or nil if it is empty.
+RalTypePtr ral_first_key(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("first-key", 1, std::distance(begin, end));
+    if ((*begin)->kind() != RalKind::SORTED_MAP) {
+        throw RalException("'first-key' requires a sorted-map.");
+    }
+    return std::static_pointer_cast<RalSortedMap>(*begin)->firstKey();
+}
+
+// ================================================================================
+// last-key: returns the largest key in a sorted-map, or nil if it is empty.
+RalTypePtr ral_last_key(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("last-key", 1, std::distance(begin, end));
+    if ((*begin)->kind() != RalKind::SORTED_MAP) {
+        throw RalException("'last-key' requires a sorted-map.");
+    }
+    return std::static_pointer_cast<RalSortedMap>(*begin)->lastKey();
+}
+
+// ================================================================================
+// lazy-seq*: takes a function of no arguments that returns a list, vector,
+// lazy seq or nil and returns a lazy seq of its items.  The function is called
+// once, when the seq is first used.  See the lazy-seq macro.
+RalTypePtr ral_lazy_seq_star(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("lazy-seq*", 1, std::distance(begin, end));
+    auto cell = std::make_shared<RalLazyCell>();
+    cell->thunk_ = *begin;
+    return std::make_shared<RalLazySeq>(cell, 0);
+}
+
+// ================================================================================
+// lazy-seq?: returns true if the argument is a lazy seq.
+RalTypePtr ral_lazy_seq_q(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("lazy-seq?", 1, std::distance(begin, end));
+    std::string s = (*begin)->kind() == RalKind::LAZY_SEQ ? "true" : "false";
+    return std::make_shared<RalConstant>(s);
+}
+
+// ================================================================================
+// range: (range), (range end), (range start end) or (range start end step)
+// returns a lazy seq of numbers from start (default 0) up to but not including
+// end (default infinity) by step (default 1).
+RalTypePtr ral_range(RalTypeIter begin, RalTypeIter end)
+{
+    auto num = std::distance(begin, end);
+    if (num > 3) {
+        throw RalException("'range' requires 0 to 3 parameters.");
+    }
+    RalTypePtr start = std::make_shared<RalInteger>(0);
+    RalTypePtr last = nullptr;
+    RalTypePtr step = std::make_shared<RalInteger>(1);
+    if (num == 1) {
+        last = *begin;
+    }
+    else if (num >= 2) {
+        start = *begin;
+        last = *(begin + 1);
+    }
+    if (num == 3) {
+        step = *(begin + 2);
+    }
+    return makeLazySeq(std::make_shared<RalRangeGen>(start, last, step));
+}
+
+// ================================================================================
+// iterate: (iterate f x) returns the lazy seq x, (f x), (f (f x)) ...
+RalTypePtr ral_iterate(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("iterate", 2, std::distance(begin, end));
+    return makeLazySeq(std::make_shared<RalIterateGen>(*begin, *(begin + 1)));
+}
+
+// ================================================================================
+// repeat: (repeat x) returns an endless lazy seq of x and (repeat n x) returns
+// a lazy seq of n x's.
+RalTypePtr ral_repeat(RalTypeIter begin, RalTypeIter end)
+{
+    auto num = std::distance(begin, end);
+    if (num == 1) {
+        return makeLazySeq(std::make_shared<RalRepeatGen>(*begin, false, 0));
+    }
+    checkArgsEqual("repeat", 2, num);
+    return makeLazySeq(
+        std::make_shared<RalRepeatGen>(*(begin + 1), true, (*begin)->asInt()));
+}
+
+// ================================================================================
+// take: (take n coll) returns a lazy seq of the first n items of coll.  (take n)
+// returns a transducer.
+RalTypePtr ral_take(RalTypeIter begin, RalTypeIter end)
+{
+    if (std::distance(begin, end) == 1) {
+        return makeXform(RalXformStage::TAKE, nullptr, (*begin)->asInt());
+    }
+    checkArgsEqual("take", 2, std::distance(begin, end));
+    return makeLazySeq(
+        std::make_shared<RalTakeGen>(*(begin + 1), (*begin)->asInt()));
+}
+
+// ================================================================================
+// drop: (drop n coll) returns a lazy seq of all but the first n items of coll.
+// (drop n) returns a transducer.
+RalTypePtr ral_drop(RalTypeIter begin, RalTypeIter end)
+{
+    if (std::distance(begin, end) == 1) {
+        return makeXform(RalXformStage::DROP, nullptr, (*begin)->asInt());
+    }
+    checkArgsEqual("drop", 2, std::distance(begin, end));
+    return makeLazySeq(
+        std::make_shared<RalDropGen>(*(begin + 1), (*begin)->asInt()));
+}
+
+// ================================================================================
+// take-while: (take-while pred coll) returns a lazy seq of the items of coll
+// up to the first one where pred returns nil or false.  (take-while pred)
+// returns a transducer.
+RalTypePtr ral_take_while(RalTypeIter begin, RalTypeIter end)
+{
+    if (std::distance(begin, end) == 1) {
+        return makeXform(RalXformStage::TAKE_WHILE, *begin, 0);
+    }
+    checkArgsEqual("take-while", 2, std::distance(begin, end));
+    return makeLazySeq(
+        std::make_shared<RalTakeWhileGen>(*begin, *(begin + 1)));
+}
+
+// ================================================================================
+// helper for filter & remove.  Lazy input gives lazy output, anything else is
+// filtered right away into a list.
+RalTypePtr filterSeq(const char *name, RalTypeIter begin, RalTypeIter end,
+                     bool keepPassing)
+{
+    if (std::distance(begin, end) == 1) {
+        return makeXform(keepPassing ? RalXformStage::FILTER
+                                     : RalXformStage::REMOVE,
+                         *begin, 0);
+    }
+    checkArgsEqual(name, 2, std::distance(begin, end));
+    auto pred = *begin;
+    auto coll = *(begin + 1);
+    if (coll->kind() == RalKind::LAZY_SEQ) {
+        return makeLazySeq(
+            std::make_shared<RalFilterGen>(name, pred, coll, keepPassing));
+    }
+    auto result = std::make_shared<RalList>('(');
+    RalCaller caller(pred, 1);
+    RalSeqCursor cursor(name, coll);
+    RalTypePtr item;
+    while (cursor.next(item)) {
+        if (caller.call(item)->isNilOrFalse() != keepPassing) {
+            result->add(item);
+        }
+    }
+    return result;
+}
+
+// ================================================================================
+// filter: (filter pred coll) returns the items of coll where pred returns
+// neither nil nor false.  Returns a list, or a lazy seq when coll is lazy.
+// (filter pred) returns a transducer.
+RalTypePtr ral_filter(RalTypeIter begin, RalTypeIter end)
+{
+    return filterSeq("filter", begin, end, true);
+}
+
+// ================================================================================
+// remove: (remove pred coll) returns the items of coll where pred returns nil
+// or false.  Returns a list, or a lazy seq when coll is lazy.  (remove pred)
+// returns a transducer.
+RalTypePtr ral_remove(RalTypeIter begin, RalTypeIter end)
+{
+    return filterSeq("remove", begin, end, false);
+}
+
+// ================================================================================
+// keep: (keep f coll) returns the results of (f item) for each item of coll
+// that are not nil.  Returns a list, or a lazy seq when coll is lazy.  (keep f)
+// returns a transducer.
+RalTypePtr ral_keep(RalTypeIter begin, RalTypeIter end)
+{
+    if (std::distance(begin, end) == 1) {
+        return makeXform(RalXformStage::KEEP, *begin, 0);
+    }
+    checkArgsEqual("keep", 2, std::distance(begin, end));
+    auto fn = *begin;
+    auto coll = *(begin + 1);
+    if (coll->kind() == RalKind::LAZY_SEQ) {
+        return makeLazySeq(std::make_shared<RalKeepGen>(fn, coll));
+    }
+    auto result = std::make_shared<RalList>('(');
+    RalCaller caller(fn, 1);
+    RalSeqCursor cursor("keep", coll);
+    RalTypePtr item;
+    while (cursor.next(item)) {
+        auto value = caller.call(item);
+        if (!isNil(value)) {
+            result->add(value);
+        }
+    }
+    return result;
+}
+
+// ================================================================================
+// reduce: (reduce f init coll) calls (f acc item) for each item of coll,
+// starting with init as acc, and returns the final acc.  (reduce f coll) uses
+// the first item as init, returns the only item of a 1 item coll and (f) for
+// an empty coll.
+RalTypePtr ral_reduce(RalTypeIter begin, RalTypeIter end)
+{
+    auto num = std::distance(begin, end);
+    if ((num != 2) && (num != 3)) {
+        throw RalException("'reduce' requires 2 or 3 parameters.");
+    }
+    auto fn = *begin;
+    RalSeqCursor cursor("reduce", *(end - 1));
+    RalTypePtr acc;
+    if (num == 3) {
+        acc = *(begin + 1);
+    }
+    else if (!cursor.next(acc)) {
+        return RalCaller(fn, 0).call();
+    }
+    RalCaller caller(fn, 2);
+    RalTypePtr item;
+    while (cursor.next(item)) {
+        acc = caller.call(acc, item);
+    }
+    return acc;
+}
+
+// ================================================================================
+// foldr: (foldr f init coll) is the right fold (f x1 (f x2 (... (f xn init)))).
+RalTypePtr ral_foldr(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("foldr", 3, std::distance(begin, end));
+    std::vector<RalTypePtr> items;
+    RalSeqCursor cursor("foldr", *(begin + 2));
+    RalTypePtr item;
+    while (cursor.next(item)) {
+        items.push_back(item);
+    }
+    RalCaller caller(*begin, 2);
+    auto acc = *(begin + 1);
+    for (auto iter = items.rbegin(); iter != items.rend(); iter++) {
+        acc = caller.call(*iter, acc);
+    }
+    return acc;
+}
+
+// ================================================================================
+// every?: (every? pred coll) returns true if pred returns neither nil nor false
+// for every item of coll.  Stops at the first item that fails.
+RalTypePtr ral_every_q(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("every?", 2, std::distance(begin, end));
+    RalCaller caller(*begin, 1);
+    RalSeqCursor cursor("every?", *(begin + 1));
+    RalTypePtr item;
+    while (cursor.next(item)) {
+        if (caller.call(item)->isNilOrFalse()) {
+            return std::make_shared<RalConstant>("false");
+        }
+    }
+    return std::make_shared<RalConstant>("true");
+}
+
+// ================================================================================
+// some: (some pred coll) returns the first result of (pred item) that is
+// neither nil nor false, or nil if there is none.
+RalTypePtr ral_some(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("some", 2, std::distance(begin, end));
+    RalCaller caller(*begin, 1);
+    RalSeqCursor cursor("some", *(begin + 1));
+    RalTypePtr item;
+    while (cursor.next(item)) {
+        auto result = caller.call(item);
+        if (!result->isNilOrFalse()) {
+            return result;
+        }
+    }
+    return std::make_shared<RalConstant>("nil");
+}
+
+// ================================================================================
+// partition-all: (partition-all n coll) returns a lazy seq of vectors of n
+// items of coll.  The last vector may have fewer items.  (partition-all n)
+// returns a transducer.
+RalTypePtr ral_partition_all(RalTypeIter begin, RalTypeIter end)
+{
+    auto num = std::distance(begin, end);
+    if ((num != 1) && (num != 2)) {
+        throw RalException("'partition-all' requires 1 or 2 parameters.");
+    }
+    auto n = (*begin)->asInt();
+    if (n <= 0) {
+        throw RalException("'partition-all' requires a positive size.");
+    }
+    auto xf = makeXform(RalXformStage::PARTITION_ALL, nullptr, n);
+    if (num == 1) {
+        return xf;
+    }
+    return makeLazySeq(std::make_shared<RalXformGen>(
+        std::static_pointer_cast<RalTransducer>(xf), *(begin + 1)));
+}
+
+// ================================================================================
+// comp: composes its arguments.  Given transducers, returns a transducer that
+// runs them left to right.  Given functions, returns a function that calls
+// them right to left, so ((comp f g) x) is (f (g x)).
+RalTypePtr ral_comp(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsAtLeast("comp", 1, std::distance(begin, end));
+    if ((*begin)->kind() == RalKind::TRANSDUCER) {
+        std::vector<RalXformStage> stages;
+        for (auto iter = begin; iter != end; iter++) {
+            auto &more = xformArg("comp", *iter)->stages();
+            stages.insert(stages.end(), more.begin(), more.end());
+        }
+        return std::make_shared<RalTransducer>(stages);
+    }
+    std::vector<RalTypePtr> fns(begin, end);
+    return std::make_shared<RalFunction>(
+        "comp", [fns](RalTypeIter fbegin, RalTypeIter fend) {
+            auto iter = fns.rbegin();
+            auto result = invoke(*iter++, fbegin, fend);
+            for (; iter != fns.rend(); iter++) {
+                result = RalCaller(*iter, 1).call(result);
+            }
+            return result;
+        });
+}
+
+// true if fn is a lambda with an arity for no arguments.  Builtins like +
+// don't say, so they are treated as not having one.
+static bool hasZeroArity(RalTypePtr fn)
+{
+    if (fn->kind() != RalKind::LAMBDA) {
+        return false;
+    }
+    auto a = std::static_pointer_cast<RalLambda>(fn)->arities()->find(0);
+    return (a != nullptr) && a->names_.empty();
+}
+
+// ================================================================================
+// transduce: (transduce xf f init coll) reduces coll with f like reduce, but
+// each item goes through transducer xf first.  (transduce xf f coll) starts
+// with (f) as init if f has a no-argument arity, else with the first item.
+RalTypePtr ral_transduce(RalTypeIter begin, RalTypeIter end)
+{
+    auto num = std::distance(begin, end);
+    if ((num != 3) && (num != 4)) {
+        throw RalException("'transduce' requires 3 or 4 parameters.");
+    }
+    auto xf = xformArg("transduce", *begin);
+    auto fn = *(begin + 1);
+    RalTypePtr acc;
+    if (num == 4) {
+        acc = *(begin + 2);
+    }
+    else if (hasZeroArity(fn)) {
+        acc = RalCaller(fn, 0).call();
+    }
+    // otherwise, like reduce, the first item out of xf is the init
+    RalCaller caller(fn, 2);
+    RalXformRun run(xf, [&](RalTypePtr item) {
+        acc = (acc == nullptr) ? item : caller.call(acc, item);
+    });
+    RalSeqCursor cursor("transduce", *(end - 1));
+    RalTypePtr item;
+    while (!run.done() && cursor.next(item)) {
+        run.push(item);
+    }
+    run.finish();
+    return (acc == nullptr) ? RalCaller(fn, 0).call() : acc;
+}
+
+// ================================================================================
+// into: (into to from) conj's the items of from onto the collection to.
+// (into to xf from) passes them through transducer xf first.  Items going into
+// a hash-map or sorted-map are [key value] pairs.
+RalTypePtr ral_into(RalTypeIter begin, RalTypeIter end)
+{
+    auto num = std::distance(begin, end);
+    if ((num != 2) && (num != 3)) {
+        throw RalException("'into' requires 2 or 3 parameters.");
+    }
+    auto to = *begin;
+    std::vector<RalTypePtr> items;
+    RalSeqCursor cursor("into", *(end - 1));
+    RalTypePtr item;
+    if (num == 3) {
+        RalXformRun run(xformArg("into", *(begin + 1)),
+                        [&](RalTypePtr out) { items.push_back(out); });
+        while (!run.done() && cursor.next(item)) {
+            run.push(item);
+        }
+        run.finish();
+    }
+    else {
+        while (cursor.next(item)) {
+            items.push_back(item);
+        }
+    }
+    if (items.empty()) {
+        return to;
+    }
+    if ((to->kind() == RalKind::MAP) || (to->kind() == RalKind::SORTED_MAP)) {
+        // assoc takes care of copying the map once
+        std::vector<RalTypePtr> args{to};
+        for (auto &entry : items) {
+            if ((entry->kind() != RalKind::LIST) ||
+                (std::static_pointer_cast<RalList>(entry)->size() != 2)) {
+                throw RalException("'into' a map requires [key value] items.");
+            }
+            args.push_back(std::static_pointer_cast<RalList>(entry)->get(0));
+            args.push_back(std::static_pointer_cast<RalList>(entry)->get(1));
+        }
+        return ral_assoc(args.data(), args.data() + args.size());
+    }
+    items.insert(items.begin(), to);
+    return ral_conj(items.data(), items.data() + items.size());
+}
+
+// ================================================================================
+// sequence: (sequence xf coll) returns a lazy seq of the items of coll passed
+// through transducer xf.  (sequence coll) returns a seq of coll.
+RalTypePtr ral_sequence(RalTypeIter begin, RalTypeIter end)
+{
+    auto num = std::distance(begin, end);
+    if (num == 1) {
+        return makeLazySeq(std::make_shared<RalTakeGen>(*begin, INT64_MAX));
+    }
+    checkArgsEqual("sequence", 2, num);
+    return makeLazySeq(std::make_shared<RalXformGen>(
+        xformArg("sequence", *begin), *(begin + 1)));
+}
+
+// ================================================================================
+// memoize: (memoize f) returns a function that calls f once for each set of
+// arguments it is given and returns the saved result after that.  Arguments
+// are compared with =.  Options may follow f:
+//   :max-entries n  keep at most n results, evicting the least recently used
+//   :ttl-ms n       call f again for results older than n milliseconds
+RalTypePtr ral_memoize(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsAtLeast("memoize", 1, std::distance(begin, end));
+    checkArgsOdd("memoize", std::distance(begin, end));
+    auto fn = *begin;
+    int64_t maxEntries = 0;
+    int64_t ttlMs = 0;
+    for (auto iter = begin + 1; iter != end; iter += 2) {
+        auto option = (*iter)->str(true);
+        auto value = (*(iter + 1))->asInt();
+        if (value < 0) {
+            throw RalException("'memoize' options cannot be negative.");
+        }
+        if (option == ":max-entries") {
+            maxEntries = value;
+        }
+        else if (option == ":ttl-ms") {
+            ttlMs = value;
+        }
+        else {
+            throw RalException("'memoize' options are :max-entries and :ttl-ms.");
+        }
+    }
+    auto cache = std::make_shared<RalMemoCache>(fn, (size_t)maxEntries, ttlMs);
+    return std::make_shared<RalMemoFunction>(cache);
+}
+
+// ================================================================================
+// memo-stats: takes a memoized function and returns a hash-map of its :hits,
+// :misses, :evictions and current :size.
+RalTypePtr ral_memo_stats(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("memo-stats", 1, std::distance(begin, end));
+    auto memo = std::dynamic_pointer_cast<RalMemoFunction>(*begin);
+    if (memo == nullptr) {
+        throw RalException("'memo-stats' requires a memoized function.");
+    }
+    auto cache = memo->cache();
+    auto mp = std::make_shared<RalMap>();
+    auto add = [&](const char *key, uint64_t n) {
+        mp->add(std::make_shared<RalKeyword>(key)->asMapKey(),
+                std::make_shared<RalInteger>((int64_t)n));
+    };
+    add(":hits", cache->hits_);
+    add(":misses", cache->misses_);
+    add(":evictions", cache->evictions_);
+    add(":size", cache->size());
+    return mp;
+}
+
+// ================================================================================
+// Sorting
+// ================================================================================
+// natural order sorts of at least this many items are split across threads
+const size_t RAL_PARALLEL_SORT_MIN = 1 << 16;
+
+// runs the tasks on their own threads and rethrows the first exception any of
+// them threw
+void runParallel(std::vector<std::function<void()>> &tasks)
+{
+    std::vector<std::exception_ptr> errors(tasks.size());
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < tasks.size(); i++) {
+        workers.emplace_back([&tasks, &errors, i]() {
+            try {
+                tasks[i]();
+            }
+            catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    for (auto &error : errors) {
+        if (error != nullptr) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+// Stable sort.  Large inputs are sorted in one run per core and the runs are
+// merged pairwise, also in parallel.  less must not call back into EVAL.
+template <typename T, typename Less>
+void parallelStableSort(std::vector<T> &v, Less less)
+{
+    size_t numThreads = std::min<size_t>(std::thread::hardware_concurrency(), 8);
+    if ((v.size() < RAL_PARALLEL_SORT_MIN) || (numThreads < 2)) {
+        std::stable_sort(v.begin(), v.end(), less);
+        return;
+    }
+    // run i is [bounds[i], bounds[i + 1])
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= numThreads; i++) {
+        bounds.push_back(v.size() * i / numThreads);
+    }
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0; i < numThreads; i++) {
+        auto lo = bounds[i];
+        auto hi = bounds[i + 1];
+        tasks.push_back([&v, lo, hi, less]() {
+            std::stable_sort(v.begin() + lo, v.begin() + hi, less);
+        });
+    }
+    runParallel(tasks);
+    while (bounds.size() > 2) {
+        std::vector<size_t> merged;
+        tasks.clear();
+        size_t i = 0;
+        for (; i + 2 < bounds.size(); i += 2) {
+            auto lo = bounds[i];
+            auto mid = bounds[i + 1];
+            auto hi = bounds[i + 2];
+            tasks.push_back([&v, lo, mid, hi, less]() {
+                std::inplace_merge(v.begin() + lo, v.begin() + mid,
+                                   v.begin() + hi, less);
+            });
+            merged.push_back(lo);
+        }
+        // an odd run out waits for the next round
+        for (; i < bounds.size(); i++) {
+            merged.push_back(bounds[i]);
+        }
+        runParallel(tasks);
+        bounds = merged;
+    }
+}
+
+// Returns the order of keys in their natural order (see compare), as indices.
+// Integer, double and string/keyword/symbol keys are sorted on their raw
+// values instead of comparing RalTypes.
+std::vector<size_t> naturalOrder(std::vector<RalTypePtr> &keys)
+{
+    bool allInts = true, allDoubles = true, allStrings = true;
+    for (auto &k : keys) {
+        allInts = allInts && (k->kind() == RalKind::INTEGER);
+        allDoubles = allDoubles && (k->kind() == RalKind::DOUBLE);
+        allStrings = allStrings && (k->kind() == keys[0]->kind()) &&
+                     ((k->kind() == RalKind::STRING) ||
+                      (k->kind() == RalKind::KEYWORD) ||
+                      (k->kind() == RalKind::SYMBOL));
+    }
+    std::vector<size_t> order;
+    order.reserve(keys.size());
+    if (allInts || allDoubles) {
+        std::vector<std::pair<double, size_t>> dv;
+        std::vector<std::pair<int64_t, size_t>> iv;
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (allInts) {
+                iv.emplace_back(keys[i]->asInt(), i);
+            }
+            else {
+                dv.emplace_back(keys[i]->asDouble(), i);
+            }
+        }
+        if (allInts) {
+            parallelStableSort(iv, [](const std::pair<int64_t, size_t> &a,
+                                      const std::pair<int64_t, size_t> &b) {
+                return a.first < b.first;
+            });
+            for (auto &p : iv) {
+                order.push_back(p.second);
+            }
+        }
+        else {
+            parallelStableSort(dv, [](const std::pair<double, size_t> &a,
+                                      const std::pair<double, size_t> &b) {
+                return a.first < b.first;
+            });
+            for (auto &p : dv) {
+                order.push_back(p.second);
+            }
+        }
+    }
+    else if (allStrings) {
+        std::vector<std::pair<std::string, size_t>> sv;
+        for (size_t i = 0; i < keys.size(); i++) {
+            sv.emplace_back(keys[i]->str(false), i);
+        }
+        parallelStableSort(sv, [](const std::pair<std::string, size_t> &a,
+                                  const std::pair<std::string, size_t> &b) {
+            return a.first < b.first;
+        });
+        for (auto &p : sv) {
+            order.push_back(p.second);
+        }
+    }
+    else {
+        for (size_t i = 0; i < keys.size(); i++) {
+            order.push_back(i);
+        }
+        parallelStableSort(order, [&keys](size_t a, size_t b) {
+            return ralCompare(keys[a], keys[b]) < 0;
+        });
+    }
+    return order;
+}
+
+// order with a ral comparator function.  This calls back into EVAL, so it
+// always runs on this thread.
+std::vector<size_t> comparatorOrder(std::vector<RalTypePtr> &keys,
+                                    RalTypePtr fn)
+{
+    std::vector<size_t> order;
+    for (size_t i = 0; i < keys.size(); i++) {
+        order.push_back(i);
+    }
+    RalComparator cmp{fn};
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return cmp.compare(keys[a], keys[b]) < 0;
+    });
+    return order;
+}
+
+std::vector<RalTypePtr> seqItems(const char *name, RalTypePtr coll)
+{
+    std::vector<RalTypePtr> items;
+    RalSeqCursor cursor(name, coll);
+    RalTypePtr item;
+    while (cursor.next(item)) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+RalTypePtr orderedList(std::vector<RalTypePtr> &items,
+                       const std::vector<size_t> &order)
+{
+    auto mp = std::make_shared<RalList>('(');
+    mp->reserve(order.size());
+    for (auto i : order) {
+        mp->add(items[i]);
+    }
+    return mp;
+}
+
+// ================================================================================
+// compare: returns -1, 0 or 1 as a is less than, equal to or greater than b in
+// their natural order.  nil sorts first, numbers compare by value, strings,
+// keywords & symbols by name, false before true and sequences by length, then
+// item by item.
+RalTypePtr ral_compare(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("compare", 2, std::distance(begin, end));
+    int c = ralCompare(*begin, *(begin + 1));
+    return std::make_shared<RalInteger>((int64_t)((c > 0) - (c < 0)));
+}
+
+// ================================================================================
+// sort: (sort coll) returns a list of the items of coll in their natural order.
+// The sort is stable.
+RalTypePtr ral_sort(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("sort", 1, std::distance(begin, end));
+    auto items = seqItems("sort", *begin);
+    return orderedList(items, naturalOrder(items));
+}
+
+// the natural order of a table column, sorting typed arrays in place of
+// their boxed items
+std::vector<size_t> columnOrder(RalTypePtr col)
+{
+    if (!isArray(col->kind())) {
+        auto keys = std::static_pointer_cast<RalList>(col);
+        std::vector<RalTypePtr> items(keys->data(),
+                                      keys->data() + keys->size());
+        return naturalOrder(items);
+    }
+    auto a = std::static_pointer_cast<RalArray>(col);
+    std::vector<size_t> order(a->size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    if (a->elem() == RalArray::F64) {
+        auto d = a->f64();
+        parallelStableSort(order,
+                           [d](size_t x, size_t y) { return d[x] < d[y]; });
+    }
+    else {
+        auto d = a->i64();
+        parallelStableSort(order,
+                           [d](size_t x, size_t y) { return d[x] < d[y]; });
+    }
+    return order;
+}
+
+// ================================================================================
+// sort-by: (sort-by keyfn coll) returns a list of the items of coll ordered by
+// (keyfn item).  keyfn is called once per item.  (sort-by keyfn cmp coll)
+// orders the keys with comparator cmp, as in sort-with.  For a table, keyfn
+// names a column & the result is a table.
+RalTypePtr ral_sort_by(RalTypeIter begin, RalTypeIter end)
+{
+    auto num = std::distance(begin, end);
+    if ((num != 2) && (num != 3)) {
+        throw RalException("'sort-by' requires 2 or 3 parameters.");
+    }
+    if ((*(end - 1))->kind() == RalKind::TABLE) {
+        auto t = std::static_pointer_cast<RalTable>(*(end - 1));
+        size_t j;
+        if (!t->find(*begin, j)) {
+            throw RalException("'sort-by' requires a column of the table.");
+        }
+        if (num == 3) {
+            std::vector<RalTypePtr> keys;
+            for (size_t i = 0; i < t->rows(); i++) {
+                keys.push_back(t->cell(j, i));
+            }
+            return t->take(comparatorOrder(keys, *(begin + 1)));
+        }
+        return t->take(columnOrder(t->column(j)));
+    }
+    auto items = seqItems("sort-by", *(end - 1));
+    std::vector<RalTypePtr> keys;
+    keys.reserve(items.size());
+    RalCaller keyfn(*begin, 1);
+    for (auto &item : items) {
+        keys.push_back(keyfn.call(item));
+    }
+    if (num == 3) {
+        return orderedList(items, comparatorOrder(keys, *(begin + 1)));
+    }
+    return orderedList(items, naturalOrder(keys));
+}
+
+// ================================================================================
+// sort-with: (sort-with cmp coll) returns a list of the items of coll ordered
+// by comparator cmp, which returns a negative, zero or positive number like
+// compare, or true when its first argument should sort first.
+RalTypePtr ral_sort_with(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("sort-with", 2, std::distance(begin, end));
+    auto items = seqItems("sort-with", *(begin + 1));
+    return orderedList(items, comparatorOrder(items, *begin));
+}
+
+// ================================================================================
+// Typed Arrays
+// ================================================================================
+RalTypePtr mapDouble(RalTypePtr x, double (*fn)(double),
+                     void (*kernel)(double *, size_t))
+{
+    if (isArray(x->kind())) {
+        auto mp = std::make_shared<RalArray>(
+            RalArray::F64, std::static_pointer_cast<RalArray>(x));
+        kernel(mp->f64(), mp->size());
+        return mp;
+    }
+    if (x->kind() == RalKind::MATRIX) {
+        auto mp = std::static_pointer_cast<RalMatrix>(x)->copy();
+        kernel(mp->data(), mp->size());
+        return mp;
+    }
+    return std::make_shared<RalDouble>(fn(x->asDouble()));
+}
+
+std::shared_ptr<RalArray> arrayArg(const char *name, RalTypePtr a)
+{
+    if (!isArray(a->kind())) {
+        throw RalException(std::string("'") + name +
+                           "' requires a typed array.");
+    }
+    return std::static_pointer_cast<RalArray>(a);
+}
+
+// an array of n zeros, or of the numbers in a collection
+RalTypePtr makeArray(const char *name, RalArray::Elem elem, RalTypeIter begin,
+                     RalTypeIter end)
+{
+    checkArgsEqual(name, 1, std::distance(begin, end));
+    auto arg = *begin;
+    if (arg->kind() == RalKind::INTEGER) {
+        auto n = arg->asInt();
+        if (n < 0) {
+            throw RalException(std::string("'") + name +
+                               "' requires a non-negative size.");
+        }
+        return std::make_shared<RalArray>(elem, (size_t)n);
+    }
+    if (isArray(arg->kind())) {
+        return std::make_shared<RalArray>(
+            elem, std::static_pointer_cast<RalArray>(arg));
+    }
+    if (arg->kind() == RalKind::MATRIX) {
+        // the items, row by row
+        auto m = std::static_pointer_cast<RalMatrix>(arg)->copy();
+        auto mp = std::make_shared<RalArray>(RalArray::F64, m->size());
+        std::copy(m->data(), m->data() + m->size(), mp->f64());
+        return (elem == RalArray::F64) ? mp
+                                       : std::make_shared<RalArray>(elem, mp);
+    }
+    auto items = seqItems(name, arg);
+    auto mp = std::make_shared<RalArray>(elem, items.size());
+    for (size_t i = 0; i < items.size(); i++) {
+        auto kind = items[i]->kind();
+        if ((kind != RalKind::INTEGER) && (kind != RalKind::DOUBLE)) {
+            throw RalException(std::string("'") + name +
+                               "' requires numbers.");
+        }
+        if (elem == RalArray::F64) {
+            mp->f64()[i] = items[i]->asDouble();
+        }
+        else {
+            mp->i64()[i] = (kind == RalKind::INTEGER)
+                               ? items[i]->asInt()
+                               : RalArray::toI64(name, items[i]->asDouble());
+        }
+    }
+    return mp;
+}
+
+// ================================================================================
+// f64-array: (f64-array coll) returns a typed array of the numbers in coll as
+// doubles.  (f64-array n) returns an array of n zeros.
+RalTypePtr ral_f64_array(RalTypeIter begin, RalTypeIter end)
+{
+    return makeArray("f64-array", RalArray::F64, begin, end);
+}
+
+// ================================================================================
+// i64-array: (i64-array coll) returns a typed array of the numbers in coll as
+// integers, truncating any doubles.  (i64-array n) returns an array of n zeros.
+RalTypePtr ral_i64_array(RalTypeIter begin, RalTypeIter end)
+{
+    return makeArray("i64-array", RalArray::I64, begin, end);
+}
+
+// ================================================================================
+RalTypePtr ral_array_q(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("array?", 1, std::distance(begin, end));
+    return isArray((*begin)->kind()) ? std::make_shared<RalConstant>("true")
+                                     : std::make_shared<RalConstant>("false");
+}
+
+// ================================================================================
+// vec: returns a vector of the items of a typed array or any other collection.
+// A matrix becomes a vector of row vectors.
+RalTypePtr ral_vec(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("vec", 1, std::distance(begin, end));
+    if (isArray((*begin)->kind())) {
+        return std::static_pointer_cast<RalArray>(*begin)->toVector();
+    }
+    if ((*begin)->kind() == RalKind::MATRIX) {
+        auto m = std::static_pointer_cast<RalMatrix>(*begin);
+        auto mp = std::make_shared<RalList>('[');
+        for (size_t i = 0; i < m->rows(); i++) {
+            auto row = std::make_shared<RalList>('[');
+            for (size_t j = 0; j < m->cols(); j++) {
+                row->add(std::make_shared<RalDouble>(m->at(i, j)));
+            }
+            mp->add(row);
+        }
+        return mp;
+    }
+    auto items = seqItems("vec", *begin);
+    auto mp = std::make_shared<RalList>('[');
+    mp->reserve(items.size());
+    for (auto &item : items) {
+        mp->add(item);
+    }
+    return mp;
+}
+
+// ================================================================================
+// sum: returns the sum of the numbers in a typed array, matrix or collection.
+RalTypePtr ral_sum(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("sum", 1, std::distance(begin, end));
+    if ((*begin)->kind() == RalKind::MATRIX) {
+        auto m = std::static_pointer_cast<RalMatrix>(*begin);
+        if (!m->isContiguous()) {
+            m = m->copy();
+        }
+        return std::make_shared<RalDouble>(f64Sum(m->data(), m->size()));
+    }
+    if (isArray((*begin)->kind())) {
+        auto a = std::static_pointer_cast<RalArray>(*begin);
+        if (a->elem() == RalArray::F64) {
+            return std::make_shared<RalDouble>(f64Sum(a->f64(), a->size()));
+        }
+        int64_t sum;
+        if (i64Sum(a->i64(), a->size(), &sum)) {
+            return std::make_shared<RalInteger>(sum);
+        }
+        RalBig total(int64_t(0));
+        for (size_t i = 0; i < a->size(); i++) {
+            total = total + RalBig(a->i64()[i]);
+        }
+        return makeInteger(total);
+    }
+    auto items = seqItems("sum", *begin);
+    items.insert(items.begin(), std::make_shared<RalInteger>(0));
+    return ral_add(items.data(), items.data() + items.size());
+}
+
+// ================================================================================
+// dot: returns the dot product of two typed arrays of the same length.  The
+// result is an integer only if both arrays are i64.
+RalTypePtr ral_dot(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("dot", 2, std::distance(begin, end));
+    auto a = arrayArg("dot", *begin);
+    auto b = arrayArg("dot", *(begin + 1));
+    if (a->size() != b->size()) {
+        throw RalException("'dot' requires arrays of the same length.");
+    }
+    if ((a->elem() == RalArray::I64) && (b->elem() == RalArray::I64)) {
+        int64_t dot;
+        if (i64Dot(a->i64(), b->i64(), a->size(), &dot)) {
+            return std::make_shared<RalInteger>(dot);
+        }
+        RalBig total(int64_t(0));
+        for (size_t i = 0; i < a->size(); i++) {
+            total = total + RalBig(a->i64()[i]) * RalBig(b->i64()[i]);
+        }
+        return makeInteger(total);
+    }
+    if (a->elem() == RalArray::I64) {
+        a = std::make_shared<RalArray>(RalArray::F64, a);
+    }
+    if (b->elem() == RalArray::I64) {
+        b = std::make_shared<RalArray>(RalArray::F64, b);
+    }
+    return std::make_shared<RalDouble>(f64Dot(a->f64(), b->f64(), a->size()));
+}
+
+// the smallest (or largest) item of a typed array, or of the numbers given
+RalTypePtr minMax(const char *name, bool isMax, RalTypeIter begin,
+                  RalTypeIter end)
+{
+    checkArgsAtLeast(name, 1, std::distance(begin, end));
+    if ((std::distance(begin, end) == 1) && isArray((*begin)->kind())) {
+        auto a = std::static_pointer_cast<RalArray>(*begin);
+        if (a->size() == 0) {
+            throw RalException(std::string("'") + name +
+                               "' requires a non-empty array.");
+        }
+        if (a->elem() == RalArray::F64) {
+            return std::make_shared<RalDouble>(isMax ? f64Max(a->f64(), a->size())
+                                                     : f64Min(a->f64(), a->size()));
+        }
+        return std::make_shared<RalInteger>(isMax ? i64Max(a->i64(), a->size())
+                                                  : i64Min(a->i64(), a->size()));
+    }
+    auto best = *begin;
+    for (auto iter = begin; iter != end; iter++) {
+        auto kind = (*iter)->kind();
+        if ((kind != RalKind::INTEGER) && (kind != RalKind::DOUBLE)) {
+            throw RalException(std::string("'") + name +
+                               "' requires numbers or a typed array.");
+        }
+        bool better;
+        if ((kind == RalKind::INTEGER) && (best->kind() == RalKind::INTEGER)) {
+            better = isMax ? ((*iter)->asInt() > best->asInt())
+                           : ((*iter)->asInt() < best->asInt());
+        }
+        else {
+            better = isMax ? ((*iter)->asDouble() > best->asDouble())
+                           : ((*iter)->asDouble() < best->asDouble());
+        }
+        if (better) {
+            best = *iter;
+        }
+    }
+    return best;
+}
+
+// ================================================================================
+// min: (min a b ...) returns the smallest number.  (min array) returns the
+// smallest item of a typed array.
+RalTypePtr ral_min(RalTypeIter begin, RalTypeIter end)
+{
+    return minMax("min", false, begin, end);
+}
+
+// ================================================================================
+// max: (max a b ...) returns the largest number.  (max array) returns the
+// largest item of a typed array.
+RalTypePtr ral_max(RalTypeIter begin, RalTypeIter end)
+{
+    return minMax("max", true, begin, end);
+}
+
+// ================================================================================
+// Matrices
+// ================================================================================
+std::shared_ptr<RalMatrix> matrixArg(const char *name, RalTypePtr m)
+{
+    if (m->kind() != RalKind::MATRIX) {
+        throw RalException(std::string("'") + name + "' requires a matrix.");
+    }
+    return std::static_pointer_cast<RalMatrix>(m);
+}
+
+size_t indexArg(const char *name, RalTypePtr i, size_t size)
+{
+    if (i->kind() != RalKind::INTEGER) {
+        throw RalException(std::string("'") + name + "' requires an integer.");
+    }
+    auto index = i->asInt();
+    if ((index < 0) || (index >= (int64_t)size)) {
+        throw RalIndexOutOfRange();
+    }
+    return (size_t)index;
+}
+
+double numberArg(const char *name, RalTypePtr x)
+{
+    if ((x->kind() != RalKind::INTEGER) && (x->kind() != RalKind::DOUBLE)) {
+        throw RalException(std::string("'") + name + "' requires numbers.");
+    }
+    return x->asDouble();
+}
+
+// ================================================================================
+// matrix: (matrix rows) returns a matrix from a collection of rows, each a
+// collection of numbers of the same length.  (matrix r c) returns an r x c
+// matrix of zeros & (matrix r c coll) one filled row by row from the r * c
+// numbers in coll.
+RalTypePtr ral_matrix(RalTypeIter begin, RalTypeIter end)
+{
+    auto num = std::distance(begin, end);
+    if (num == 1) {
+        auto rows = seqItems("matrix", *begin);
+        size_t cols = 0;
+        std::vector<std::vector<RalTypePtr>> items;
+        for (auto &row : rows) {
+            items.push_back(seqItems("matrix", row));
+            if ((items.size() > 1) && (items.back().size() != cols)) {
+                throw RalException(
+                    "'matrix' requires rows of the same length.");
+            }
+            cols = items.back().size();
+        }
+        auto mp = std::make_shared<RalMatrix>(rows.size(), cols);
+        for (size_t i = 0; i < items.size(); i++) {
+            for (size_t j = 0; j < cols; j++) {
+                mp->at(i, j) = numberArg("matrix", items[i][j]);
+            }
+        }
+        return mp;
+    }
+    if ((num != 2) && (num != 3)) {
+        throw RalException("'matrix' requires 1, 2 or 3 parameters.");
+    }
+    auto r = (*begin)->asInt();
+    auto c = (*(begin + 1))->asInt();
+    if ((r < 0) || (c < 0)) {
+        throw RalException("'matrix' requires a non-negative size.");
+    }
+    auto mp = std::make_shared<RalMatrix>((size_t)r, (size_t)c);
+    if (num == 3) {
+        auto items = seqItems("matrix", *(begin + 2));
+        if (items.size() != mp->size()) {
+            throw RalException("'matrix' requires r * c items.");
+        }
+        for (size_t i = 0; i < items.size(); i++) {
+            mp->data()[i] = numberArg("matrix", items[i]);
+        }
+    }
+    return mp;
+}
+
+// ================================================================================
+RalTypePtr ral_matrix_q(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("matrix?", 1, std::distance(begin, end));
+    return ((*begin)->kind() == RalKind::MATRIX)
+               ? std::make_shared<RalConstant>("true")
+               : std::make_shared<RalConstant>("false");
+}
+
+// ================================================================================
+// identity-matrix: (identity-matrix n) returns the n x n identity matrix.
+RalTypePtr ral_identity_matrix(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("identity-matrix", 1, std::distance(begin, end));
+    auto n = (*begin)->asInt();
+    if (n < 0) {
+        throw RalException("'identity-matrix' requires a non-negative size.");
+    }
+    auto mp = std::make_shared<RalMatrix>((size_t)n, (size_t)n);
+    for (size_t i = 0; i < (size_t)n; i++) {
+        mp->at(i, i) = 1.0;
+    }
+    return mp;
+}
+
+// ================================================================================
+// shape: returns [rows cols] of a matrix.
+RalTypePtr ral_shape(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("shape", 1, std::distance(begin, end));
+    auto m = matrixArg("shape", *begin);
+    auto mp = std::make_shared<RalList>('[');
+    mp->add(std::make_shared<RalInteger>((int64_t)m->rows()));
+    mp->add(std::make_shared<RalInteger>((int64_t)m->cols()));
+    return mp;
+}
+
+// ================================================================================
+// mget: (mget m i j) returns the item in row i & column j of m.
+RalTypePtr ral_mget(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("mget", 3, std::distance(begin, end));
+    auto m = matrixArg("mget", *begin);
+    auto i = indexArg("mget", *(begin + 1), m->rows());
+    auto j = indexArg("mget", *(begin + 2), m->cols());
+    return std::make_shared<RalDouble>(m->at(i, j));
+}
+
+// ================================================================================
+// row: (row m i) returns row i of m as a 1 x cols matrix that shares m's
+// items.
+RalTypePtr ral_row(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("row", 2, std::distance(begin, end));
+    auto m = matrixArg("row", *begin);
+    return m->row(indexArg("row", *(begin + 1), m->rows()));
+}
+
+// ================================================================================
+// col: (col m j) returns column j of m as a rows x 1 matrix that shares m's
+// items.
+RalTypePtr ral_col(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("col", 2, std::distance(begin, end));
+    auto m = matrixArg("col", *begin);
+    return m->col(indexArg("col", *(begin + 1), m->cols()));
+}
+
+// ================================================================================
+// transpose: returns the transpose of m, which shares m's items.
+RalTypePtr ral_transpose(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("transpose", 1, std::distance(begin, end));
+    return matrixArg("transpose", *begin)->transpose();
+}
+
+// ================================================================================
+// matmul: (matmul a b) returns the matrix product of a (n x m) & b (m x p).
+RalTypePtr ral_matmul(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("matmul", 2, std::distance(begin, end));
+    auto a = matrixArg("matmul", *begin);
+    auto b = matrixArg("matmul", *(begin + 1));
+    if (a->cols() != b->rows()) {
+        throw RalException("'matmul' requires a's columns to match b's rows.");
+    }
+    if (!a->isContiguous()) {
+        a = a->copy();
+    }
+    if (!b->isContiguous()) {
+        b = b->copy();
+    }
+    auto mp = std::make_shared<RalMatrix>(a->rows(), b->cols());
+    f64Matmul(a->data(), b->data(), mp->data(), a->rows(), a->cols(),
+              b->cols());
+    return mp;
+}
+
+// ================================================================================
+// solve: (solve a b) returns x where a x = b, for a square matrix a.  b is a
+// matrix with a's number of rows, or a typed array, which returns an f64
+// array.
+RalTypePtr ral_solve(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("solve", 2, std::distance(begin, end));
+    auto a = matrixArg("solve", *begin)->copy();
+    if (a->rows() != a->cols()) {
+        throw RalException("'solve' requires a square matrix.");
+    }
+    auto b = *(begin + 1);
+    std::shared_ptr<RalMatrix> x;
+    if (isArray(b->kind())) {
+        auto arr = std::make_shared<RalArray>(
+            RalArray::F64, std::static_pointer_cast<RalArray>(b));
+        x = std::make_shared<RalMatrix>(arr->size(), 1);
+        std::copy(arr->f64(), arr->f64() + arr->size(), x->data());
+    }
+    else {
+        x = matrixArg("solve", b)->copy();
+    }
+    if (x->rows() != a->rows()) {
+        throw RalException("'solve' requires b to have a's number of rows.");
+    }
+    if (!f64Solve(a->data(), x->data(), a->rows(), x->cols())) {
+        throw RalException("'solve' requires a non-singular matrix.");
+    }
+    if (isArray(b->kind())) {
+        auto mp = std::make_shared<RalArray>(RalArray::F64, x->size());
+        std::copy(x->data(), x->data() + x->size(), mp->f64());
+        return mp;
+    }
+    return x;
+}
+
+// ================================================================================
+// Random Numbers
+// ================================================================================
+std::shared_ptr<RalRng> rngArg(const char *name, RalTypePtr r)
+{
+    if (r->kind() != RalKind::RNG) {
+        throw RalException(std::string("'") + name + "' requires an rng.");
+    }
+    return std::static_pointer_cast<RalRng>(r);
+}
+
+int64_t positiveArg(const char *name, RalTypePtr n)
+{
+    if ((n->kind() != RalKind::INTEGER) || (n->asInt() <= 0)) {
+        throw RalException(std::string("'") + name +
+                           "' requires a positive integer.");
+    }
+    return n->asInt();
+}
+
+size_t sizeArg(const char *name, RalTypePtr n)
+{
+    if ((n->kind() != RalKind::INTEGER) || (n->asInt() < 0)) {
+        throw RalException(std::string("'") + name +
+                           "' requires a non-negative size.");
+    }
+    return (size_t)n->asInt();
+}
+
+// ================================================================================
+// rng: (rng seed) returns a new random number generator.  The same integer
+// seed always gives the same numbers.  (rng) seeds it from the system.
+RalTypePtr ral_rng(RalTypeIter begin, RalTypeIter end)
+{
+    auto num = std::distance(begin, end);
+    if (num > 1) {
+        throw RalException("'rng' requires 0 or 1 parameters.");
+    }
+    if (num == 1) {
+        if ((*begin)->kind() != RalKind::INTEGER) {
+            throw RalException("'rng' requires an integer seed.");
+        }
+        return std::make_shared<RalRng>((uint64_t)(*begin)->asInt());
+    }
+    std::random_device device;
+    uint64_t seed = ((uint64_t)device() << 32) ^ device() ^
+                    (uint64_t)std::chrono::high_resolution_clock::now()
+                        .time_since_epoch()
+                        .count();
+    return std::make_shared<RalRng>(seed);
+}
+
+// ================================================================================
+RalTypePtr ral_rng_q(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("rng?", 1, std::distance(begin, end));
+    return ((*begin)->kind() == RalKind::RNG)
+               ? std::make_shared<RalConstant>("true")
+               : std::make_shared<RalConstant>("false");
+}
+
+// ================================================================================
+// rand-int: (rand-int rng n) returns a random integer from 0 to n-1.
+RalTypePtr ral_rand_int(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("rand-int", 2, std::distance(begin, end));
+    auto rng = rngArg("rand-int", *begin);
+    auto n = positiveArg("rand-int", *(begin + 1));
+    return std::make_shared<RalInteger>((int64_t)rng->nextBelow((uint64_t)n));
+}
+
+// ================================================================================
+// rand-double: (rand-double rng) returns a random double in [0, 1).
+RalTypePtr ral_rand_double(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("rand-double", 1, std::distance(begin, end));
+    return std::make_shared<RalDouble>(
+        rngArg("rand-double", *begin)->nextDouble());
+}
+
+// ================================================================================
+// split: (split rng) returns a new rng whose numbers never overlap the ones rng
+// goes on to give, for handing to another thread or task.
+RalTypePtr ral_split(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("split", 1, std::distance(begin, end));
+    return rngArg("split", *begin)->split();
+}
+
+// ================================================================================
+// rand-doubles: (rand-doubles rng n) returns an f64 array of n random doubles
+// in [0, 1).
+RalTypePtr ral_rand_doubles(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("rand-doubles", 2, std::distance(begin, end));
+    auto rng = rngArg("rand-doubles", *begin);
+    auto mp = std::make_shared<RalArray>(
+        RalArray::F64, sizeArg("rand-doubles", *(begin + 1)));
+    auto data = mp->f64();
+    for (size_t i = 0; i < mp->size(); i++) {
+        data[i] = rng->nextDouble();
+    }
+    return mp;
+}
+
+// ================================================================================
+// rand-ints: (rand-ints rng n bound) returns an i64 array of n random integers
+// from 0 to bound-1.
+RalTypePtr ral_rand_ints(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("rand-ints", 3, std::distance(begin, end));
+    auto rng = rngArg("rand-ints", *begin);
+    auto mp = std::make_shared<RalArray>(RalArray::I64,
+                                         sizeArg("rand-ints", *(begin + 1)));
+    auto bound = (uint64_t)positiveArg("rand-ints", *(begin + 2));
+    auto data = mp->i64();
+    for (size_t i = 0; i < mp->size(); i++) {
+        data[i] = (int64_t)rng->nextBelow(bound);
+    }
+    return mp;
+}
+
+// ================================================================================
+// Array Files
+// ================================================================================
+// An array file is a 32 byte header followed by the items in native byte
+// order.  The header is the magic "RALARRAY", the element type (0 for f64, 1
+// for i64), the number of items & 8 bytes of zeros, each 8 bytes, so the
+// items start 32 byte aligned.
+struct RalArrayHeader {
+    char magic_[8];
+    uint64_t elem_;
+    uint64_t size_;
+    uint64_t reserved_;
+};
+static const char RAL_ARRAY_MAGIC[8] = {'R', 'A', 'L', 'A', 'R', 'R', 'A', 'Y'};
+
+// checks a header read from a file of fileSize bytes
+void checkArrayHeader(const RalArrayHeader &header, size_t fileSize,
+                      const std::string &filename)
+{
+    if ((fileSize < sizeof(RalArrayHeader)) ||
+        !std::equal(RAL_ARRAY_MAGIC, RAL_ARRAY_MAGIC + 8, header.magic_) ||
+        (header.elem_ > 1) ||
+        (header.size_ > (fileSize - sizeof(RalArrayHeader)) / 8)) {
+        throw RalException("'mmap-array' requires an array file: " +
+                           filename);
+    }
+}
+
+// ================================================================================
+// save-array: (save-array filename array) writes a typed array to an array
+// file & returns nil.  It writes a new file next to filename & renames it
+// over filename, so arrays mapped from the old file keep their pages, even
+// when the array being saved is one of them.
+RalTypePtr ral_save_array(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("save-array", 2, std::distance(begin, end));
+    std::string filename = (*begin)->str(false);
+    auto a = arrayArg("save-array", *(begin + 1));
+    RalArrayHeader header;
+    std::copy(RAL_ARRAY_MAGIC, RAL_ARRAY_MAGIC + 8, header.magic_);
+    header.elem_ = (a->elem() == RalArray::F64) ? 0 : 1;
+    header.size_ = a->size();
+    header.reserved_ = 0;
+    std::string tmpname = filename + ".tmp";
+    std::ofstream ofs(tmpname.c_str(), std::ios::out | std::ios::binary);
+    if (!ofs.is_open()) {
+        throw RalException("cannot write file: " + filename);
+    }
+    ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char *>(a->f64()), a->size() * 8);
+    ofs.close();
+    if (!ofs) {
+        std::remove(tmpname.c_str());
+        throw RalException("cannot write file: " + filename);
+    }
+#ifndef RAL_HAVE_MMAP
+    // rename doesn't replace an existing file everywhere
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+        std::remove(tmpname.c_str());
+        throw RalException("cannot write file: " + filename);
+    }
+    return std::make_shared<RalConstant>("nil");
+}
+
+// ================================================================================
+// mmap-array: (mmap-array filename) returns the typed array in an array file.
+// The items are the file's pages, mapped read-only, so nothing is parsed or
+// copied & only the pages used are read.  Without mmap the file is read in.
+RalTypePtr ral_mmap_array(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("mmap-array", 1, std::distance(begin, end));
+    std::string filename = (*begin)->str(false);
+#ifdef RAL_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw RalException("file not found: " + filename);
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(RalArrayHeader))) {
+        close(fd);
+        throw RalException("'mmap-array' requires an array file: " +
+                           filename);
+    }
+    size_t length = (size_t)st.st_size;
+    void *addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        throw RalException("'mmap-array' cannot map file: " + filename);
+    }
+    // unmapped when the last array using it goes away
+    std::shared_ptr<void> mapping(addr,
+                                  [length](void *p) { munmap(p, length); });
+    auto header = static_cast<RalArrayHeader *>(addr);
+    checkArrayHeader(*header, length, filename);
+    return std::make_shared<RalArray>(
+        (header->elem_ == 0) ? RalArray::F64 : RalArray::I64,
+        (size_t)header->size_, static_cast<char *>(addr) + sizeof(*header),
+        mapping);
+#else
+    std::ifstream ifs(filename.c_str(),
+                      std::ios::in | std::ios::binary | std::ios::ate);
+    if (!ifs.is_open()) {
+        throw RalException("file not found: " + filename);
+    }
+    size_t length = (size_t)ifs.tellg();
+    ifs.seekg(0, std::ios::beg);
+    RalArrayHeader header;
+    ifs.read(reinterpret_cast<char *>(&header), sizeof(header));
+    checkArrayHeader(header, length, filename);
+    auto mp = std::make_shared<RalArray>(
+        (header.elem_ == 0) ? RalArray::F64 : RalArray::I64,
+        (size_t)header.size_);
+    ifs.read(reinterpret_cast<char *>(mp->f64()), mp->size() * 8);
+    return mp;
+#endif
+}
+
+// ================================================================================
+// Tables
+// ================================================================================
+std::shared_ptr<RalTable> tableArg(const char *name, RalTypePtr t)
+{
+    if (t->kind() != RalKind::TABLE) {
+        throw RalException(std::string("'") + name + "' requires a table.");
+    }
+    return std::static_pointer_cast<RalTable>(t);
+}
+
+size_t columnArg(const char *name, std::shared_ptr<RalTable> t, RalTypePtr k)
+{
+    size_t j;
+    if (!t->find(k, j)) {
+        throw RalException(std::string("'") + name +
+                           "' requires a column of the table: " + k->str(true));
+    }
+    return j;
+}
+
+// the columns named by k, a column name or a vector of them
+std::vector<size_t> columnsArg(const char *name, std::shared_ptr<RalTable> t,
+                               RalTypePtr k)
+{
+    std::vector<size_t> js;
+    if (k->kind() == RalKind::LIST) {
+        auto names = std::static_pointer_cast<RalList>(k);
+        for (size_t i = 0; i < names->size(); i++) {
+            js.push_back(columnArg(name, t, names->get(i)));
+        }
+    }
+    else {
+        js.push_back(columnArg(name, t, k));
+    }
+    return js;
+}
+
+size_t columnSize(RalTypePtr col)
+{
+    if (isArray(col->kind())) {
+        return std::static_pointer_cast<RalArray>(col)->size();
+    }
+    return std::static_pointer_cast<RalList>(col)->size();
+}
+
+// Numbers the distinct keys of table rows in order of first appearance.  A
+// single i64 key column can be hashed raw; anything else hashes the boxed
+// values.
+class RalRowIndex {
+    bool raw_;
+    std::unordered_map<int64_t, size_t> ints_;
+    std::unordered_map<RalTypePtr, size_t, RalTypeHash, RalTypeEqual> values_;
+    size_t size_;
+
+  public:
+    static const size_t npos = (size_t)-1;
+    RalRowIndex(bool raw) : raw_(raw), size_(0) {}
+    // true if the rows of t can be indexed raw by the key columns
+    static bool canBeRaw(RalTable &t, const std::vector<size_t> &keys)
+    {
+        return (keys.size() == 1) &&
+               (t.column(keys[0])->kind() == RalKind::I64_ARRAY);
+    }
+    size_t size() { return size_; }
+    // the number of row i's key in the key columns of t.  A new key gets the
+    // next number when add is true & is npos otherwise.
+    size_t find(RalTable &t, const std::vector<size_t> &keys, size_t i,
+                bool add)
+    {
+        if (raw_) {
+            auto k = static_cast<RalArray *>(t.column(keys[0]).get())->i64()[i];
+            auto it = ints_.find(k);
+            if (it != ints_.end()) {
+                return it->second;
+            }
+            if (!add) {
+                return npos;
+            }
+            ints_.emplace(k, size_);
+            return size_++;
+        }
+        RalTypePtr k;
+        if (keys.size() == 1) {
+            k = t.cell(keys[0], i);
+        }
+        else {
+            auto v = std::make_shared<RalList>('[');
+            for (auto j : keys) {
+                v->add(t.cell(j, i));
+            }
+            k = v;
+        }
+        auto it = values_.find(k);
+        if (it != values_.end()) {
+            return it->second;
+        }
+        if (!add) {
+            return npos;
+        }
+        values_.emplace(k, size_);
+        return size_++;
+    }
+};
+
+// ================================================================================
+// table: (table columns) returns a table of columns, a map of column names to
+// vectors or typed arrays of the same length.  (table rows) returns a table of
+// a sequence of maps or records, with a column for every key in them & nil
+// for missing values.  Number columns are stored as typed arrays.
+RalTypePtr ral_table(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("table", 1, std::distance(begin, end));
+    std::vector<RalTypePtr> names, columns;
+    if ((*begin)->kind() == RalKind::MAP) {
+        auto m = std::static_pointer_cast<RalMap>(*begin);
+        auto keys = std::static_pointer_cast<RalList>(m->getKeys());
+        size_t rows = 0;
+        for (size_t j = 0; j < keys->size(); j++) {
+            auto col = m->get(keys->get(j));
+            if (!isArray(col->kind())) {
+                col = RalTable::makeColumn(seqItems("table", col));
+            }
+            if ((j > 0) && (columnSize(col) != rows)) {
+                throw RalException(
+                    "'table' requires columns of the same length.");
+            }
+            rows = columnSize(col);
+            names.push_back(keys->get(j));
+            columns.push_back(col);
+        }
+        return std::make_shared<RalTable>(names, columns, rows);
+    }
+    auto rows = seqItems("table", *begin);
+    std::unordered_map<std::string, size_t> index;
+    std::vector<std::vector<RalTypePtr>> values;
+    auto nil = std::make_shared<RalConstant>("nil");
+    for (size_t i = 0; i < rows.size(); i++) {
+        std::shared_ptr<RalList> keys;
+        if (rows[i]->kind() == RalKind::MAP) {
+            keys = std::static_pointer_cast<RalList>(
+                std::static_pointer_cast<RalMap>(rows[i])->getKeys());
+        }
+        else if (rows[i]->kind() == RalKind::RECORD) {
+            keys = std::static_pointer_cast<RalList>(
+                std::static_pointer_cast<RalRecord>(rows[i])->getKeys());
+        }
+        else {
+            throw RalException(
+                "'table' requires a map of columns or a sequence of maps.");
+        }
+        for (size_t k = 0; k < keys->size(); k++) {
+            auto key = keys->get(k);
+            auto it = index.emplace(key->asMapKey(), names.size());
+            if (it.second) {
+                names.push_back(key);
+                values.emplace_back(i, nil);
+            }
+            auto &col = values[it.first->second];
+            col.push_back(
+                (rows[i]->kind() == RalKind::MAP)
+                    ? std::static_pointer_cast<RalMap>(rows[i])->get(key)
+                    : std::static_pointer_cast<RalRecord>(rows[i])->get(key));
+        }
+        for (auto &col : values) {
+            if (col.size() == i) {
+                col.push_back(nil);
+            }
+        }
+    }
+    for (auto &col : values) {
+        columns.push_back(RalTable::makeColumn(col));
+    }
+    return std::make_shared<RalTable>(names, columns, rows.size());
+}
+
+// ================================================================================
+// table?: (table? x) returns true if x is a table
+RalTypePtr ral_is_table(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("table?", 1, std::distance(begin, end));
+    return ((*begin)->kind() == RalKind::TABLE)
+               ? std::make_shared<RalConstant>("true")
+               : std::make_shared<RalConstant>("false");
+}
+
+// ================================================================================
+// table->maps: (table->maps t) returns a vector of the rows of t as maps
+RalTypePtr ral_table_to_maps(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("table->maps", 1, std::distance(begin, end));
+    return tableArg("table->maps", *begin)->toMaps('[');
+}
+
+// ================================================================================
+// columns: (columns t) returns a vector of the column names of t
+RalTypePtr ral_columns(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("columns", 1, std::distance(begin, end));
+    auto t = tableArg("columns", *begin);
+    auto mp = std::make_shared<RalList>('[');
+    for (size_t j = 0; j < t->numColumns(); j++) {
+        mp->add(t->name(j));
+    }
+    return mp;
+}
+
+// ================================================================================
+// column: (column t k) returns column k of t, a typed array or a vector
+RalTypePtr ral_column(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("column", 2, std::distance(begin, end));
+    auto t = tableArg("column", *begin);
+    return t->column(columnArg("column", t, *(begin + 1)));
+}
+
+// ================================================================================
+// select: (select t k ...) returns a table of the columns of t named by the
+// ks, each a column name or a vector of them.  The columns are shared.
+RalTypePtr ral_select(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsAtLeast("select", 1, std::distance(begin, end));
+    auto t = tableArg("select", *begin);
+    std::vector<RalTypePtr> names, columns;
+    for (auto iter = begin + 1; iter != end; ++iter) {
+        for (auto j : columnsArg("select", t, *iter)) {
+            names.push_back(t->name(j));
+            columns.push_back(t->column(j));
+        }
+    }
+    return std::make_shared<RalTable>(names, columns, t->rows());
+}
+
+// ================================================================================
+// the comparisons where runs over raw columns
+enum class RalCompareOp { EQ, LT, LE, GT, GE };
+
+bool compareOp(RalTypePtr fn, RalCompareOp &op)
+{
+    if (fn->kind() != RalKind::FUNCTION) {
+        return false;
+    }
+    auto p = std::static_pointer_cast<RalFunction>(fn)
+                 ->signature()
+                 .target<RalTypePtr (*)(RalTypeIter, RalTypeIter)>();
+    if (p == nullptr) {
+        return false;
+    }
+    if (*p == ral_equal) {
+        op = RalCompareOp::EQ;
+    }
+    else if (*p == ral_lt) {
+        op = RalCompareOp::LT;
+    }
+    else if (*p == ral_le) {
+        op = RalCompareOp::LE;
+    }
+    else if (*p == ral_gt) {
+        op = RalCompareOp::GT;
+    }
+    else if (*p == ral_ge) {
+        op = RalCompareOp::GE;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+template <typename T, typename Pred>
+void keepRows(const T *d, size_t n, Pred pred, std::vector<size_t> &rows)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (pred(d[i])) {
+            rows.push_back(i);
+        }
+    }
+}
+
+template <typename T, typename X>
+void compareRows(const T *d, size_t n, RalCompareOp op, X x,
+                 std::vector<size_t> &rows)
+{
+    switch (op) {
+    case RalCompareOp::EQ:
+        keepRows(d, n, [x](T v) { return v == x; }, rows);
+        break;
+    case RalCompareOp::LT:
+        keepRows(d, n, [x](T v) { return v < x; }, rows);
+        break;
+    case RalCompareOp::LE:
+        keepRows(d, n, [x](T v) { return v <= x; }, rows);
+        break;
+    case RalCompareOp::GT:
+        keepRows(d, n, [x](T v) { return v > x; }, rows);
+        break;
+    case RalCompareOp::GE:
+        keepRows(d, n, [x](T v) { return v >= x; }, rows);
+        break;
+    }
+}
+
+// ================================================================================
+// where: (where t k pred) returns a table of the rows of t where (pred v) is
+// true for their value v in column k.  (where t k op x) keeps the rows where
+// (op v x) is true.  When op is =, <, <=, > or >=, x is a number & the column
+// is a typed array, the comparison runs over the raw column without calling
+// op.
+RalTypePtr ral_where(RalTypeIter begin, RalTypeIter end)
+{
+    auto num = std::distance(begin, end);
+    if ((num != 3) && (num != 4)) {
+        throw RalException("'where' requires 3 or 4 parameters.");
+    }
+    auto t = tableArg("where", *begin);
+    auto j = columnArg("where", t, *(begin + 1));
+    auto col = t->column(j);
+    std::vector<size_t> rows;
+    RalCompareOp op;
+    if ((num == 4) && isArray(col->kind()) && compareOp(*(begin + 2), op) &&
+        (((*(begin + 3))->kind() == RalKind::INTEGER) ||
+         ((*(begin + 3))->kind() == RalKind::DOUBLE))) {
+        auto a = std::static_pointer_cast<RalArray>(col);
+        auto x = *(begin + 3);
+        // = is never true for an integer & a double, as with boxed values
+        if ((op == RalCompareOp::EQ) &&
+            ((a->elem() == RalArray::F64) != (x->kind() == RalKind::DOUBLE))) {
+            return t->take(rows);
+        }
+        if (a->elem() == RalArray::F64) {
+            compareRows(a->f64(), a->size(), op, x->asDouble(), rows);
+        }
+        else if (x->kind() == RalKind::INTEGER) {
+            compareRows(a->i64(), a->size(), op, x->asInt(), rows);
+        }
+        else {
+            compareRows(a->i64(), a->size(), op, x->asDouble(), rows);
+        }
+        return t->take(rows);
+    }
+    RalCaller pred(*(begin + 2), num - 2);
+    for (size_t i = 0; i < t->rows(); i++) {
+        auto keep = (num == 4) ? pred.call(t->cell(j, i), *(begin + 3))
+                               : pred.call(t->cell(j, i));
+        if (!keep->isNilOrFalse()) {
+            rows.push_back(i);
+        }
+    }
+    return t->take(rows);
+}
+
+// ================================================================================
+// out[g] = the :sum, :min or :max of the items of d in group g.  out starts
+// as zeros & every group has at least one item.
+template <typename T>
+void aggregate(const std::string &op, const T *d,
+               const std::vector<size_t> &gid, T *out, size_t groups)
+{
+    if (op == ":sum") {
+        for (size_t i = 0; i < gid.size(); i++) {
+            out[gid[i]] += d[i];
+        }
+        return;
+    }
+    std::vector<bool> seen(groups);
+    bool isMin = (op == ":min");
+    for (size_t i = 0; i < gid.size(); i++) {
+        auto g = gid[i];
+        if (!seen[g] || (isMin ? (d[i] < out[g]) : (d[i] > out[g]))) {
+            out[g] = d[i];
+            seen[g] = true;
+        }
+    }
+}
+
+// the :sum of the items of d in each group, as an i64 array, or as a vector
+// with bigints if a sum doesn't fit in an i64
+RalTypePtr sumI64Column(const int64_t *d, const std::vector<size_t> &gid,
+                        size_t groups)
+{
+    auto mp = std::make_shared<RalArray>(RalArray::I64, groups);
+    auto out = mp->i64();
+    bool overflow = false;
+    for (size_t i = 0; i < gid.size(); i++) {
+        overflow |= ralAddOverflow(out[gid[i]], d[i], &out[gid[i]]);
+    }
+    if (!overflow) {
+        return mp;
+    }
+    std::vector<RalBig> sums(groups, RalBig(int64_t(0)));
+    for (size_t i = 0; i < gid.size(); i++) {
+        sums[gid[i]] = sums[gid[i]] + RalBig(d[i]);
+    }
+    std::vector<RalTypePtr> values;
+    for (auto &s : sums) {
+        values.push_back(makeInteger(s));
+    }
+    return RalTable::makeColumn(values);
+}
+
+// the column for one group-by aggregate, spec
+RalTypePtr aggregateColumn(std::shared_ptr<RalTable> t, RalTypePtr spec,
+                           const std::vector<size_t> &gid, size_t groups)
+{
+    auto s = (spec->kind() == RalKind::LIST)
+                 ? std::static_pointer_cast<RalList>(spec)
+                 : nullptr;
+    auto op = ((s != nullptr) && (s->size() > 0)) ? s->get(0)->str(true) : "";
+    if ((op == ":count") && (s->size() == 1)) {
+        auto mp = std::make_shared<RalArray>(RalArray::I64, groups);
+        for (auto g : gid) {
+            mp->i64()[g]++;
+        }
+        return mp;
+    }
+    if (((op != ":sum") && (op != ":mean") && (op != ":min") &&
+         (op != ":max")) ||
+        (s->size() != 2)) {
+        throw RalException("'group-by' requires aggregates like [:count] or "
+                           "[:sum column].");
+    }
+    auto col = t->column(columnArg("group-by", t, s->get(1)));
+    if (!isArray(col->kind())) {
+        throw RalException("'group-by' requires a number column for " + op +
+                           ".");
+    }
+    auto a = std::static_pointer_cast<RalArray>(col);
+    if (op == ":mean") {
+        auto mp = std::make_shared<RalArray>(RalArray::F64, groups);
+        std::vector<size_t> counts(groups);
+        for (size_t i = 0; i < gid.size(); i++) {
+            mp->f64()[gid[i]] += (a->elem() == RalArray::F64)
+                                     ? a->f64()[i]
+                                     : (double)a->i64()[i];
+            counts[gid[i]]++;
+        }
+        for (size_t g = 0; g < groups; g++) {
+            mp->f64()[g] /= counts[g];
+        }
+        return mp;
+    }
+    if ((op == ":sum") && (a->elem() == RalArray::I64)) {
+        return sumI64Column(a->i64(), gid, groups);
+    }
+    auto mp = std::make_shared<RalArray>(a->elem(), groups);
+    if (a->elem() == RalArray::F64) {
+        aggregate(op, a->f64(), gid, mp->f64(), groups);
+    }
+    else {
+        aggregate(op, a->i64(), gid, mp->i64(), groups);
+    }
+    return mp;
+}
+
+// ================================================================================
+// group-by: (group-by t k aggs) groups the rows of t by their values in
+// column k, or in the columns of a vector k, & returns a table with a row for
+// each group, in order of first appearance.  It has the key columns & a
+// column for each entry of the map aggs, whose value is [:count] or [op k]
+// with op one of :sum, :mean, :min or :max of number column k.  The groups are
+// found with a hash table & each aggregate is one pass over its column.
+RalTypePtr ral_group_by(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("group-by", 3, std::distance(begin, end));
+    auto t = tableArg("group-by", *begin);
+    auto keys = columnsArg("group-by", t, *(begin + 1));
+    if ((*(begin + 2))->kind() != RalKind::MAP) {
+        throw RalException("'group-by' requires a map of aggregates.");
+    }
+    RalRowIndex index(RalRowIndex::canBeRaw(*t, keys));
+    std::vector<size_t> gid(t->rows()), firsts;
+    for (size_t i = 0; i < t->rows(); i++) {
+        gid[i] = index.find(*t, keys, i, true);
+        if (gid[i] == firsts.size()) {
+            firsts.push_back(i);
+        }
+    }
+    std::vector<RalTypePtr> names, columns;
+    for (auto j : keys) {
+        names.push_back(t->name(j));
+        columns.push_back(RalTable::takeColumn(t->column(j), firsts));
+    }
+    auto aggs = std::static_pointer_cast<RalMap>(*(begin + 2));
+    auto aggNames = std::static_pointer_cast<RalList>(aggs->getKeys());
+    for (size_t k = 0; k < aggNames->size(); k++) {
+        names.push_back(aggNames->get(k));
+        columns.push_back(aggregateColumn(t, aggs->get(aggNames->get(k)), gid,
+                                          firsts.size()));
+    }
+    return std::make_shared<RalTable>(names, columns, firsts.size());
+}
+
+// ================================================================================
+// join: (join a b k) returns the inner join of tables a & b on column k, or
+// the columns of a vector k: a row for every pair of rows of a & b with equal
+// keys, in the order of a.  The result has the columns of a, then those of b
+// not in a.  The rows of b are hashed, then each row of a is looked up.
+RalTypePtr ral_join(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("join", 3, std::distance(begin, end));
+    auto a = tableArg("join", *begin);
+    auto b = tableArg("join", *(begin + 1));
+    auto aKeys = columnsArg("join", a, *(begin + 2));
+    auto bKeys = columnsArg("join", b, *(begin + 2));
+    RalRowIndex index(RalRowIndex::canBeRaw(*a, aKeys) &&
+                      RalRowIndex::canBeRaw(*b, bKeys));
+    std::vector<std::vector<size_t>> matches;
+    for (size_t i = 0; i < b->rows(); i++) {
+        auto k = index.find(*b, bKeys, i, true);
+        if (k == matches.size()) {
+            matches.emplace_back();
+        }
+        matches[k].push_back(i);
+    }
+    std::vector<size_t> aRows, bRows;
+    for (size_t i = 0; i < a->rows(); i++) {
+        auto k = index.find(*a, aKeys, i, false);
+        if (k != RalRowIndex::npos) {
+            for (auto r : matches[k]) {
+                aRows.push_back(i);
+                bRows.push_back(r);
+            }
+        }
+    }
+    auto joined = a->take(aRows);
+    std::vector<RalTypePtr> names, columns;
+    for (size_t j = 0; j < joined->numColumns(); j++) {
+        names.push_back(joined->name(j));
+        columns.push_back(joined->column(j));
+    }
+    for (size_t j = 0; j < b->numColumns(); j++) {
+        size_t ignore;
+        if (!a->find(b->name(j), ignore)) {
+            names.push_back(b->name(j));
+            columns.push_back(RalTable::takeColumn(b->column(j), bRows));
+        }
+    }
+    return std::make_shared<RalTable>(names, columns, aRows.size());
+}
+
+// ================================================================================
+// Protocols & Multimethods
+// ================================================================================
+std::shared_ptr<RalMultiFn> multiFnArg(const char *name, RalTypePtr mf)
+{
+    if (mf->kind() != RalKind::MULTI_FN) {
+        throw RalException(std::string("'") + name +
+                           "' requires a protocol method or multimethod.");
+    }
+    return std::static_pointer_cast<RalMultiFn>(mf);
+}
+
+// ================================================================================
+// protocol-fn: takes a name and returns a protocol method without any
+// methods.  It dispatches on the type of its first argument.
+RalTypePtr ral_protocol_fn(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("protocol-fn", 1, std::distance(begin, end));
+    return std::make_shared<RalMultiFn>((*begin)->str(false), nullptr);
+}
+
+// ================================================================================
+// multi-fn: takes a name and a dispatch function and returns a multimethod
+// without any methods.  It dispatches on what the dispatch function returns
+// for its arguments.
+RalTypePtr ral_multi_fn(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("multi-fn", 2, std::distance(begin, end));
+    auto dispatch = *(begin + 1);
+    if ((dispatch->kind() != RalKind::FUNCTION) &&
+        (dispatch->kind() != RalKind::LAMBDA) &&
+        (dispatch->kind() != RalKind::MULTI_FN)) {
+        throw RalException("'multi-fn' requires a dispatch function.");
+    }
+    return std::make_shared<RalMultiFn>((*begin)->str(false), dispatch);
+}
+
+// ================================================================================
+// add-method: takes a protocol method or multimethod, a dispatch value and a
+// function and makes the function the method for that value.  A protocol
+// method's dispatch values are types, and either takes :default.
+RalTypePtr ral_add_method(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("add-method", 3, std::distance(begin, end));
+    auto mf = multiFnArg("add-method", *begin);
+    mf->addMethod(*(begin + 1), *(begin + 2));
+    return mf;
+}
+
+// ================================================================================
+// extend: takes a type, a protocol (a map of method keywords to protocol
+// methods, as made by defprotocol) and a map of method keywords to functions
+// and adds each function to the protocol method of the same name for type.
+RalTypePtr ral_extend(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("extend", 3, std::distance(begin, end));
+    auto type = *begin;
+    auto protocol = *(begin + 1);
+    auto fns = *(begin + 2);
+    if ((typeKeyOf(type) == 0) && (type->str(false) != ":default")) {
+        throw RalException("'extend' requires a type keyword or record type.");
+    }
+    if ((protocol->kind() != RalKind::MAP) || (fns->kind() != RalKind::MAP)) {
+        throw RalException("'extend' requires a protocol and a map of methods.");
+    }
+    auto pp = std::static_pointer_cast<RalMap>(protocol);
+    auto fp = std::static_pointer_cast<RalMap>(fns);
+    auto keys = std::static_pointer_cast<RalList>(fp->getKeys());
+    for (size_t i = 0; i < keys->size(); i++) {
+        auto mf = pp->get(keys->get(i));
+        if ((mf->kind() != RalKind::MULTI_FN) ||
+            !std::static_pointer_cast<RalMultiFn>(mf)->isProtocol()) {
+            throw RalException("'extend' given " + keys->get(i)->str(true) +
+                               ", which is not in the protocol.");
+        }
+        std::static_pointer_cast<RalMultiFn>(mf)->addMethod(type,
+                                                            fp->get(keys->get(i)));
+    }
+    return std::make_shared<RalConstant>("nil");
+}
+
+// ================================================================================
+// type: returns the record type of a record, or else a keyword for the type
+// of its argument, like :vector or :string.  These are what extend takes.
+RalTypePtr ral_type(RalTypeIter begin, RalTypeIter end)
+{
+    checkArgsEqual("type", 1, std::distance(begin, end));
+    return typeOf(*begin);
+}
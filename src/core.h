@@ -26,6 +26,11 @@
 #include <map>
 #include <string>
 
+// argument checks
+void checkArgsEqual(const char *name, size_t expected, size_t num);
+void checkArgsAtLeast(const char *name, size_t min, size_t num);
+void checkArgsEven(const char *name, size_t num);
+void checkArgsOdd(const char *name, size_t num);
 // integer/double math
 RalTypePtr ral_add(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_sub(RalTypeIter begin, RalTypeIter end);
@@ -36,10 +41,10 @@ RalTypePtr ral_lt(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_le(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_gt(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_ge(RalTypeIter begin, RalTypeIter end);
-// double math
-RalTypePtr ral_sqrt_d(RalTypeIter begin, RalTypeIter end);
-RalTypePtr ral_sin_d(RalTypeIter begin, RalTypeIter end);
-RalTypePtr ral_cos_d(RalTypeIter begin, RalTypeIter end);
+// double math is bound with defnative in core.cpp.  this applies fn to a
+// number, or kernel to a copy of a typed array or matrix as doubles.
+RalTypePtr mapDouble(RalTypePtr x, double (*fn)(double),
+                     void (*kernel)(double *, size_t));
 // non-math
 RalTypePtr ral_list(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_list_q(RalTypeIter begin, RalTypeIter end);
@@ -52,6 +57,7 @@ RalTypePtr ral_prn(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_println(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_read_string(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_slurp(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_delete_file(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_atom(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_atom_q(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_deref(RalTypeIter begin, RalTypeIter end);
@@ -93,6 +99,112 @@ RalTypePtr ral_number_q(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_seq(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_conj(RalTypeIter begin, RalTypeIter end);
 RalTypePtr ral_macro_q(RalTypeIter begin, RalTypeIter end);
+// transients
+RalTypePtr ral_transient(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_conj_bang(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_assoc_bang(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_dissoc_bang(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_persistent_bang(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_disj_bang(RalTypeIter begin, RalTypeIter end);
+// sets
+RalTypePtr ral_set(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_hash_set(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_set_q(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_disj(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_union(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_intersection(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_difference(RalTypeIter begin, RalTypeIter end);
+// records
+RalTypePtr ral_record_type(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_record(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_map_to_record(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_record_q(RalTypeIter begin, RalTypeIter end);
+// sorted maps
+RalTypePtr ral_sorted_map(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_sorted_map_by(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_sorted_q(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_subseq(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_rsubseq(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_first_key(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_last_key(RalTypeIter begin, RalTypeIter end);
+// lazy seqs
+RalTypePtr ral_lazy_seq_star(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_lazy_seq_q(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_range(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_iterate(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_repeat(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_take(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_drop(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_take_while(RalTypeIter begin, RalTypeIter end);
+// sequence functions
+RalTypePtr ral_filter(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_remove(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_keep(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_reduce(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_foldr(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_every_q(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_some(RalTypeIter begin, RalTypeIter end);
+// transducers
+RalTypePtr ral_partition_all(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_comp(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_transduce(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_into(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_sequence(RalTypeIter begin, RalTypeIter end);
+// memoize
+RalTypePtr ral_memoize(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_memo_stats(RalTypeIter begin, RalTypeIter end);
+// sorting
+RalTypePtr ral_compare(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_sort(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_sort_by(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_sort_with(RalTypeIter begin, RalTypeIter end);
+// typed arrays
+RalTypePtr ral_f64_array(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_i64_array(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_array_q(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_vec(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_sum(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_dot(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_min(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_max(RalTypeIter begin, RalTypeIter end);
+// matrices
+RalTypePtr ral_matrix(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_matrix_q(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_identity_matrix(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_shape(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_mget(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_row(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_col(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_transpose(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_matmul(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_solve(RalTypeIter begin, RalTypeIter end);
+// random numbers
+RalTypePtr ral_rng(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_rng_q(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_rand_int(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_rand_double(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_split(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_rand_doubles(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_rand_ints(RalTypeIter begin, RalTypeIter end);
+// array files
+RalTypePtr ral_save_array(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_mmap_array(RalTypeIter begin, RalTypeIter end);
+// tables
+RalTypePtr ral_table(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_is_table(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_table_to_maps(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_columns(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_column(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_select(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_where(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_group_by(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_join(RalTypeIter begin, RalTypeIter end);
+// protocols & multimethods
+RalTypePtr ral_protocol_fn(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_multi_fn(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_add_method(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_extend(RalTypeIter begin, RalTypeIter end);
+RalTypePtr ral_type(RalTypeIter begin, RalTypeIter end);
 
 // RalCore::ns is for mapping from symbol string to above functions
 struct RalCore {
@@ -36,8 +36,16 @@ RalEnv::RalEnv()
 
 RalEnv::RalEnv(RalEnvPtr outer, std::vector<RalTypePtr> &binds,
                std::vector<RalTypePtr> &exprs)
+    : RalEnv(outer, binds, exprs.data(), exprs.data() + exprs.size())
+{
+}
+
+// binds the exprs in [begin, end).  Missing exprs are bound to nil.
+RalEnv::RalEnv(RalEnvPtr outer, std::vector<RalTypePtr> &binds,
+               RalTypeIter begin, RalTypeIter end)
 {
     outer_ = outer;
+    size_t num = end - begin;
     bool varArgMode = false;
     size_t i = 0;
     for (auto mp : binds) {
@@ -47,15 +55,17 @@ RalEnv::RalEnv(RalEnvPtr outer, std::vector<RalTypePtr> &binds,
                 varArgMode = true;
             }
             else {
+                auto expr = (i < num) ? begin[i++]
+                                      : std::make_shared<RalConstant>("nil");
                 DBG << "env_bind: " << mp->str(false) << " = "
-                    << exprs[i]->str(true) << "\n";
-                data_[mp->str(false)] = exprs[i++];
+                    << expr->str(true) << "\n";
+                data_[mp->str(false)] = expr;
             }
         }
         else {
             RalTypePtr lp = std::make_shared<RalList>('(');
-            while (i < exprs.size()) {
-                std::static_pointer_cast<RalList>(lp)->add(exprs[i++]);
+            while (i < num) {
+                std::static_pointer_cast<RalList>(lp)->add(begin[i++]);
             }
             DBG << "env_bind: " << mp->str(false) << " = " << lp->str(true)
                 << "\n";
@@ -64,6 +74,36 @@ RalEnv::RalEnv(RalEnvPtr outer, std::vector<RalTypePtr> &binds,
     }
 }
 
+// binds the arguments in [begin, end) to the parameters of a function arity.
+// Missing arguments are bound to nil.  The variadic tail is a list of the
+// remaining arguments, moved out of [begin, end) when moveArgs is true.
+RalEnv::RalEnv(RalEnvPtr outer, const RalArity &arity, RalTypeIter begin,
+               RalTypeIter end, bool moveArgs)
+{
+    outer_ = outer;
+    size_t num = end - begin;
+    size_t i = 0;
+    for (auto &name : arity.names_) {
+        if (i < num) {
+            data_[name] = begin[i++];
+        }
+        else {
+            data_[name] = std::make_shared<RalConstant>("nil");
+        }
+    }
+    if (arity.variadic_) {
+        std::vector<RalTypePtr> rest;
+        if (moveArgs) {
+            rest.assign(std::make_move_iterator(begin + i),
+                        std::make_move_iterator(end));
+        }
+        else if (i < num) {
+            rest.assign(begin + i, end);
+        }
+        data_[arity.rest_] = std::make_shared<RalList>('(', std::move(rest));
+    }
+}
+
 // ================================================================================
 // special setter for functions
 void RalEnv::set(const std::string &name, const RalFunctionSignature &fn)
@@ -39,6 +39,10 @@ class RalEnv : public std::enable_shared_from_this<RalEnv> {
     RalEnv();
     RalEnv(RalEnvPtr outer, std::vector<RalTypePtr> &binds,
            std::vector<RalTypePtr> &exprs);
+    RalEnv(RalEnvPtr outer, std::vector<RalTypePtr> &binds, RalTypeIter begin,
+           RalTypeIter end);
+    RalEnv(RalEnvPtr outer, const RalArity &arity, RalTypeIter begin,
+           RalTypeIter end, bool moveArgs);
     void set(const std::string &name, const RalFunctionSignature &fn);
     void set(const std::string &name, const RalTypePtr &fn);
     RalEnvPtr find(const std::string &name);
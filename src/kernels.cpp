@@ -0,0 +1,694 @@
+// ======================================================================
+// ral - Roger Allen's Lisp via https://github.com/kanaka/mal
+// Copyright(C) 2020 Roger Allen
+//
+// kernels.cpp - numeric kernels over contiguous arrays
+//
+// ======================================================================
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#include "bigint.h"
+#include "kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RAL_HAVE_AVX2 1
+#include <immintrin.h>
+#define RAL_AVX2 __attribute__((target("avx2")))
+#endif
+
+// ================================================================================
+// Scalar kernels
+// ================================================================================
+template <typename T> static T applyOp(RalKernelOp op, T a, T b)
+{
+    switch (op) {
+    case RalKernelOp::ADD:
+        return a + b;
+    case RalKernelOp::SUB:
+        return a - b;
+    case RalKernelOp::MUL:
+        return a * b;
+    default:
+        return a / b;
+    }
+}
+
+template <typename T>
+static void scalarBinary(RalKernelOp op, T *a, const T *b, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        a[i] = applyOp(op, a[i], b[i]);
+    }
+}
+
+template <typename T>
+static void scalarScalar(RalKernelOp op, T *a, T b, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        a[i] = applyOp(op, a[i], b);
+    }
+}
+
+template <typename T>
+static void scalarScalarLeft(RalKernelOp op, T *a, T b, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        a[i] = applyOp(op, b, a[i]);
+    }
+}
+
+template <typename T> static T scalarSum(const T *a, size_t n)
+{
+    T sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i];
+    }
+    return sum;
+}
+
+template <typename T> static T scalarDot(const T *a, const T *b, size_t n)
+{
+    T sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// *r = a op b, or false if that doesn't fit in an int64_t
+static bool checkedOp(RalKernelOp op, int64_t a, int64_t b, int64_t *r)
+{
+    switch (op) {
+    case RalKernelOp::ADD:
+        return !ralAddOverflow(a, b, r);
+    case RalKernelOp::SUB:
+        return !ralSubOverflow(a, b, r);
+    case RalKernelOp::MUL:
+        return !ralMulOverflow(a, b, r);
+    default:
+        if ((a == INT64_MIN) && (b == -1)) {
+            return false;
+        }
+        *r = a / b;
+        return true;
+    }
+}
+
+static bool checkedBinary(RalKernelOp op, int64_t *a, const int64_t *b,
+                          size_t n)
+{
+    bool ok = true;
+    for (size_t i = 0; i < n; i++) {
+        ok &= checkedOp(op, a[i], b[i], &a[i]);
+    }
+    return ok;
+}
+
+static bool checkedScalar(RalKernelOp op, int64_t *a, int64_t b, size_t n)
+{
+    bool ok = true;
+    for (size_t i = 0; i < n; i++) {
+        ok &= checkedOp(op, a[i], b, &a[i]);
+    }
+    return ok;
+}
+
+static bool checkedScalarLeft(RalKernelOp op, int64_t *a, int64_t b,
+                              size_t n)
+{
+    bool ok = true;
+    for (size_t i = 0; i < n; i++) {
+        ok &= checkedOp(op, b, a[i], &a[i]);
+    }
+    return ok;
+}
+
+static bool checkedSum(const int64_t *a, size_t n, int64_t *sum)
+{
+    bool ok = true;
+    for (size_t i = 0; i < n; i++) {
+        ok &= !ralAddOverflow(*sum, a[i], sum);
+    }
+    return ok;
+}
+
+static void scalarAxpy(double *y, double a, const double *x, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+// ================================================================================
+// AVX2 kernels
+// ================================================================================
+#ifdef RAL_HAVE_AVX2
+RAL_AVX2 static __m256d avx2Op(RalKernelOp op, __m256d a, __m256d b)
+{
+    switch (op) {
+    case RalKernelOp::ADD:
+        return _mm256_add_pd(a, b);
+    case RalKernelOp::SUB:
+        return _mm256_sub_pd(a, b);
+    case RalKernelOp::MUL:
+        return _mm256_mul_pd(a, b);
+    default:
+        return _mm256_div_pd(a, b);
+    }
+}
+
+RAL_AVX2 static void avx2F64Binary(RalKernelOp op, double *a, const double *b,
+                                   size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        auto va = _mm256_loadu_pd(a + i);
+        auto vb = _mm256_loadu_pd(b + i);
+        _mm256_storeu_pd(a + i, avx2Op(op, va, vb));
+    }
+    scalarBinary(op, a + i, b + i, n - i);
+}
+
+RAL_AVX2 static void avx2F64Scalar(RalKernelOp op, double *a, double b,
+                                   size_t n, bool left)
+{
+    auto vb = _mm256_set1_pd(b);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        auto va = _mm256_loadu_pd(a + i);
+        _mm256_storeu_pd(a + i, left ? avx2Op(op, vb, va) : avx2Op(op, va, vb));
+    }
+    if (left) {
+        scalarScalarLeft(op, a + i, b, n - i);
+    }
+    else {
+        scalarScalar(op, a + i, b, n - i);
+    }
+}
+
+// r = x + y or r = x - y, wrapping, with the sign bit of each lane of
+// *overflow set if that lane overflowed
+RAL_AVX2 static __m256i avx2AddSub(bool add, __m256i x, __m256i y,
+                                   __m256i *overflow)
+{
+    if (add) {
+        auto r = _mm256_add_epi64(x, y);
+        *overflow = _mm256_or_si256(
+            *overflow, _mm256_and_si256(_mm256_xor_si256(x, r),
+                                        _mm256_xor_si256(y, r)));
+        return r;
+    }
+    auto r = _mm256_sub_epi64(x, y);
+    *overflow = _mm256_or_si256(*overflow,
+                                _mm256_and_si256(_mm256_xor_si256(x, y),
+                                                 _mm256_xor_si256(x, r)));
+    return r;
+}
+
+RAL_AVX2 static bool avx2NoOverflow(__m256i overflow)
+{
+    return _mm256_movemask_pd(_mm256_castsi256_pd(overflow)) == 0;
+}
+
+RAL_AVX2 static bool avx2I64Binary(RalKernelOp op, int64_t *a,
+                                   const int64_t *b, size_t n)
+{
+    auto overflow = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        auto va = _mm256_loadu_si256((const __m256i *)(a + i));
+        auto vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        auto vr = avx2AddSub(op == RalKernelOp::ADD, va, vb, &overflow);
+        _mm256_storeu_si256((__m256i *)(a + i), vr);
+    }
+    bool ok = checkedBinary(op, a + i, b + i, n - i);
+    return ok && avx2NoOverflow(overflow);
+}
+
+RAL_AVX2 static bool avx2I64Scalar(RalKernelOp op, int64_t *a, int64_t b,
+                                   size_t n, bool left)
+{
+    auto vb = _mm256_set1_epi64x(b);
+    auto overflow = _mm256_setzero_si256();
+    bool add = (op == RalKernelOp::ADD);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        auto va = _mm256_loadu_si256((const __m256i *)(a + i));
+        auto vr = left ? avx2AddSub(add, vb, va, &overflow)
+                       : avx2AddSub(add, va, vb, &overflow);
+        _mm256_storeu_si256((__m256i *)(a + i), vr);
+    }
+    bool ok = left ? checkedScalarLeft(op, a + i, b, n - i)
+                   : checkedScalar(op, a + i, b, n - i);
+    return ok && avx2NoOverflow(overflow);
+}
+
+RAL_AVX2 static void avx2F64Sqrt(double *a, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(a + i, _mm256_sqrt_pd(_mm256_loadu_pd(a + i)));
+    }
+    for (; i < n; i++) {
+        a[i] = std::sqrt(a[i]);
+    }
+}
+
+RAL_AVX2 static void avx2F64Abs(double *a, size_t n)
+{
+    // clear the sign bits
+    auto mask = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(a + i, _mm256_and_pd(_mm256_loadu_pd(a + i), mask));
+    }
+    for (; i < n; i++) {
+        a[i] = std::fabs(a[i]);
+    }
+}
+
+RAL_AVX2 static double avx2Hsum(__m256d v)
+{
+    double lanes[4];
+    _mm256_storeu_pd(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+RAL_AVX2 static double avx2F64Sum(const double *a, size_t n)
+{
+    auto acc = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm256_add_pd(acc, _mm256_loadu_pd(a + i));
+    }
+    return avx2Hsum(acc) + scalarSum(a + i, n - i);
+}
+
+RAL_AVX2 static bool avx2I64Sum(const int64_t *a, size_t n, int64_t *sum)
+{
+    auto acc = _mm256_setzero_si256();
+    auto overflow = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc = avx2AddSub(true, acc,
+                         _mm256_loadu_si256((const __m256i *)(a + i)),
+                         &overflow);
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    *sum = 0;
+    bool ok = checkedSum(lanes, 4, sum) && checkedSum(a + i, n - i, sum);
+    return ok && avx2NoOverflow(overflow);
+}
+
+RAL_AVX2 static double avx2F64Dot(const double *a, const double *b, size_t n)
+{
+    auto acc = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm256_add_pd(
+            acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    return avx2Hsum(acc) + scalarDot(a + i, b + i, n - i);
+}
+
+RAL_AVX2 static void avx2F64Axpy(double *y, double a, const double *x,
+                                 size_t n)
+{
+    auto va = _mm256_set1_pd(a);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        auto vy = _mm256_loadu_pd(y + i);
+        auto vx = _mm256_loadu_pd(x + i);
+        _mm256_storeu_pd(y + i, _mm256_add_pd(vy, _mm256_mul_pd(va, vx)));
+    }
+    scalarAxpy(y + i, a, x + i, n - i);
+}
+
+RAL_AVX2 static double avx2F64MinMax(const double *a, size_t n, bool isMax)
+{
+    double result = a[0];
+    size_t i = 0;
+    if (n >= 4) {
+        auto acc = _mm256_loadu_pd(a);
+        for (i = 4; i + 4 <= n; i += 4) {
+            auto v = _mm256_loadu_pd(a + i);
+            acc = isMax ? _mm256_max_pd(acc, v) : _mm256_min_pd(acc, v);
+        }
+        double lanes[4];
+        _mm256_storeu_pd(lanes, acc);
+        result = lanes[0];
+        for (int j = 1; j < 4; j++) {
+            result = isMax ? std::max(result, lanes[j])
+                           : std::min(result, lanes[j]);
+        }
+    }
+    for (; i < n; i++) {
+        result = isMax ? std::max(result, a[i]) : std::min(result, a[i]);
+    }
+    return result;
+}
+
+RAL_AVX2 static int64_t avx2I64MinMax(const int64_t *a, size_t n, bool isMax)
+{
+    int64_t result = a[0];
+    size_t i = 0;
+    if (n >= 4) {
+        auto acc = _mm256_loadu_si256((const __m256i *)a);
+        for (i = 4; i + 4 <= n; i += 4) {
+            auto v = _mm256_loadu_si256((const __m256i *)(a + i));
+            // there is no 64 bit min/max in AVX2, so compare & blend
+            auto gt = _mm256_cmpgt_epi64(v, acc);
+            acc = isMax ? _mm256_blendv_epi8(acc, v, gt)
+                        : _mm256_blendv_epi8(v, acc, gt);
+        }
+        int64_t lanes[4];
+        _mm256_storeu_si256((__m256i *)lanes, acc);
+        result = lanes[0];
+        for (int j = 1; j < 4; j++) {
+            result = isMax ? std::max(result, lanes[j])
+                           : std::min(result, lanes[j]);
+        }
+    }
+    for (; i < n; i++) {
+        result = isMax ? std::max(result, a[i]) : std::min(result, a[i]);
+    }
+    return result;
+}
+#endif
+
+// ================================================================================
+// Dispatch
+// ================================================================================
+bool ralKernelsAvx2()
+{
+#ifdef RAL_HAVE_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+void f64Binary(RalKernelOp op, double *a, const double *b, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2F64Binary(op, a, b, n);
+    }
+#endif
+    scalarBinary(op, a, b, n);
+}
+
+bool i64Binary(RalKernelOp op, int64_t *a, const int64_t *b, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2() &&
+        ((op == RalKernelOp::ADD) || (op == RalKernelOp::SUB))) {
+        return avx2I64Binary(op, a, b, n);
+    }
+#endif
+    return checkedBinary(op, a, b, n);
+}
+
+void f64Scalar(RalKernelOp op, double *a, double b, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2F64Scalar(op, a, b, n, false);
+    }
+#endif
+    scalarScalar(op, a, b, n);
+}
+
+bool i64Scalar(RalKernelOp op, int64_t *a, int64_t b, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2() &&
+        ((op == RalKernelOp::ADD) || (op == RalKernelOp::SUB))) {
+        return avx2I64Scalar(op, a, b, n, false);
+    }
+#endif
+    return checkedScalar(op, a, b, n);
+}
+
+void f64ScalarLeft(RalKernelOp op, double *a, double b, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2F64Scalar(op, a, b, n, true);
+    }
+#endif
+    scalarScalarLeft(op, a, b, n);
+}
+
+bool i64ScalarLeft(RalKernelOp op, int64_t *a, int64_t b, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2() &&
+        ((op == RalKernelOp::ADD) || (op == RalKernelOp::SUB))) {
+        return avx2I64Scalar(op, a, b, n, true);
+    }
+#endif
+    return checkedScalarLeft(op, a, b, n);
+}
+
+void f64Sqrt(double *a, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2F64Sqrt(a, n);
+    }
+#endif
+    for (size_t i = 0; i < n; i++) {
+        a[i] = std::sqrt(a[i]);
+    }
+}
+
+// AVX2 has no sin or cos, so these are always scalar
+void f64Sin(double *a, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        a[i] = std::sin(a[i]);
+    }
+}
+
+void f64Cos(double *a, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        a[i] = std::cos(a[i]);
+    }
+}
+
+void f64Abs(double *a, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2F64Abs(a, n);
+    }
+#endif
+    for (size_t i = 0; i < n; i++) {
+        a[i] = std::fabs(a[i]);
+    }
+}
+
+bool i64Abs(int64_t *a, size_t n)
+{
+    bool ok = true;
+    for (size_t i = 0; i < n; i++) {
+        ok &= (a[i] != INT64_MIN);
+        a[i] = (a[i] < 0) ? (int64_t)(0 - (uint64_t)a[i]) : a[i];
+    }
+    return ok;
+}
+
+double f64Sum(const double *a, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2F64Sum(a, n);
+    }
+#endif
+    return scalarSum(a, n);
+}
+
+bool i64Sum(const int64_t *a, size_t n, int64_t *sum)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2I64Sum(a, n, sum);
+    }
+#endif
+    *sum = 0;
+    return checkedSum(a, n, sum);
+}
+
+double f64Dot(const double *a, const double *b, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2F64Dot(a, b, n);
+    }
+#endif
+    return scalarDot(a, b, n);
+}
+
+bool i64Dot(const int64_t *a, const int64_t *b, size_t n, int64_t *dot)
+{
+    bool ok = true;
+    *dot = 0;
+    for (size_t i = 0; i < n; i++) {
+        int64_t product;
+        ok &= !ralMulOverflow(a[i], b[i], &product);
+        ok &= !ralAddOverflow(*dot, product, dot);
+    }
+    return ok;
+}
+
+double f64Min(const double *a, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2F64MinMax(a, n, false);
+    }
+#endif
+    return *std::min_element(a, a + n);
+}
+
+double f64Max(const double *a, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2F64MinMax(a, n, true);
+    }
+#endif
+    return *std::max_element(a, a + n);
+}
+
+int64_t i64Min(const int64_t *a, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2I64MinMax(a, n, false);
+    }
+#endif
+    return *std::min_element(a, a + n);
+}
+
+int64_t i64Max(const int64_t *a, size_t n)
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2I64MinMax(a, n, true);
+    }
+#endif
+    return *std::max_element(a, a + n);
+}
+
+// ================================================================================
+// Linear algebra
+// ================================================================================
+typedef void (*RalAxpy)(double *, double, const double *, size_t);
+
+static RalAxpy axpyKernel()
+{
+#ifdef RAL_HAVE_AVX2
+    if (ralKernelsAvx2()) {
+        return avx2F64Axpy;
+    }
+#endif
+    return scalarAxpy;
+}
+
+void f64Axpy(double *y, double a, const double *x, size_t n)
+{
+    axpyKernel()(y, a, x, n);
+}
+
+// a block of b is RAL_MATMUL_BLOCK^2 doubles, 32KB, so it stays in cache
+// while every row of a passes over it
+const size_t RAL_MATMUL_BLOCK = 64;
+
+void f64Matmul(const double *a, const double *b, double *c, size_t n,
+               size_t m, size_t p)
+{
+    auto axpy = axpyKernel();
+    std::fill(c, c + n * p, 0.0);
+    for (size_t kk = 0; kk < m; kk += RAL_MATMUL_BLOCK) {
+        size_t kend = std::min(kk + RAL_MATMUL_BLOCK, m);
+        for (size_t jj = 0; jj < p; jj += RAL_MATMUL_BLOCK) {
+            size_t width = std::min(jj + RAL_MATMUL_BLOCK, p) - jj;
+            for (size_t i = 0; i < n; i++) {
+                for (size_t k = kk; k < kend; k++) {
+                    axpy(c + i * p + jj, a[i * m + k], b + k * p + jj, width);
+                }
+            }
+        }
+    }
+}
+
+// LU decomposition with scaled partial pivoting, applied to b as it goes,
+// then back substitution.  Each pivot is picked & checked relative to the
+// largest item of its row of a, so rows of very different sizes are fine,
+// but a pivot within rounding error of 0 for its row means a is singular.
+bool f64Solve(double *a, double *b, size_t n, size_t k)
+{
+    auto axpy = axpyKernel();
+    std::vector<double> scale(n);
+    for (size_t r = 0; r < n; r++) {
+        for (size_t j = 0; j < n; j++) {
+            scale[r] = std::max(scale[r], std::fabs(a[r * n + j]));
+        }
+    }
+    double eps = n * std::numeric_limits<double>::epsilon();
+    for (size_t c = 0; c < n; c++) {
+        size_t pivot = c;
+        double best = 0.0;
+        for (size_t r = c; r < n; r++) {
+            double size = (scale[r] > 0.0) ? std::fabs(a[r * n + c]) / scale[r]
+                                           : 0.0;
+            if (size > best) {
+                best = size;
+                pivot = r;
+            }
+        }
+        if (best <= eps) {
+            return false;
+        }
+        if (pivot != c) {
+            std::swap_ranges(a + c * n, a + c * n + n, a + pivot * n);
+            std::swap_ranges(b + c * k, b + c * k + k, b + pivot * k);
+            std::swap(scale[c], scale[pivot]);
+        }
+        for (size_t r = c + 1; r < n; r++) {
+            double f = -a[r * n + c] / a[c * n + c];
+            axpy(a + r * n + c, f, a + c * n + c, n - c);
+            axpy(b + r * k, f, b + c * k, k);
+        }
+    }
+    for (size_t c = n; c-- > 0;) {
+        double d = a[c * n + c];
+        for (size_t j = 0; j < k; j++) {
+            b[c * k + j] /= d;
+        }
+        for (size_t r = 0; r < c; r++) {
+            axpy(b + r * k, -a[r * n + c], b + c * k, k);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+// ======================================================================
+// ral - Roger Allen's Lisp via https://github.com/kanaka/mal
+// Copyright(C) 2020 Roger Allen
+//
+// kernels.h - numeric kernels over contiguous arrays
+//
+// ======================================================================
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Each kernel has an AVX2 version, used when the cpu supports it, and a
+// scalar version for everything else.  The element-wise kernels update a in
+// place.
+enum class RalKernelOp { ADD, SUB, MUL, DIV };
+
+// true if the AVX2 kernels are in use
+bool ralKernelsAvx2();
+
+// The i64 kernels that can overflow return false if any result did not fit
+// in an int64_t, counting INT64_MIN / -1, and the items of a are then
+// unspecified.  Divisors must not be 0.
+
+// a[i] = a[i] op b[i]
+void f64Binary(RalKernelOp op, double *a, const double *b, size_t n);
+bool i64Binary(RalKernelOp op, int64_t *a, const int64_t *b, size_t n);
+// a[i] = a[i] op b
+void f64Scalar(RalKernelOp op, double *a, double b, size_t n);
+bool i64Scalar(RalKernelOp op, int64_t *a, int64_t b, size_t n);
+// a[i] = b op a[i], for a scalar on the left
+void f64ScalarLeft(RalKernelOp op, double *a, double b, size_t n);
+bool i64ScalarLeft(RalKernelOp op, int64_t *a, int64_t b, size_t n);
+
+void f64Sqrt(double *a, size_t n);
+void f64Sin(double *a, size_t n);
+void f64Cos(double *a, size_t n);
+void f64Abs(double *a, size_t n);
+bool i64Abs(int64_t *a, size_t n);
+
+double f64Sum(const double *a, size_t n);
+// false if a partial sum overflowed, even if the total would fit
+bool i64Sum(const int64_t *a, size_t n, int64_t *sum);
+double f64Dot(const double *a, const double *b, size_t n);
+bool i64Dot(const int64_t *a, const int64_t *b, size_t n, int64_t *dot);
+// n must be at least 1
+double f64Min(const double *a, size_t n);
+double f64Max(const double *a, size_t n);
+int64_t i64Min(const int64_t *a, size_t n);
+int64_t i64Max(const int64_t *a, size_t n);
+
+// y[i] += a * x[i]
+void f64Axpy(double *y, double a, const double *x, size_t n);
+// c = a b, for row-major a (n x m), b (m x p) & c (n x p)
+void f64Matmul(const double *a, const double *b, double *c, size_t n,
+               size_t m, size_t p);
+// Solves a x = b for row-major a (n x n) & b (n x k).  b is replaced by x &
+// a is overwritten.  Returns false if a is singular to within rounding error,
+// relative to the size of each row.
+bool f64Solve(double *a, double *b, size_t n, size_t k);
@@ -0,0 +1,120 @@
+// ======================================================================
+// ral - Roger Allen's Lisp via https://github.com/kanaka/mal
+// Copyright(C) 2020 Roger Allen
+//
+// native.h - bind plain C++ functions as core builtins
+//
+// ======================================================================
+// This program is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+// ======================================================================
+#pragma once
+
+#include "core.h"
+#include "types.h"
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// defnative(name, f) returns a RalCore::ns entry that calls f, a lambda or
+// function pointer taking & returning the types below.  The arity check,
+// unboxing of the arguments & boxing of the result are generated for f's
+// signature at compile time.
+//
+//   defnative("sqrt", [](double x) { return std::sqrt(x); }),
+//
+//   int64_t     - an integer (or a double, truncated)
+//   double      - a double or integer
+//   bool        - nil & false are false, anything else is true
+//   std::string - a string's contents
+//   RalTypePtr  - any value, as-is
+
+// ================================================================================
+template <typename T> struct RalUnbox;
+template <> struct RalUnbox<int64_t> {
+    static int64_t get(const char *name, const RalTypePtr &a)
+    {
+        return a->asInt();
+    }
+};
+template <> struct RalUnbox<double> {
+    static double get(const char *name, const RalTypePtr &a)
+    {
+        return a->asDouble();
+    }
+};
+template <> struct RalUnbox<bool> {
+    static bool get(const char *name, const RalTypePtr &a)
+    {
+        return !a->isNilOrFalse();
+    }
+};
+template <> struct RalUnbox<std::string> {
+    static std::string get(const char *name, const RalTypePtr &a)
+    {
+        if (a->kind() != RalKind::STRING) {
+            throw RalException(std::string("'") + name +
+                               "' requires a string.");
+        }
+        return a->str(false);
+    }
+};
+template <> struct RalUnbox<RalTypePtr> {
+    static RalTypePtr get(const char *name, const RalTypePtr &a) { return a; }
+};
+
+inline RalTypePtr ralBox(int64_t v) { return std::make_shared<RalInteger>(v); }
+inline RalTypePtr ralBox(double v) { return std::make_shared<RalDouble>(v); }
+inline RalTypePtr ralBox(bool v)
+{
+    return std::make_shared<RalConstant>(v ? "true" : "false");
+}
+inline RalTypePtr ralBox(const std::string &v)
+{
+    return std::make_shared<RalString>(v);
+}
+inline RalTypePtr ralBox(RalTypePtr v) { return v; }
+
+// ================================================================================
+template <typename... Args> struct RalNativeArgs {
+    static const size_t arity = sizeof...(Args);
+
+    template <typename F, size_t... I>
+    static RalTypePtr call(const char *name, const F &f, RalTypeIter begin,
+                           std::index_sequence<I...>)
+    {
+        return ralBox(f(RalUnbox<typename std::decay<Args>::type>::get(
+            name, begin[I])...));
+    }
+};
+
+// the argument types of a lambda or function pointer
+template <typename F>
+struct RalNativeTraits : RalNativeTraits<decltype(&F::operator())> {};
+template <typename C, typename R, typename... Args>
+struct RalNativeTraits<R (C::*)(Args...) const> : RalNativeArgs<Args...> {};
+template <typename R, typename... Args>
+struct RalNativeTraits<R (*)(Args...)> : RalNativeArgs<Args...> {};
+
+template <typename F>
+std::pair<const std::string, RalFunctionSignature> defnative(const char *name,
+                                                             F f)
+{
+    typedef RalNativeTraits<F> Traits;
+    return {name, [name, f](RalTypeIter begin, RalTypeIter end) {
+                checkArgsEqual(name, Traits::arity, end - begin);
+                return Traits::call(name, f, begin,
+                                    std::make_index_sequence<Traits::arity>());
+            }};
+}
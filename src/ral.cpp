@@ -27,6 +27,7 @@
 #include "version.h"
 #include <iostream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 INITIALIZE_EASYLOGGINGPP
@@ -38,12 +39,18 @@ bool gDebug2 = false;
 RalTypePtr READ(std::string s);
 RalTypePtr EVAL(RalTypePtr mp, RalEnvPtr env);
 std::string PRINT(RalTypePtr mp);
-RalTypePtr apply(RalTypePtr mp);
 std::string rep(std::string s, RalEnvPtr env);
 RalTypePtr ral_eval(RalTypeIter begin, RalTypeIter end);
 void setup_repl_env(std::vector<std::string> args);
 bool is_pair(RalTypePtr lp);
-RalTypePtr quasiquote(RalTypePtr mp);
+RalTypePtr quasiquote(std::shared_ptr<RalList> lp, RalEnvPtr env);
+RalTypePtr thread_forms(std::shared_ptr<RalList> lp, bool last);
+bool is_native_form(RalTypePtr mp, RalEnvPtr env);
+int primitive_of(RalTypePtr head, RalEnvPtr env);
+RalTypePtr recur(std::shared_ptr<RalList> lp, RalEnvPtr env);
+RalTypePtr eval_inner(RalTypePtr mp, RalEnvPtr env);
+RalAritiesPtr fnArities(std::shared_ptr<RalList> lp);
+RalTypePtr run_primitive(int prim, std::shared_ptr<RalList> lp, RalEnvPtr env);
 RalTypePtr macroexpand(RalTypePtr ast, RalEnvPtr env);
 void completion(const char *editBuffer, std::vector<std::string> &completions);
 
@@ -53,6 +60,183 @@ void completion(const char *editBuffer, std::vector<std::string> &completions);
 // environments
 static RalEnvPtr repl_env = std::make_shared<RalEnv>();
 
+// stdlib macros that EVAL runs as special forms, by name.  The macros stay
+// defined for macroexpand & macro?, but are skipped until they are redefined.
+static std::unordered_map<std::string, RalTypePtr> native_forms = {
+    {"cond", nullptr}, {"and", nullptr}, {"or", nullptr},
+    {"when", nullptr}, {"->", nullptr},  {"->>", nullptr}};
+
+// (recur ...) stores the new loop values here & returns recur_marker, which
+// passes straight up to the loop since recur is always in tail position.
+static std::vector<RalTypePtr> recur_values;
+static RalTypePtr recur_marker = std::make_shared<RalConstant>("nil");
+
+// A (throw value) that EVAL runs itself stores the value here & returns
+// throw_marker, which every eval_inner caller passes straight up to the
+// nearest try*, so ral code that throws & catches never unwinds the C++
+// stack.  EVAL turns a marker that gets past all of them into a
+// RalException carrying the value, for native callers & the repl.
+static RalTypePtr thrown_value;
+static RalTypePtr throw_marker = std::make_shared<RalConstant>("nil");
+
+static RalTypePtr take_thrown()
+{
+    auto value = thrown_value;
+    thrown_value = nullptr;
+    return value;
+}
+
+// Core builtins that EVAL runs inline.  A call through one of these names
+// evaluates its operands onto the stack & calls the builtin directly, with
+// integer fast paths for arithmetic & comparisons.  This only happens while
+// the name still refers to the builtin, so redefining or shadowing the name
+// restores the generic path.
+enum RalPrim {
+    PRIM_NONE,
+    PRIM_ADD,
+    PRIM_SUB,
+    PRIM_MUL,
+    PRIM_DIV,
+    PRIM_LT,
+    PRIM_LE,
+    PRIM_GT,
+    PRIM_GE,
+    PRIM_EQ,
+    PRIM_FIRST,
+    PRIM_REST,
+    PRIM_NTH,
+    PRIM_COUNT,
+    PRIM_EMPTY_Q,
+    PRIM_NIL_Q,
+    PRIM_THROW,
+    NUM_PRIMS
+};
+struct RalPrimitive {
+    const char *name_;
+    RalTypePtr (*fn_)(RalTypeIter, RalTypeIter);
+    RalTypePtr builtin_; // what name_ refers to in repl_env
+};
+static RalPrimitive primitives[NUM_PRIMS] = {
+    {"", nullptr, nullptr},          {"+", ral_add, nullptr},
+    {"-", ral_sub, nullptr},         {"*", ral_mul, nullptr},
+    {"/", ral_div, nullptr},         {"<", ral_lt, nullptr},
+    {"<=", ral_le, nullptr},         {">", ral_gt, nullptr},
+    {">=", ral_ge, nullptr},         {"=", ral_equal, nullptr},
+    {"first", ral_first, nullptr},   {"rest", ral_rest, nullptr},
+    {"nth", ral_nth, nullptr},       {"count", ral_count, nullptr},
+    {"empty?", ral_empty_q, nullptr}, {"nil?", ral_nil_q, nullptr},
+    {"throw", ral_throw, nullptr}};
+
+// A loop form checked the first time it is evaluated.  Every recur in its
+// body is in tail position & marked with a RalRecurSite.
+class RalLoopPlan : public RalCompiled {
+  public:
+    std::vector<std::string> names_;
+    std::vector<RalTypePtr> inits_;
+    RalTypePtr body_;
+    // the body may make closures over the loop syms, so every iteration
+    // gets a new env instead of rebinding the old one
+    bool freshFrames_;
+
+    RalLoopPlan() : freshFrames_(false) {}
+    // Marks the recurs in form, expanding macro calls first so a recur a
+    // macro puts in tail position counts.  Returns the form to evaluate in
+    // place of form, which is its expansion if it was a macro call.
+    RalTypePtr mark(RalTypePtr form, bool tail, RalEnvPtr env);
+};
+
+class RalRecurSite : public RalCompiled {
+  public:
+    size_t arity_; // the number of loop syms
+    RalRecurSite(size_t arity) : arity_(arity) {}
+};
+
+std::shared_ptr<RalLoopPlan> loop_plan(std::shared_ptr<RalList> lp,
+                                       RalEnvPtr env);
+
+// A call (f a ...).  A call to a small global lambda is replaced by its body
+// (see plan_inline).  A call to a protocol method or multimethod keeps the
+// methods f picked for the last few dispatch keys or values, so dispatching
+// again costs a compare.  The cache is emptied when f changes or gets a new
+// method.
+class RalCallSite : public RalCompiled {
+    struct Dispatch {
+        uint64_t key_;      // for a protocol method
+        RalTypePtr value_;  // for a multimethod
+        RalTypePtr method_;
+    };
+    static const size_t MAX_DISPATCH = 4;
+    bool dispatches_; // false for the shared plain_call
+    RalTypePtr multi_;
+    uint64_t version_;
+    std::vector<Dispatch> dispatch_;
+
+  public:
+    RalTypePtr expansion_; // nullptr for a normal call
+    std::vector<std::pair<std::string, RalTypePtr>> guards_;
+    std::vector<std::string> globals_; // the free symbols of the expansion
+
+    RalCallSite(bool dispatches) : dispatches_(dispatches), version_(0) {}
+    // true if the expansion still means the call in env: the inlined globals
+    // are unchanged & no local binding hides a global the body refers to
+    bool holds(RalEnvPtr env)
+    {
+        for (auto &guard : guards_) {
+            if (env->get(guard.first) != guard.second) {
+                return false;
+            }
+        }
+        for (auto &name : globals_) {
+            auto where = env->find(name);
+            if ((where != nullptr) && (where != repl_env)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    // the method of mf for the arguments [begin, end)
+    RalTypePtr method(RalMultiFn *mf, RalTypeIter begin, RalTypeIter end)
+    {
+        if (!dispatches_) {
+            return mf->method(begin, end);
+        }
+        if ((multi_.get() != mf) || (version_ != mf->version())) {
+            multi_ = mf->shared_from_this();
+            version_ = mf->version();
+            dispatch_.clear();
+        }
+        RalTypePtr value;
+        auto key = mf->dispatchKey(begin, end);
+        if (mf->isProtocol()) {
+            for (auto &d : dispatch_) {
+                if (d.key_ == key) {
+                    return d.method_;
+                }
+            }
+        }
+        else {
+            value = mf->dispatchValue(begin, end);
+            RalTypeEqual eq;
+            for (auto &d : dispatch_) {
+                if (eq(d.value_, value)) {
+                    return d.method_;
+                }
+            }
+        }
+        auto method = mf->isProtocol() ? mf->methodForType(key, *begin)
+                                       : mf->methodForValue(value);
+        if (dispatch_.size() < MAX_DISPATCH) {
+            dispatch_.push_back({key, value, method});
+        }
+        return method;
+    }
+};
+static auto plain_call = std::make_shared<RalCallSite>(false);
+std::shared_ptr<RalCallSite> plan_inline(std::shared_ptr<RalList> lp,
+                                         RalEnvPtr env);
+std::shared_ptr<RalCallSite> plan_call(std::shared_ptr<RalList> lp,
+                                       RalEnvPtr env);
+
 // ================================================================================
 // REPL
 // ================================================================================
@@ -65,7 +249,8 @@ RalTypePtr READ(std::string s)
 // ================================================================================
 // EVAL
 //   note that mp->eval() is equivalent to eval_ast() in instructions
-RalTypePtr EVAL(RalTypePtr mp, RalEnvPtr env)
+// EVAL, except that a ral throw returns throw_marker instead of unwinding
+RalTypePtr eval_inner(RalTypePtr mp, RalEnvPtr env)
 {
     INFO << "EVAL " << mp->str(true);
     while (true) {
@@ -85,11 +270,15 @@ RalTypePtr EVAL(RalTypePtr mp, RalEnvPtr env)
             return mp;
         }
 
-        mp = macroexpand(mp, env);
-        // if not list, return eval_ast(ast, env)
-        if (!(mp->isList())) {
-            DBG << "(post macroexpand) not list, eval_ast... " << mp->str(true);
-            return mp->eval(env);
+        bool native = is_native_form(mp, env);
+        if (!native) {
+            mp = macroexpand(mp, env);
+            // if not list, return eval_ast(ast, env)
+            if (!(mp->isList())) {
+                DBG << "(post macroexpand) not list, eval_ast... "
+                    << mp->str(true);
+                return mp->eval(env);
+            }
         }
 
         // since we know at this point 'mp' is a RalList,
@@ -104,7 +293,10 @@ RalTypePtr EVAL(RalTypePtr mp, RalEnvPtr env)
             DBG << "def! " << lp->str(true);
             auto symbol = lp->get(1)->str(true);
             auto value = lp->get(2);
-            auto e = EVAL(value, env);
+            auto e = eval_inner(value, env);
+            if (e == throw_marker) {
+                return e;
+            }
             env->set(symbol, e); // update env
             return e;
         }
@@ -113,7 +305,10 @@ RalTypePtr EVAL(RalTypePtr mp, RalEnvPtr env)
             DBG << "defmacro! " << lp->str(true);
             auto symbol = lp->get(1)->str(true);
             auto value = lp->get(2);
-            auto e = EVAL(value, env);
+            auto e = eval_inner(value, env);
+            if (e == throw_marker) {
+                return e;
+            }
             auto lambdap = std::static_pointer_cast<RalLambda>(e);
             auto copyLambdap =
                 std::make_shared<RalLambda>(new RalLambda(lambdap));
@@ -135,7 +330,21 @@ RalTypePtr EVAL(RalTypePtr mp, RalEnvPtr env)
             std::vector<RalTypePtr> exprs;
             // letEnv is temporary
             RalEnvPtr let_env = std::make_shared<RalEnv>(env, binds, exprs);
-            letEnvList->setEnv(let_env);
+            if (!(letEnvList->isList() || letEnvList->isVector())) {
+                throw RalBadSetEnv();
+            }
+            // like RalList::setEnv, but passing a throw on
+            auto pairs = std::static_pointer_cast<RalList>(letEnvList);
+            if (pairs->size() % 2 != 0) {
+                throw RalBadSetEnvList();
+            }
+            for (size_t i = 0; i < pairs->size(); i += 2) {
+                auto e = eval_inner(pairs->get(i + 1), let_env);
+                if (e == throw_marker) {
+                    return e;
+                }
+                let_env->set(pairs->get(i)->str(true), e);
+            }
             // return EVAL(form, let_env);
             // set ast to the last element and loop for tco
             mp = form;
@@ -149,9 +358,10 @@ RalTypePtr EVAL(RalTypePtr mp, RalEnvPtr env)
             // eval_ast would do which is EVAL each item. (but the last)
             size_t size = lp->size();
             size_t index = 1; // skip the "do"
-            RalTypePtr p0, p1;
             for (; index < size - 1; index++) {
-                p1 = EVAL(lp->get(index), env);
+                if (eval_inner(lp->get(index), env) == throw_marker) {
+                    return throw_marker;
+                }
             }
             // set ast to the last element and loop for tco
             mp = lp->get(index);
@@ -162,7 +372,10 @@ RalTypePtr EVAL(RalTypePtr mp, RalEnvPtr env)
             auto condition = lp->get(1);
             auto true_form = lp->get(2);
             auto false_form = lp->get(3);
-            auto emp = EVAL(condition, env);
+            auto emp = eval_inner(condition, env);
+            if (emp == throw_marker) {
+                return emp;
+            }
             if (!(emp->isNilOrFalse())) {
                 mp = true_form; // TCO
             }
@@ -170,20 +383,114 @@ RalTypePtr EVAL(RalTypePtr mp, RalEnvPtr env)
                 mp = false_form; // TCO
             }
         }
+        // (cond test1 form1 ...) - EVAL the form after the first true test
+        else if (native && (first == "cond")) {
+            DBG << "cond " << lp->str(true);
+            size_t size = lp->size();
+            if ((size % 2) == 0) {
+                throw RalException("odd number of forms to cond");
+            }
+            size_t index = 1; // skip the "cond"
+            for (; index < size; index += 2) {
+                auto emp = eval_inner(lp->get(index), env);
+                if (emp == throw_marker) {
+                    return emp;
+                }
+                if (!(emp->isNilOrFalse())) {
+                    break;
+                }
+            }
+            if (index >= size) {
+                return std::make_shared<RalConstant>("nil");
+            }
+            mp = lp->get(index + 1); // TCO
+        }
+        // (and ...) - returns the first nil/false value or the last value
+        // (or ...) - returns the first true value or the last value
+        else if (native && ((first == "and") || (first == "or"))) {
+            DBG << first << " " << lp->str(true);
+            bool isAnd = (first == "and");
+            size_t size = lp->size();
+            if (size == 1) {
+                return std::make_shared<RalConstant>(isAnd ? "true" : "nil");
+            }
+            for (size_t index = 1; index < size - 1; index++) {
+                auto emp = eval_inner(lp->get(index), env);
+                if ((emp == throw_marker) || (emp->isNilOrFalse() == isAnd)) {
+                    return emp;
+                }
+            }
+            mp = lp->get(size - 1); // TCO
+        }
+        // (when test ...) - like (if test (do ...))
+        else if (native && (first == "when")) {
+            DBG << "when " << lp->str(true);
+            size_t size = lp->size();
+            if (size < 2) {
+                return std::make_shared<RalConstant>("nil");
+            }
+            // the test runs even without a body, for its side effects
+            auto emp = eval_inner(lp->get(1), env);
+            if ((emp == throw_marker) || emp->isNilOrFalse() || (size < 3)) {
+                return (emp == throw_marker) ? emp
+                                             : std::make_shared<RalConstant>("nil");
+            }
+            size_t index = 2; // skip the "when" & test
+            for (; index < size - 1; index++) {
+                if (eval_inner(lp->get(index), env) == throw_marker) {
+                    return throw_marker;
+                }
+            }
+            mp = lp->get(index); // TCO
+        }
+        // (-> x forms...) & (->> x forms...)
+        else if (native && ((first == "->") || (first == "->>"))) {
+            DBG << first << " " << lp->str(true);
+            mp = thread_forms(lp, first == "->>"); // TCO
+        }
+        // (loop [sym1 val1 ...] body ...) - bind the syms like let* & EVAL the
+        // body until it returns something other than a recur
+        else if (first == "loop") {
+            DBG << "loop " << lp->str(true);
+            auto plan = loop_plan(lp, env);
+            std::vector<RalTypePtr> binds;
+            std::vector<RalTypePtr> exprs;
+            RalEnvPtr loop_env = std::make_shared<RalEnv>(env, binds, exprs);
+            for (size_t i = 0; i < plan->names_.size(); i++) {
+                auto e = eval_inner(plan->inits_[i], loop_env);
+                if (e == throw_marker) {
+                    return e;
+                }
+                loop_env->set(plan->names_[i], e);
+            }
+            while (true) {
+                auto result = eval_inner(plan->body_, loop_env);
+                if (result != recur_marker) {
+                    return result;
+                }
+                if (plan->freshFrames_) {
+                    loop_env = std::make_shared<RalEnv>(env, binds, exprs);
+                }
+                // rebind the loop's slots in place
+                for (size_t i = 0; i < plan->names_.size(); i++) {
+                    loop_env->set(plan->names_[i], recur_values[i]);
+                }
+            }
+        }
+        // (recur val1 ...) - start the enclosing loop again with new values
+        else if (first == "recur") {
+            DBG << "recur " << lp->str(true);
+            return recur(lp, env);
+        }
         // (fn* ...)
         else if (first == "fn*") {
             DBG << "fn* " << lp->str(true);
-            auto bindings = lp->get(1);
-            if (!(bindings->isList() || bindings->isVector())) {
-                throw RalBadFnParam1();
-            }
-            auto bindingList = std::static_pointer_cast<RalList>(bindings);
-            auto form = lp->get(2);
-            std::vector<RalTypePtr> bindStrs;
-            for (size_t i = 0; i < bindingList->size(); i++) {
-                bindStrs.push_back(bindingList->get(i));
+            auto arities = std::static_pointer_cast<RalArities>(lp->compiled());
+            if (arities == nullptr) {
+                arities = fnArities(lp);
+                lp->setCompiled(arities);
             }
-            return std::make_shared<RalLambda>(bindStrs, form, env);
+            return std::make_shared<RalLambda>(arities, env);
         }
         // (quote ...)
         else if (first == "quote") {
@@ -193,8 +500,7 @@ RalTypePtr EVAL(RalTypePtr mp, RalEnvPtr env)
         // (quasiquote ...)
         else if (first == "quasiquote") {
             DBG << "quasiquote " << lp->str(true);
-            auto second = lp->get(1);
-            mp = quasiquote(second);
+            return quasiquote(lp, env);
         }
         // (try* A (catch* B C))
         // Add a (native language) try/catch block that evaluates A within the
@@ -208,55 +514,136 @@ RalTypePtr EVAL(RalTypePtr mp, RalEnvPtr env)
         // will extract the ral type/value from the native exception. Create a
         // ral environment that binds B to the value of the exception.
         // Finally, evaluate C using that new environment.
+        // A ral throw evaluated here comes back as throw_marker without
+        // unwinding.  One from native code, like (map throw ...), is a
+        // RalException carrying the value.  Any other exception binds B to
+        // its message.
         else if (first == "try*") {
             DBG << "try* " << lp->str(true);
+            RalTypePtr ep;
             try {
                 auto A = lp->get(1);
-                mp = EVAL(A, env);
-            }
-            catch (std::exception &e) {
-                auto ep = std::make_shared<RalString>(e.what());
-                if (lp->size() > 2) {
-                    auto catchList = lp->get(2);
-                    auto clp = std::static_pointer_cast<RalList>(catchList);
-                    auto B = clp->get(1);
-                    auto C = clp->get(2);
-                    std::vector<RalTypePtr> binds;
-                    binds.push_back(B);
-                    std::vector<RalTypePtr> exprs;
-                    exprs.push_back(ep);
-                    RalEnvPtr catch_env =
-                        std::make_shared<RalEnv>(env, binds, exprs);
-                    mp = EVAL(C, catch_env);
+                auto value = eval_inner(A, env);
+                if (value != throw_marker) {
+                    return value;
                 }
-                else {
-                    mp = ep;
+                ep = take_thrown();
+            }
+            catch (RalException &e) {
+                ep = e.value();
+                if (ep == nullptr) {
+                    ep = std::make_shared<RalString>(
+                        static_cast<std::exception &>(e).what());
                 }
             }
+            catch (std::exception &e) {
+                ep = std::make_shared<RalString>(e.what());
+            }
+            if (lp->size() <= 2) {
+                return ep;
+            }
+            auto catchList = lp->get(2);
+            auto clp = std::static_pointer_cast<RalList>(catchList);
+            auto B = clp->get(1);
+            std::vector<RalTypePtr> binds;
+            binds.push_back(B);
+            std::vector<RalTypePtr> exprs;
+            exprs.push_back(ep);
+            env = std::make_shared<RalEnv>(env, binds, exprs);
+            mp = clp->get(2); // TCO
         }
         else {
             DBG << "list: eval,apply... " << lp->str(true);
-            // evaluate the list & we know this returns a list
-            auto elp = std::static_pointer_cast<RalList>(lp->eval(env));
+            auto prim = primitive_of(lp->get(0), env);
+            if (prim != PRIM_NONE) {
+                return run_primitive(prim, lp, env);
+            }
+            // a call to a small global lambda runs its inlined body
+            auto site = dynamic_cast<RalCallSite *>(lp->compiled().get());
+            if (site == nullptr) {
+                lp->setCompiled(plan_inline(lp, env));
+                site = static_cast<RalCallSite *>(lp->compiled().get());
+            }
+            if (site->expansion_ != nullptr) {
+                if (site->holds(env)) {
+                    mp = site->expansion_; // TCO
+                    continue;
+                }
+                lp->setCompiled(plan_call(lp, env)); // a global was redefined
+                site = static_cast<RalCallSite *>(lp->compiled().get());
+            }
+            // evaluate the list, passing a throw on
+            std::vector<RalTypePtr> elp;
+            elp.reserve(lp->size());
+            for (size_t i = 0; i < lp->size(); i++) {
+                auto e = eval_inner(lp->data()[i], env);
+                if (e == throw_marker) {
+                    return e;
+                }
+                elp.push_back(std::move(e));
+            }
+            if (elp[0]->kind() == RalKind::MULTI_FN) {
+                elp[0] = site->method(static_cast<RalMultiFn *>(elp[0].get()),
+                                      elp.data() + 1, elp.data() + elp.size());
+            }
             // check if first element of the list is a LAMBDA
-            if (elp->get(0)->kind() == RalKind::LAMBDA) {
+            if (elp[0]->kind() == RalKind::LAMBDA) {
                 DBG << "lambda apply";
-                // special case for TCO
-                auto lambda = elp->get(0);
-                mp = std::static_pointer_cast<RalLambda>(lambda)->form();
-                std::vector<RalTypePtr> rest;
-                for (size_t i = 1; i < elp->size(); i++) {
-                    rest.push_back(elp->get(i));
-                }
-                env = std::static_pointer_cast<RalLambda>(lambda)->makeEnv(
-                    rest.begin(), rest.end());
+                // special case for TCO.  elp is ours, so a variadic tail
+                // can take over its arguments.
+                auto lambda = std::static_pointer_cast<RalLambda>(elp[0]);
+                auto &a = lambda->arity(elp.size() - 1);
+                mp = a.form_;
+                env = lambda->makeEnv(a, elp.data() + 1,
+                                      elp.data() + elp.size(), true);
             }
             else {
                 DBG << "non-lambda apply";
-                return apply(elp);
+                return invoke(elp[0], elp.data() + 1, elp.data() + elp.size());
+            }
+        }
+    }
+}
+
+RalTypePtr EVAL(RalTypePtr mp, RalEnvPtr env)
+{
+    auto value = eval_inner(mp, env);
+    if (value == throw_marker) {
+        throw RalException(take_thrown());
+    }
+    return value;
+}
+
+// The arities of (fn* [params] body) or (fn* ([params] body) ...).  A list
+// whose first item is a list or vector is a list of arity clauses; any other
+// list is one parameter list.
+RalAritiesPtr fnArities(std::shared_ptr<RalList> lp)
+{
+    auto bindings = lp->get(1);
+    if (!(bindings->isList() || bindings->isVector())) {
+        throw RalBadFnParam1();
+    }
+    auto bindingList = std::static_pointer_cast<RalList>(bindings);
+    std::vector<RalArity> arities;
+    if (bindings->isList() && (bindingList->size() > 0) &&
+        (bindingList->get(0)->isList() || bindingList->get(0)->isVector())) {
+        for (size_t i = 1; i < lp->size(); i++) {
+            auto clause = lp->get(i);
+            if (!clause->isList() || clause->isEmptyList()) {
+                throw RalBadFnParam1();
+            }
+            auto clp = std::static_pointer_cast<RalList>(clause);
+            auto params = clp->get(0);
+            if (!(params->isList() || params->isVector())) {
+                throw RalBadFnParam1();
             }
+            arities.emplace_back(std::static_pointer_cast<RalList>(params),
+                                 clp->get(1));
         }
+        return std::make_shared<RalArities>(std::move(arities), false);
     }
+    arities.emplace_back(bindingList, lp->get(2));
+    return std::make_shared<RalArities>(std::move(arities), true);
 }
 
 bool is_pair(RalTypePtr mp)
@@ -264,65 +651,639 @@ bool is_pair(RalTypePtr mp)
     return (mp->isList() || mp->isVector()) && !(mp->isEmptyList());
 }
 
-RalTypePtr quasiquote(RalTypePtr mp)
+// A quasiquote template compiled into the steps to build its value.  Parts
+// without unquotes are built once & shared by every evaluation, so only the
+// unquoted & spliced slots are filled in at run time.
+class RalQuasiPlan : public RalCompiled {
+  public:
+    enum Op { LITERAL, UNQUOTE, LIST };
+    Op op_;
+    RalTypePtr form_; // the value for LITERAL, the form to EVAL for UNQUOTE
+    std::vector<std::shared_ptr<RalQuasiPlan>> items_; // for LIST
+    std::vector<bool> splice_; // true if items_[i] is splice-unquoted
+
+    RalQuasiPlan(Op op, RalTypePtr form) : op_(op), form_(form) {}
+    static std::shared_ptr<RalQuasiPlan> compile(RalTypePtr mp);
+    RalTypePtr instantiate(RalEnvPtr env);
+};
+
+// true if mp is a list or vector whose first item is the symbol name
+bool starts_with(RalTypePtr mp, const char *name)
+{
+    if (!is_pair(mp)) {
+        return false;
+    }
+    auto first = std::static_pointer_cast<RalList>(mp)->get(0);
+    return (first->kind() == RalKind::SYMBOL) && (first->str(true) == name);
+}
+
+std::shared_ptr<RalQuasiPlan> RalQuasiPlan::compile(RalTypePtr mp)
 {
-    // if is_pair of ast is false: return a new list containing:
-    // a symbol named "quote" and ast.
+    // anything but a non-empty list or vector is quoted as-is
     if (!is_pair(mp)) {
-        DBG << "!is_pair";
-        auto list = std::make_shared<RalList>('(');
-        auto quote = std::make_shared<RalSymbol>("quote");
-        list->add(quote);
-        list->add(mp);
-        return list;
+        return std::make_shared<RalQuasiPlan>(LITERAL, mp);
     }
-    // we know mp is a list
     auto lp = std::static_pointer_cast<RalList>(mp);
-    auto first = lp->get(0);
-    // else if the first element of ast is a symbol named "unquote":
-    // return the second element of ast.
-    if (first->str(true) == "unquote") {
-        DBG << "unquote";
-        return lp->get(1);
-    }
-    // if is_pair of the first element of ast is true and
-    // the first element of first element of ast (ast[0][0]) is a
-    // symbol named "splice-unquote": return a new list containing:
-    // a symbol named "concat", the second element of first element
-    // of ast (ast[0][1]), and the result of calling quasiquote with
-    // the second through last element of ast.
-    auto firstlp = std::static_pointer_cast<RalList>(first);
-    if (is_pair(first) && firstlp->get(0)->str(true) == "splice-unquote") {
-        DBG << "splice-unquote";
-        auto list = std::make_shared<RalList>('(');
-        auto concat = std::make_shared<RalSymbol>("concat");
-        list->add(concat);
-        list->add(firstlp->get(1));
-        auto rest = std::make_shared<RalList>('(');
-        for (size_t i = 1; i < lp->size(); i++) {
-            rest->add(lp->get(i));
+    if (starts_with(mp, "unquote")) {
+        return std::make_shared<RalQuasiPlan>(UNQUOTE, lp->get(1));
+    }
+    auto plan = std::make_shared<RalQuasiPlan>(LIST, nullptr);
+    bool literal = true;
+    for (size_t i = 0; i < lp->size(); i++) {
+        auto item = lp->get(i);
+        if (starts_with(item, "splice-unquote")) {
+            auto ilp = std::static_pointer_cast<RalList>(item);
+            plan->items_.push_back(
+                std::make_shared<RalQuasiPlan>(UNQUOTE, ilp->get(1)));
+            plan->splice_.push_back(true);
+            literal = false;
+        }
+        else {
+            plan->items_.push_back(compile(item));
+            plan->splice_.push_back(false);
+            literal = literal && (plan->items_.back()->op_ == LITERAL);
         }
-        list->add(quasiquote(rest));
-        return list;
     }
-    // otherwise: return a new list containing:
-    // a symbol named "cons",
-    // the result of calling quasiquote on first element of ast (ast[0]),
-    // and the result of calling quasiquote with the second through last
-    // element of ast.
-    {
-        DBG << "else cons";
+    if (literal) {
+        // a quasiquoted vector is a list
         auto list = std::make_shared<RalList>('(');
-        auto cons = std::make_shared<RalSymbol>("cons");
-        list->add(cons);
-        list->add(quasiquote(first));
-        auto rest = std::make_shared<RalList>('(');
-        for (size_t i = 1; i < lp->size(); i++) {
-            rest->add(lp->get(i));
+        for (auto &item : plan->items_) {
+            list->add(item->form_);
+        }
+        return std::make_shared<RalQuasiPlan>(LITERAL, list);
+    }
+    return plan;
+}
+
+RalTypePtr RalQuasiPlan::instantiate(RalEnvPtr env)
+{
+    switch (op_) {
+    case LITERAL:
+        return form_;
+    case UNQUOTE:
+        return EVAL(form_, env);
+    default:
+        break;
+    }
+    auto list = std::make_shared<RalList>('(');
+    for (size_t i = 0; i < items_.size(); i++) {
+        auto value = items_[i]->instantiate(env);
+        if (splice_[i]) {
+            RalSeqCursor cursor("splice-unquote", value);
+            RalTypePtr item;
+            while (cursor.next(item)) {
+                list->add(item);
+            }
+        }
+        else {
+            list->add(value);
+        }
+    }
+    return list;
+}
+
+// (quasiquote a) - the template a is compiled the first time & the plan kept
+// on the quasiquote form lp.
+RalTypePtr quasiquote(std::shared_ptr<RalList> lp, RalEnvPtr env)
+{
+    auto plan = std::static_pointer_cast<RalQuasiPlan>(lp->compiled());
+    if (plan == nullptr) {
+        plan = RalQuasiPlan::compile(lp->get(1));
+        lp->setCompiled(plan);
+    }
+    return plan->instantiate(env);
+}
+
+// ================================================================================
+// true if list mp starts with one of the native_forms names & that name still
+// refers to the stdlib macro.
+bool is_native_form(RalTypePtr mp, RalEnvPtr env)
+{
+    auto first = std::static_pointer_cast<RalList>(mp)->get(0);
+    if (first->kind() != RalKind::SYMBOL) {
+        return false;
+    }
+    auto it = native_forms.find(first->str(true));
+    return (it != native_forms.end()) && (it->second != nullptr) &&
+           (first->eval(env) == it->second);
+}
+
+// ================================================================================
+// Walks form, marking the recurs in tail position.  Only the special forms
+// pass tail position on to their subforms; a recur anywhere else, or inside
+// a macro call other than the native forms, is an error.
+RalTypePtr RalLoopPlan::mark(RalTypePtr form, bool tail, RalEnvPtr env)
+{
+    if (!form->isList() && !form->isVector()) {
+        return form;
+    }
+    if (form->isEmptyList()) {
+        return form;
+    }
+    auto lp = std::static_pointer_cast<RalList>(form);
+    if (form->isList() && lp->is_macro_call(env) && !is_native_form(lp, env)) {
+        // a recur the expansion puts in tail position is fine, so mark the
+        // expansion & have EVAL run that instead of expanding again
+        return mark(macroexpand(lp, env), tail, env);
+    }
+    // marks item i of lp, keeping the expansion of any macro in it
+    auto markItem = [&](size_t i, bool itemTail) {
+        auto item = lp->get(i);
+        auto marked = mark(item, itemTail, env);
+        if (marked != item) {
+            lp->set(i, marked);
+        }
+    };
+    size_t size = lp->size();
+    auto head = lp->get(0);
+    std::string first =
+        (head->kind() == RalKind::SYMBOL) ? head->str(true) : "";
+    if (form->isVector()) {
+        first = "";
+    }
+    if (first == "recur") {
+        if (!tail) {
+            throw RalException("'recur' must be in tail position of a loop.");
+        }
+        lp->setCompiled(std::make_shared<RalRecurSite>(names_.size()));
+        for (size_t i = 1; i < size; i++) {
+            markItem(i, false);
+        }
+    }
+    else if ((first == "quote") || (first == "quasiquote") ||
+             (first == "loop")) {
+        // nothing to mark; an inner loop marks its own recurs
+        if (first == "loop") {
+            markItem(1, false);
+        }
+    }
+    else if (first == "fn*") {
+        freshFrames_ = true;
+    }
+    else if (first == "if") {
+        markItem(1, false);
+        markItem(2, tail);
+        if (size > 3) {
+            markItem(3, tail);
+        }
+    }
+    else if ((first == "do") ||
+             (is_native_form(lp, env) &&
+              ((first == "and") || (first == "or") || (first == "when")))) {
+        for (size_t i = 1; i < size; i++) {
+            // the test of when is not in tail position
+            bool isTest = (first == "when") && (i == 1);
+            markItem(i, tail && (i == size - 1) && !isTest);
+        }
+    }
+    else if (first == "let*") {
+        markItem(1, false);
+        markItem(2, tail);
+    }
+    else if (is_native_form(lp, env) && (first == "cond")) {
+        for (size_t i = 1; i < size; i++) {
+            // tests are at odd indices, the forms they choose at even ones
+            markItem(i, tail && (i % 2 == 0));
+        }
+    }
+    else {
+        for (size_t i = 0; i < size; i++) {
+            markItem(i, false);
+        }
+    }
+    return form;
+}
+
+std::shared_ptr<RalLoopPlan> loop_plan(std::shared_ptr<RalList> lp,
+                                       RalEnvPtr env)
+{
+    auto plan = std::dynamic_pointer_cast<RalLoopPlan>(lp->compiled());
+    if (plan != nullptr) {
+        return plan;
+    }
+    plan = std::make_shared<RalLoopPlan>();
+    auto bindings = lp->get(1);
+    if (!(bindings->isList() || bindings->isVector())) {
+        throw RalException("'loop' requires a vector of bindings.");
+    }
+    auto blp = std::static_pointer_cast<RalList>(bindings);
+    if (blp->size() % 2 != 0) {
+        throw RalException("'loop' requires an even number of bindings.");
+    }
+    for (size_t i = 0; i < blp->size(); i += 2) {
+        if (blp->get(i)->kind() != RalKind::SYMBOL) {
+            throw RalException("'loop' can only bind symbols.");
+        }
+        plan->names_.push_back(blp->get(i)->str(true));
+        plan->inits_.push_back(blp->get(i + 1));
+    }
+    // more than one body form runs as a do
+    if (lp->size() == 3) {
+        plan->body_ = lp->get(2);
+    }
+    else {
+        auto body = std::make_shared<RalList>('(');
+        body->add(std::make_shared<RalSymbol>("do"));
+        for (size_t i = 2; i < lp->size(); i++) {
+            body->add(lp->get(i));
+        }
+        plan->body_ = body;
+    }
+    plan->body_ = plan->mark(plan->body_, true, env);
+    lp->setCompiled(plan);
+    return plan;
+}
+
+RalTypePtr recur(std::shared_ptr<RalList> lp, RalEnvPtr env)
+{
+    auto site = std::dynamic_pointer_cast<RalRecurSite>(lp->compiled());
+    if (site == nullptr) {
+        throw RalException("'recur' must be in tail position of a loop.");
+    }
+    size_t num = lp->size() - 1;
+    checkArgsEqual("recur", site->arity_, num);
+    // evaluating the values may run other loops, so only store them after
+    RalArgBuffer values(num);
+    for (size_t i = 0; i < num; i++) {
+        values[i] = eval_inner(lp->data()[i + 1], env);
+        if (values[i] == throw_marker) {
+            return throw_marker;
+        }
+    }
+    recur_values.assign(values.begin(), values.end());
+    return recur_marker;
+}
+
+// ================================================================================
+// Inlining.  The first time EVAL sees a call (f a ...) to a global lambda
+// with one small body that binds no names & doesn't refer to f, it replaces
+// the call with that body.  Literal arguments are substituted for the
+// parameters; any other argument, symbols included, is bound by a let* first,
+// in order, so it is still evaluated once, in the same order & even if the
+// body doesn't use it.  Calls in the body to other such globals are inlined
+// too, a few levels deep.  The expansion is only used while every global
+// inlined into it has the value it had & no local binding where the call runs
+// hides a global its body refers to, so re-def!ing one of them, or running
+// the call where one is shadowed, puts the call back on the normal path for
+// good.
+static const size_t RAL_INLINE_MAX_NODES = 32;
+static const size_t RAL_INLINE_MAX_DEPTH = 4;
+static size_t inline_names = 0; // numbers the let* names of arguments
+
+// true if form evaluates to itself, so it can stand in for a parameter
+static bool inline_literal(RalTypePtr form)
+{
+    switch (form->kind()) {
+    case RalKind::INTEGER:
+    case RalKind::BIGINT:
+    case RalKind::DOUBLE:
+    case RalKind::CONSTANT:
+    case RalKind::STRING:
+    case RalKind::KEYWORD:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// true if name is a special form, with allowed set if it can be inlined.  The
+// others bind names or decide what gets evaluated.
+static bool inline_special(const std::string &name, bool &allowed)
+{
+    static const std::unordered_map<std::string, bool> specials = {
+        {"def!", false},  {"defmacro!", false}, {"macroexpand", false},
+        {"let*", false},  {"fn*", false},       {"loop", false},
+        {"recur", false}, {"try*", false},      {"quasiquote", false},
+        {"do", true},     {"if", true},         {"quote", true}};
+    auto it = specials.find(name);
+    if (it == specials.end()) {
+        return false;
+    }
+    allowed = it->second;
+    return true;
+}
+
+class RalInliner {
+    RalEnvPtr env_;                  // the call site's env
+    std::vector<std::string> stack_; // the globals being inlined
+
+    bool canInline(RalTypePtr form, const std::vector<std::string> &params,
+                   const std::string &self, size_t &nodes);
+    RalTypePtr substitute(RalTypePtr form,
+                          std::unordered_map<std::string, RalTypePtr> &args);
+    RalTypePtr inlineCalls(RalTypePtr form);
+
+  public:
+    std::vector<std::pair<std::string, RalTypePtr>> guards_;
+    std::vector<std::string> globals_; // the free symbols of the bodies
+    RalInliner(RalEnvPtr env) : env_(env) {}
+    // the expansion of call, or nullptr if it can't be inlined
+    RalTypePtr inlineCall(std::shared_ptr<RalList> call);
+};
+
+bool RalInliner::canInline(RalTypePtr form,
+                           const std::vector<std::string> &params,
+                           const std::string &self, size_t &nodes)
+{
+    if (++nodes > RAL_INLINE_MAX_NODES) {
+        return false;
+    }
+    if (form->kind() == RalKind::SYMBOL) {
+        auto name = form->str(false);
+        if (std::find(params.begin(), params.end(), name) != params.end()) {
+            return true;
+        }
+        // any other symbol has to mean the same global at the call site,
+        // & wherever the expansion runs later
+        auto where = env_->find(name);
+        if ((name == self) || ((where != nullptr) && (where != repl_env))) {
+            return false;
+        }
+        if (std::find(globals_.begin(), globals_.end(), name) ==
+            globals_.end()) {
+            globals_.push_back(name);
+        }
+        return true;
+    }
+    if (form->kind() == RalKind::MAP) {
+        return false;
+    }
+    if (!(form->isList() || form->isVector()) || form->isEmptyList()) {
+        return true;
+    }
+    auto lp = std::static_pointer_cast<RalList>(form);
+    if (form->isList() && (lp->get(0)->kind() == RalKind::SYMBOL)) {
+        bool allowed;
+        if (inline_special(lp->get(0)->str(false), allowed)) {
+            if (!allowed) {
+                return false;
+            }
+            if (lp->get(0)->str(false) == "quote") {
+                return true;
+            }
+        }
+        else if (lp->is_macro_call(env_) && !is_native_form(lp, env_)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < lp->size(); i++) {
+        if (!canInline(lp->get(i), params, self, nodes)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// a copy of form with the parameters in args replaced
+RalTypePtr
+RalInliner::substitute(RalTypePtr form,
+                       std::unordered_map<std::string, RalTypePtr> &args)
+{
+    if (form->kind() == RalKind::SYMBOL) {
+        auto it = args.find(form->str(false));
+        return (it != args.end()) ? it->second : form;
+    }
+    if (!(form->isList() || form->isVector())) {
+        return form;
+    }
+    auto lp = std::static_pointer_cast<RalList>(form);
+    if (form->isList() && (lp->get(0)->str(true) == "quote")) {
+        return form;
+    }
+    auto copy = std::make_shared<RalList>(form->isList() ? '(' : '[');
+    copy->reserve(lp->size());
+    for (size_t i = 0; i < lp->size(); i++) {
+        copy->add(substitute(lp->get(i), args));
+    }
+    return copy;
+}
+
+// inlines the calls in form, a copy made by substitute, & marks the rest as
+// normal calls so they aren't expanded again when they are evaluated
+RalTypePtr RalInliner::inlineCalls(RalTypePtr form)
+{
+    if (!(form->isList() || form->isVector()) || form->isEmptyList()) {
+        return form;
+    }
+    auto lp = std::static_pointer_cast<RalList>(form);
+    if (form->isList() && (lp->get(0)->kind() == RalKind::SYMBOL)) {
+        bool allowed;
+        auto name = lp->get(0)->str(false);
+        if (name == "quote") {
+            return form;
+        }
+        if (!inline_special(name, allowed) && !is_native_form(lp, env_)) {
+            auto expansion = inlineCall(lp);
+            if (expansion != nullptr) {
+                return expansion;
+            }
+            lp->setCompiled(plan_call(lp, env_));
+        }
+    }
+    for (size_t i = 0; i < lp->size(); i++) {
+        lp->set(i, inlineCalls(lp->get(i)));
+    }
+    return form;
+}
+
+RalTypePtr RalInliner::inlineCall(std::shared_ptr<RalList> call)
+{
+    auto head = call->get(0);
+    if ((head->kind() != RalKind::SYMBOL) ||
+        (stack_.size() >= RAL_INLINE_MAX_DEPTH)) {
+        return nullptr;
+    }
+    auto name = head->str(false);
+    if ((std::find(stack_.begin(), stack_.end(), name) != stack_.end()) ||
+        (env_->find(name) != repl_env)) {
+        return nullptr;
+    }
+    auto value = repl_env->get(name);
+    if (value->kind() != RalKind::LAMBDA) {
+        return nullptr;
+    }
+    auto lambda = std::static_pointer_cast<RalLambda>(value);
+    auto a = lambda->arities()->single();
+    if (lambda->get_is_macro() || (lambda->env() != repl_env) ||
+        (a == nullptr) || a->variadic_ ||
+        (a->names_.size() != call->size() - 1)) {
+        return nullptr;
+    }
+    size_t nodes = 0;
+    auto numGlobals = globals_.size();
+    if (!canInline(a->form_, a->names_, name, nodes)) {
+        globals_.resize(numGlobals);
+        return nullptr;
+    }
+    std::unordered_map<std::string, RalTypePtr> args;
+    auto bindings = std::make_shared<RalList>('[');
+    for (size_t i = 0; i < a->names_.size(); i++) {
+        auto arg = call->get(i + 1);
+        if (!inline_literal(arg)) {
+            auto bound = std::make_shared<RalSymbol>(
+                a->names_[i] + "#" + std::to_string(++inline_names));
+            bindings->add(bound);
+            // the arguments of a nested call are copies, so inline them
+            // too.  The outermost call's arguments belong to the caller.
+            bindings->add(stack_.empty() ? arg : inlineCalls(arg));
+            args[a->names_[i]] = bound;
+        }
+        else {
+            args[a->names_[i]] = arg;
+        }
+    }
+    stack_.push_back(name);
+    auto body = inlineCalls(substitute(a->form_, args));
+    stack_.pop_back();
+    guards_.emplace_back(name, value);
+    if (bindings->size() == 0) {
+        return body;
+    }
+    auto let = std::make_shared<RalList>('(');
+    let->add(std::make_shared<RalSymbol>("let*"));
+    let->add(bindings);
+    let->add(body);
+    return let;
+}
+
+// the site for a call that isn't inlined.  Only calls through a symbol that
+// is a protocol method or multimethod now get their own dispatch cache.
+std::shared_ptr<RalCallSite> plan_call(std::shared_ptr<RalList> lp,
+                                       RalEnvPtr env)
+{
+    auto head = lp->get(0);
+    if ((head->kind() == RalKind::SYMBOL) &&
+        (env->find(head->str(false)) != nullptr) &&
+        (env->get(head->str(false))->kind() == RalKind::MULTI_FN)) {
+        return std::make_shared<RalCallSite>(true);
+    }
+    return plain_call;
+}
+
+std::shared_ptr<RalCallSite> plan_inline(std::shared_ptr<RalList> lp,
+                                         RalEnvPtr env)
+{
+    RalInliner inliner(env);
+    auto expansion = inliner.inlineCall(lp);
+    if (expansion == nullptr) {
+        return plan_call(lp, env);
+    }
+    auto site = std::make_shared<RalCallSite>(false);
+    site->expansion_ = expansion;
+    site->guards_ = inliner.guards_;
+    site->globals_ = inliner.globals_;
+    return site;
+}
+
+// ================================================================================
+// the RalPrim that a call through head can run inline in env, or PRIM_NONE
+int primitive_of(RalTypePtr head, RalEnvPtr env)
+{
+    if (head->kind() != RalKind::SYMBOL) {
+        return PRIM_NONE;
+    }
+    auto sym = std::static_pointer_cast<RalSymbol>(head);
+    if (sym->cachedPrim_ < 0) {
+        sym->cachedPrim_ = PRIM_NONE;
+        auto name = sym->str(false);
+        for (int i = PRIM_NONE + 1; i < NUM_PRIMS; i++) {
+            if (name == primitives[i].name_) {
+                sym->cachedPrim_ = i;
+                break;
+            }
         }
-        list->add(quasiquote(rest));
-        return list;
     }
+    int prim = sym->cachedPrim_;
+    if ((prim == PRIM_NONE) ||
+        (sym->eval(env) != primitives[prim].builtin_)) {
+        return PRIM_NONE;
+    }
+    return prim;
+}
+
+RalTypePtr run_primitive(int prim, std::shared_ptr<RalList> lp, RalEnvPtr env)
+{
+    size_t num = lp->size() - 1;
+    RalArgBuffer args(num);
+    for (size_t i = 0; i < num; i++) {
+        args[i] = eval_inner(lp->data()[i + 1], env);
+        if (args[i] == throw_marker) {
+            return throw_marker;
+        }
+    }
+    if ((prim == PRIM_THROW) && (num == 1)) {
+        thrown_value = args[0];
+        return throw_marker;
+    }
+    if ((num == 2) && (args[0]->kind() == RalKind::INTEGER) &&
+        (args[1]->kind() == RalKind::INTEGER)) {
+        int64_t a = args[0]->asInt();
+        int64_t b = args[1]->asInt();
+        int64_t r;
+        // on overflow, the builtin promotes to a bigint
+        switch (prim) {
+        case PRIM_ADD:
+            if (!ralAddOverflow(a, b, &r)) {
+                return std::make_shared<RalInteger>(r);
+            }
+            break;
+        case PRIM_SUB:
+            if (!ralSubOverflow(a, b, &r)) {
+                return std::make_shared<RalInteger>(r);
+            }
+            break;
+        case PRIM_MUL:
+            if (!ralMulOverflow(a, b, &r)) {
+                return std::make_shared<RalInteger>(r);
+            }
+            break;
+        case PRIM_LT:
+            return std::make_shared<RalConstant>((a < b) ? "true" : "false");
+        case PRIM_LE:
+            return std::make_shared<RalConstant>((a <= b) ? "true" : "false");
+        case PRIM_GT:
+            return std::make_shared<RalConstant>((a > b) ? "true" : "false");
+        case PRIM_GE:
+            return std::make_shared<RalConstant>((a >= b) ? "true" : "false");
+        case PRIM_EQ:
+            return std::make_shared<RalConstant>((a == b) ? "true" : "false");
+        default:
+            break;
+        }
+    }
+    return primitives[prim].fn_(args.begin(), args.end());
+}
+
+// ================================================================================
+// Rewrite (-> x (a a1 a2) .. (b b1 b2)) as (b (.. (a x a1 a2) ..) b1 b2)
+// or, with last, (->> x (a a1 a2) .. (b b1 b2)) as (b b1 b2 (.. (a a1 a2 x) ..)).
+// Anything but a list, like f, is treated as (f).
+RalTypePtr thread_forms(std::shared_ptr<RalList> lp, bool last)
+{
+    auto acc = lp->get(1);
+    for (size_t i = 2; i < lp->size(); i++) {
+        auto form = lp->get(i);
+        auto threaded = std::make_shared<RalList>('(');
+        if (form->isList() && !(form->isEmptyList())) {
+            auto flp = std::static_pointer_cast<RalList>(form);
+            threaded->add(flp->get(0));
+            if (!last) {
+                threaded->add(acc);
+            }
+            for (size_t j = 1; j < flp->size(); j++) {
+                threaded->add(flp->get(j));
+            }
+            if (last) {
+                threaded->add(acc);
+            }
+        }
+        else {
+            threaded->add(form);
+            threaded->add(acc);
+        }
+        acc = threaded;
+    }
+    return acc;
 }
 
 // ================================================================================
@@ -340,13 +1301,8 @@ RalTypePtr macroexpand(RalTypePtr ast, RalEnvPtr env)
         DBG << "pre: " << ast->str(true);
         auto listp = std::static_pointer_cast<RalList>(ast);
         auto symbol = std::static_pointer_cast<RalSymbol>(listp->get(0));
-        auto func = std::static_pointer_cast<RalLambda>(symbol->eval(env));
-        auto funclist = std::make_shared<RalList>('(');
-        funclist->add(func);
-        for (size_t i = 1; i < listp->size(); i++) {
-            funclist->add(listp->get(i));
-        }
-        ast = apply(funclist);
+        auto func = symbol->eval(env);
+        ast = invoke(func, listp->data() + 1, listp->data() + listp->size());
         DBG << "post: " << ast->str(true);
     }
     return ast;
@@ -359,16 +1315,6 @@ std::string PRINT(RalTypePtr mp)
     return pr_str(mp, true);
 }
 
-// ================================================================================
-RalTypePtr
-apply(RalTypePtr mp) // FIXME -- reconsider based on mp->lp change in eval
-{
-    INFO << "apply " << mp->str(true);
-    // m can only be a RalListType here
-    // exposing iterators was too much leaking abstration.
-    return mp->apply();
-}
-
 // ================================================================================
 std::string rep(std::string s, RalEnvPtr env)
 {
@@ -406,6 +1352,14 @@ void setup_repl_env(std::vector<std::string> args)
     for(int i = 0; i < NUM_RAL_STDLIB_FORMS; ++i) {
         rep(RAL_STDLIB_FORMS[i], repl_env);
     }
+    for (auto &kv : native_forms) {
+        kv.second = repl_env->get(kv.first);
+    }
+    for (auto &prim : primitives) {
+        if (prim.fn_ != nullptr) {
+            prim.builtin_ = repl_env->get(prim.name_);
+        }
+    }
 
 }
 
@@ -51,6 +51,8 @@ const char *RAL_STDLIB_FORMS[] = {
     "      (read-string"
     "        (str \"(do \" (slurp f) \"\nnil)\")))))", // FORM 2
     
+    // EVAL runs cond, when, or, and, -> & ->> as special forms (see
+    // native_forms in ral.cpp).  These macros are what macroexpand shows.
     "(defmacro! cond" 
     "  (fn* (& xs)"
     "    (if (> (count xs) 0)"
@@ -59,14 +61,18 @@ const char *RAL_STDLIB_FORMS[] = {
     "          (nth xs 1)"
     "          (throw \"odd number of forms to cond\"))" 
     "        (cons 'cond (rest (rest xs)))))))", // FORM 3
+
+    "(defmacro! when"
+    "  (fn* (test & body)"
+    "    `(if ~test (do ~@body))))", // FORM 4
     
-    "(def! radians (fn* (deg) (* TAU (/ deg 360.))))", // FORM 4
+    "(def! radians (fn* (deg) (* TAU (/ deg 360.))))", // FORM 5
 
-    "(def! degrees (fn* (rad) (* 360. (/ rad TAU))))", // FORM 5
+    "(def! degrees (fn* (rad) (* 360. (/ rad TAU))))", // FORM 6
     
     "(defmacro! defn!"
-    "  (fn* (name args body)"
-    "    `(def! ~name (fn* ~args ~body))))", // FORM 6
+    "  (fn* (name & arities)"
+    "    `(def! ~name (fn* ~@arities))))", // FORM 7
 
     // ================================================================================
     // Ral "Standard" Library 
@@ -77,7 +83,7 @@ const char *RAL_STDLIB_FORMS[] = {
     // alias-hacks.mal
     "(def! partial (fn* [pfn & args]"
     "  (fn* [& args-inner]"
-    "    (apply pfn (concat args args-inner)))))", // FORM 7
+    "    (apply pfn (concat args args-inner)))))", // FORM 8
 
     // --------------------------------------------------------------------------------
     // load-file-once.mal
@@ -87,41 +93,17 @@ const char *RAL_STDLIB_FORMS[] = {
     // since this is in our std library, we don't need the
     // special handling for load-file-once of this containing file.
     "(def! load-file-once"
-    "  (let* [seen (atom {})]"
+    "  (let* [seen (atom #{})]"
     "    (fn* [filename]"
     "      (if (not (contains? @seen filename))"
     "        (do"
-    "          (swap! seen assoc filename nil)"
-    "         (load-file filename))))))", // FORM 8
+    "          (swap! seen conj filename)"
+    "         (load-file filename))))))", // FORM 9
 
     // --------------------------------------------------------------------------------
     // memoize.mal
 
-    // Memoize any function.
-
-    // Implement `memoize` using an atom (`mem`) which holds the memoized results
-    // (hash-map from the arguments to the result). When the function is called,
-    // the hash-map is checked to see if the result for the given argument was already
-    // calculated and stored. If this is the case, it is returned immediately;
-    // otherwise, it is calculated and stored in `mem`.
-
-    // For recursive functions, take care to store the wrapper under the
-    // same name than the original computation with an assignment like
-    // `(def! f (memoize f))`, so that intermediate results are memorized.
-
-    // Adapted from http://clojure.org/atoms
-
-    "(def! memoize"
-    "  (fn* [f]"
-    "    (let* [mem (atom {})]"
-    "      (fn* [& args]"
-    "        (let* [key (str args)]"
-    "          (if (contains? @mem key)"
-    "            (get @mem key)"
-    "            (let* [ret (apply f args)]"
-    "              (do"
-    "                (swap! mem assoc key ret)"
-    "                ret))))))))", // FORM 9
+    // memoize is implemented in core.cpp
 
     // --------------------------------------------------------------------------------
     // trivial.mal
@@ -224,12 +206,18 @@ const char *RAL_STDLIB_FORMS[] = {
     "                                      (pp- (get obj k) vindent)))"
     "                        (rest (keys obj))))))"
     ""
-    "    pp- (fn* [obj indent]"
-    "      (cond"
-    "        (list? obj)   (str \"(\" (pp-seq- obj indent) \")\")"
-    "        (vector? obj) (str \"[\" (pp-seq- obj indent) \"]\")"
-    "        (map? obj)    (str \"{\" (pp-map- obj indent) \"}\")"
-    "        :else         (pr-str obj)))"
+    "    pp- (protocol-fn \"pp-\")"
+    "    _ (add-method pp- :list"
+    "        (fn* [obj indent] (str \"(\" (pp-seq- obj indent) \")\")))"
+    "    _ (add-method pp- :vector"
+    "        (fn* [obj indent] (str \"[\" (pp-seq- obj indent) \"]\")))"
+    "    _ (add-method pp- :map"
+    "        (fn* [obj indent] (str \"{\" (pp-map- obj indent) \"}\")))"
+    "    _ (add-method pp- :default"
+    "        (fn* [obj indent]"
+    "          (if (map? obj)"
+    "            (str \"{\" (pp-map- obj indent) \"}\")"
+    "            (pr-str obj))))"
     ""
     "    ]"
     ""
@@ -239,38 +227,7 @@ const char *RAL_STDLIB_FORMS[] = {
     // --------------------------------------------------------------------------------
     // reducers.mal
 
-    // Left and right folds.
-
-    // Left fold (f (.. (f (f init x1) x2) ..) xn)
-    "(def! reduce"
-    "  (fn* (f init xs)"
-    "    ;; f      : Accumulator Element -> Accumulator\n"
-    "    ;; init   : Accumulator\n"
-    "    ;; xs     : sequence of Elements x1 x2 .. xn\n"
-    "    ;; return : Accumulator\n"
-    "    (if (empty? xs)"
-    "      init"
-    "      (reduce f (f init (first xs)) (rest xs)))))", // FORM 18
-
-    // Right fold (f x1 (f x2 (.. (f xn init)) ..))
-    // The natural implementation for `foldr` is not tail-recursive, and
-    // the one based on `reduce` constructs many intermediate functions, so we
-    // rely on efficient `nth` and `count`.
-    "(def! foldr"
-    ""
-    "  (let* ["
-    "    rec (fn* [f xs acc index]"
-    "      (if (< index 0)"
-    "        acc"
-    "        (rec f xs (f (nth xs index) acc) (- index 1))))"
-    "    ]"
-    ""
-    "    (fn* [f init xs]"
-    "        ;; f      : Element Accumulator -> Accumulator\n"
-    "        ;; init   : Accumulator\n"
-    "        ;; xs     : sequence of Elements x1 x2 .. xn\n"
-    "        ;; return : Accumulator\n"
-    "       (rec f xs init (- (count xs) 1)))))", // FORM 19
+    // reduce & foldr are implemented in core.cpp
 
     // --------------------------------------------------------------------------------
     // test_cascade.mal
@@ -291,34 +248,9 @@ const char *RAL_STDLIB_FORMS[] = {
     "  (if (< (count xs) 2)"
     "    (first xs)"
     "    (let* [r (gensym)]"
-    "      `(let* (~r ~(first xs)) (if ~r ~r (or ~@(rest xs))))))))", // FORM 20
-
-    // Conjonction of predicate values (pred x1) and .. and (pred xn)
-    // Evaluate `pred x` for each `x` in turn. Return `false` if a result
-    // is `nil` or `false`, without evaluating the predicate for the
-    // remaining elements.  If all test pass, return `true`.
-    "(def! every?"
-    "  (fn* (pred xs)"
-    "    ;; pred   : Element -> interpreted as a logical value\n"
-    "    ;; xs     : sequence of Elements x1 x2 .. xn\n"
-    "    ;; return : boolean\n"
-    "    (cond (empty? xs)       true"
-    "          (pred (first xs)) (every? pred (rest xs))"
-    "          true              false)))", // FORM 21
-
-    // Disjonction of predicate values (pred x1) or .. (pred xn)
-    // Evaluate `(pred x)` for each `x` in turn. Return the first result
-    // that is neither `nil` nor `false`, without evaluating the predicate
-    // for the remaining elements.  If all tests fail, return nil.
-    "(def! some"
-    "  (fn* (pred xs)"
-    "    ;; pred   : Element -> interpreted as a logical value\n"
-    "    ;; xs     : sequence of Elements x1 x2 .. xn\n"
-    "    ;; return : boolean\n"
-    "    (if (empty? xs)"
-    "      nil"
-    "      (or (pred (first xs))"
-    "          (some pred (rest xs))))))", // FORM 22
+    "      `(let* (~r ~(first xs)) (if ~r ~r (or ~@(rest xs))))))))", // FORM 18
+
+    // every? & some are implemented in core.cpp
 
     // Search for first evaluation returning `nil` or `false`.
     // Rewrite `x1 x2 .. xn x` as
@@ -338,7 +270,7 @@ const char *RAL_STDLIB_FORMS[] = {
     "          (= 1 (count xs)) (first xs)"
     "          true             (let* (condvar (gensym))"
     "                             `(let* (~condvar ~(first xs))"
-    "                               (if ~condvar (and ~@(rest xs)) ~condvar))))))", // FORM 23
+    "                               (if ~condvar (and ~@(rest xs)) ~condvar))))))", // FORM 19
 
     // --------------------------------------------------------------------------------
     // threading.mal
@@ -352,13 +284,13 @@ const char *RAL_STDLIB_FORMS[] = {
     // equivalent to `-> x (list a)`.
     "(defmacro! ->"
     "  (fn* (x & xs)"
-    "    (reduce _iter-> x xs)))", // FORM 24
+    "    (reduce _iter-> x xs)))", // FORM 20
 
     "(def! _iter->"
     "  (fn* [acc form]"
     "    (if (list? form)"
     "      `(~(first form) ~acc ~@(rest form))"
-    "      (list form acc))))", // FORM 25
+    "      (list form acc))))", // FORM 21
 
     // Like `->`, but the arguments describe functions that are partially
     // applied with *left* arguments.  The previous result is inserted at
@@ -367,14 +299,89 @@ const char *RAL_STDLIB_FORMS[] = {
     //   (b b1 b2 (.. (a a1 a2 x) ..)).
     "(defmacro! ->>"
     "  (fn* (x & xs)"
-    "     (reduce _iter->> x xs)))", // FORM 26
+    "     (reduce _iter->> x xs)))", // FORM 22
 
     "(def! _iter->>"
     "  (fn* [acc form]"
     "    (if (list? form)"
     "      `(~(first form) ~@(rest form) ~acc)"
-    "      (list form acc))))", // FORM 27
+    "      (list form acc))))", // FORM 23
+
+    // --------------------------------------------------------------------------------
+    // loops
+
+    // (dotimes [i n] body ...) evaluates body with i bound to 0 .. n-1.
+    "(defmacro! dotimes"
+    "  (fn* (binding & body)"
+    "    (let* [n (gensym)]"
+    "      `(let* [~n ~(nth binding 1)]"
+    "         (loop [~(nth binding 0) 0]"
+    "           (when (< ~(nth binding 0) ~n)"
+    "             (do ~@body)"
+    "             (recur (+ ~(nth binding 0) 1))))))))", // FORM 24
+
+    // (doseq [x coll] body ...) evaluates body with x bound to each item of
+    // coll in turn.
+    "(defmacro! doseq"
+    "  (fn* (binding & body)"
+    "    (let* [xs (gensym)"
+    "           n  (gensym)"
+    "           i  (gensym)]"
+    "      `(let* [~xs (seq ~(nth binding 1))"
+    "              ~n  (count ~xs)]"
+    "         (loop [~i 0]"
+    "           (when (< ~i ~n)"
+    "             (let* [~(nth binding 0) (nth ~xs ~i)] (do ~@body))"
+    "             (recur (+ ~i 1))))))))", // FORM 25
+
+    // --------------------------------------------------------------------------------
+    // records
+
+    // (defrecord Point [x y]) defines the record type Point, the positional
+    // constructor ->Point and map->Point to make a Point from a hash-map.
+    "(defmacro! defrecord"
+    "  (fn* (name fields)"
+    "    `(do"
+    "       (def! ~name (record-type ~(str name)"
+    "                     ~(apply vector (map (fn* [f] (keyword (str f))) fields))))"
+    "       (def! ~(symbol (str \"->\" name)) (fn* ~fields (record ~name ~@fields)))"
+    "       (def! ~(symbol (str \"map->\" name)) (fn* [m] (map->record ~name m)))"
+    "       ~name)))", // FORM 26
+
+    // --------------------------------------------------------------------------------
+    // lazy seqs
+
+    // (lazy-seq body ...) returns a lazy seq that evaluates body only when
+    // its items are first needed.
+    "(defmacro! lazy-seq"
+    "  (fn* (& body)"
+    "    `(lazy-seq* (fn* [] (do ~@body)))))", // FORM 27
+
+    // --------------------------------------------------------------------------------
+    // protocols & multimethods
+
+    // (defprotocol Shape (area [s]) (perimeter [s])) defines a protocol method
+    // for each signature and Shape as a map of their keywords to them, which
+    // is what extend takes.
+    "(defmacro! defprotocol"
+    "  (fn* (name & sigs)"
+    "    `(do"
+    "       ~@(map (fn* [sig] (list 'def! (first sig) (list 'protocol-fn (str (first sig)))))"
+    "              sigs)"
+    "       (def! ~name ~(apply hash-map (apply concat (map (fn* [sig] [(keyword (str (first sig))) (first sig)])"
+    "                                                       sigs))))"
+    "       ~name)))", // FORM 28
+
+    // (defmulti name dispatch-fn) defines a multimethod
+    "(defmacro! defmulti"
+    "  (fn* (name dispatch)"
+    "    `(def! ~name (multi-fn ~(str name) ~dispatch))))", // FORM 29
+
+    // (defmethod name dispatch-value [params] body ...) adds a method
+    "(defmacro! defmethod"
+    "  (fn* (name value params & body)"
+    "    `(add-method ~name ~value (fn* ~params (do ~@body)))))", // FORM 30
 
 };
 
-#define NUM_RAL_STDLIB_FORMS 27
\ No newline at end of file
+#define NUM_RAL_STDLIB_FORMS 30
\ No newline at end of file
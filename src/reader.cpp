@@ -85,6 +85,11 @@ RalTypePtr read_form(Reader &r)
     case '[':
     case '{':
         return read_list(r, firstToken[0]);
+    case '#':
+        if (firstToken == "#{") {
+            return read_list(r, '#');
+        }
+        return read_atom(r);
     default:
         return read_atom(r);
     }
@@ -94,15 +99,19 @@ RalTypePtr read_form(Reader &r)
 // read_list will repeatedly call read_form with the Reader object until it
 // encounters a ')' token (if it reach EOF before reading a ')' then that is an
 // error that is thrown). It accumulates the results into a List type.
-// Now also works for the '[]' vector type and '{}' assoc arrays
+// Now also works for the '[]' vector type, '{}' assoc arrays and '#{}' sets
 RalTypePtr read_list(Reader &r, char listStartChar)
 {
     bool listNotMap = listStartChar != '{';
+    bool isSet = listStartChar == '#';
     RalTypePtr mp;
     std::string listEndStr =
         listStartChar == '(' ? ")" : (listStartChar == '[' ? "]" : "}");
-    r.next(); // eat the "(" or "[" or "{" char
-    if (listNotMap) {
+    r.next(); // eat the "(" or "[" or "{" or "#{" token
+    if (isSet) {
+        mp = std::make_shared<RalSet>();
+    }
+    else if (listNotMap) {
         mp = std::make_shared<RalList>(listStartChar);
     }
     else {
@@ -118,7 +127,10 @@ RalTypePtr read_list(Reader &r, char listStartChar)
             break;
         }
         else {
-            if (listNotMap) {
+            if (isSet) {
+                std::static_pointer_cast<RalSet>(mp)->add(read_form(r));
+            }
+            else if (listNotMap) {
                 std::static_pointer_cast<RalList>(mp)->add(read_form(r));
             }
             else {
@@ -159,8 +171,11 @@ RalTypePtr read_atom(Reader &r)
     std::string repr = r.next();
     if (std::regex_match(repr, integer_regex)) {
         DBG << "read_atom: integer >" << repr;
-        RalTypePtr mp = std::make_shared<RalInteger>(repr);
-        return mp;
+        // too many digits for int64_t makes a BIGINT
+        if (repr.size() < 18) {
+            return std::make_shared<RalInteger>(repr);
+        }
+        return makeInteger(RalBig::parse(repr));
     }
     else if (std::regex_match(repr, double_regex)) {
         DBG << "read_atom: double >" << repr;
@@ -261,7 +276,7 @@ RalTypePtr read_atom(Reader &r)
 // ================================================================================
 // tokenize will take a single string and return an array of all the tokens.
 static const std::regex token_regex(
-    R"([\s,]*(~@|[\[\]{}()'`~^@]|\"(?:\\.|[^\\\"])*\"?|;.*|[^\s\[\]{}('\"`,;)]+))");
+    R"([\s,]*(~@|#\{|[\[\]{}()'`~^@]|\"(?:\\.|[^\\\"])*\"?|;.*|[^\s\[\]{}('\"`,;)]+))");
 std::vector<std::string> tokenize(std::string s)
 {
     DBG << "tokenize: >" << s;
@@ -3,8 +3,10 @@
 // Copyright(C) 2020 Roger Allen
 //
 // types.cpp - All of the types handled by ral.
-// INTEGER, CONSTANT, SYMBOL, STRING, KEYWORD,
-// LIST, MAP, FUNCTION, LAMBDA, ATOM.
+// INTEGER, BIGINT, CONSTANT, SYMBOL, STRING, KEYWORD,
+// LIST, MAP, FUNCTION, LAMBDA, ATOM, TRANSIENT, SET, SORTED_MAP,
+// RECORD_TYPE, RECORD, LAZY_SEQ, TRANSDUCER, F64_ARRAY, I64_ARRAY, MATRIX,
+// RNG.
 //
 // ======================================================================
 // This program is free software : you can redistribute it and/or modify
@@ -24,6 +26,7 @@
 #include "easylogging++.h"
 #include "env.h"
 #include "logging.h"
+#include <algorithm>
 #include <cmath>
 // of course windows does not define PI or E
 #ifndef M_PI
@@ -52,6 +55,34 @@ RalTypePtr RalType::apply(RalTypeIter begin, RalTypeIter end)
     throw RalNotApplicable();
 }
 
+// ================================================================================
+// hash is used by the std::unordered containers (e.g. RalSet).  Values that are
+// equal() must hash the same, so value types override this.  Everything else
+// (functions, atoms, ...) only equals itself, so hash the identity.
+size_t RalType::hash() { return std::hash<RalType *>()(this); }
+
+size_t hashCombine(size_t seed, size_t h)
+{
+    return seed ^ (h + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+bool RalTypeEqual::operator()(const RalTypePtr &a, const RalTypePtr &b) const
+{
+    if (a == b) {
+        return true;
+    }
+    if (a->kind() == b->kind()) {
+        return a->equal(b);
+    }
+    if (a->kind() == RalKind::LAZY_SEQ) {
+        return a->equal(b);
+    }
+    if (b->kind() == RalKind::LAZY_SEQ) {
+        return b->equal(a);
+    }
+    return false;
+}
+
 // ================================================================================
 // when using RalType for arithmetic, use this function to get the value.
 // Only Integer (oops, and Constant) will override this an implement it.
@@ -84,22 +115,21 @@ bool RalType::isVector() { return false; }
 bool RalType::isEmptyList() { return false; }
 // ???FIXME??? throw Error? -- only when static analysis cannot confirm no
 // issue.
-RalTypePtr RalType::apply() { return nullptr; }
 void RalType::setEnv(RalEnvPtr env) { throw RalBadSetEnv(); }
 bool RalType::is_macro_call(RalEnvPtr env) { return false; }
 
 // ================================================================================
-RalInteger::RalInteger(const std::string &s) : repr_(s), value_(std::stoi(s))
+RalInteger::RalInteger(const std::string &s) : value_(std::stoll(s))
 {
     DBG2 << "***Construct: str " << value_ << " " << this;
 }
 
-RalInteger::RalInteger(int64_t i) : repr_(std::to_string(i)), value_(i)
+RalInteger::RalInteger(int64_t i) : value_(i)
 {
     DBG2 << "***Construct: int " << value_ << " " << this;
 }
 
-RalInteger::RalInteger(RalInteger *that) : repr_(that->repr_), value_(that->value_)
+RalInteger::RalInteger(RalInteger *that) : value_(that->value_)
 {
     DBG2 << "***Construct: copy* " << value_ << " " << this;
 }
@@ -116,10 +146,47 @@ bool RalInteger::equal(RalTypePtr that)
     return value_ == b->asInt();
 }
 
+size_t RalInteger::hash() { return std::hash<int64_t>()(value_); }
+
 int64_t RalInteger::asInt() { return value_; }
 
 double RalInteger::asDouble() { return (double)value_; }
 
+// ================================================================================
+RalBigInt::RalBigInt(const RalBig &value) : value_(value) {}
+
+RalBigInt::~RalBigInt() {}
+
+std::string RalBigInt::str(bool readable) { return value_.str(); }
+
+RalTypePtr RalBigInt::eval(RalEnvPtr env) { return shared_from_this(); }
+
+bool RalBigInt::equal(RalTypePtr that)
+{
+    auto b = std::static_pointer_cast<RalBigInt>(that);
+    return compare(value_, b->value_) == 0;
+}
+
+size_t RalBigInt::hash() { return value_.hash(); }
+
+double RalBigInt::asDouble() { return value_.toDouble(); }
+
+RalTypePtr makeInteger(const RalBig &value)
+{
+    if (value.fitsInt64()) {
+        return std::make_shared<RalInteger>(value.toInt64());
+    }
+    return std::make_shared<RalBigInt>(value);
+}
+
+RalBig bigValue(const RalTypePtr &mp)
+{
+    if (mp->kind() == RalKind::BIGINT) {
+        return std::static_pointer_cast<RalBigInt>(mp)->value();
+    }
+    return RalBig(mp->asInt());
+}
+
 // ================================================================================
 inline const double valueHelper(const std::string &s)
 {
@@ -161,6 +228,8 @@ bool RalDouble::equal(RalTypePtr that)
     return value_ == b->asDouble();
 }
 
+size_t RalDouble::hash() { return std::hash<double>()(value_); }
+
 double RalDouble::asDouble() { return value_; }
 
 // ================================================================================
@@ -180,6 +249,11 @@ bool RalConstant::equal(RalTypePtr that)
     return repr_ == b->str(false);
 }
 
+size_t RalConstant::hash()
+{
+    return hashCombine((size_t)kind(), std::hash<std::string>()(repr_));
+}
+
 int64_t RalConstant::asInt()
 {
     return (repr_ == "true") ? 1 : 0;
@@ -196,7 +270,7 @@ bool RalConstant::isNilOrFalse()
 }
 
 // ================================================================================
-RalSymbol::RalSymbol(const std::string &s) : repr_(s) { }
+RalSymbol::RalSymbol(const std::string &s) : repr_(s), cachedPrim_(-1) {}
 
 RalSymbol::~RalSymbol() {}
 
@@ -212,6 +286,11 @@ bool RalSymbol::equal(RalTypePtr that)
     return repr_ == b->str(false);
 }
 
+size_t RalSymbol::hash()
+{
+    return hashCombine((size_t)kind(), std::hash<std::string>()(repr_));
+}
+
 // ================================================================================
 // String helpers
 void replaceAll(std::string &str, const std::string &from,
@@ -302,12 +381,23 @@ bool RalString::equal(RalTypePtr that)
     return repr_ == b->str(false);
 }
 
+size_t RalString::hash()
+{
+    return hashCombine((size_t)kind(), std::hash<std::string>()(repr_));
+}
+
 std::string RalString::asMapKey() { return str(false); }
 
 // ================================================================================
-RalKeyword::RalKeyword(const std::string &s) : repr_(s) { }
+RalKeyword::RalKeyword(const std::string &s)
+    : repr_(s), cachedShapeId_(0), cachedSlot_(0)
+{
+}
 
-RalKeyword::RalKeyword(RalKeyword *that) : repr_(that->repr_) { }
+RalKeyword::RalKeyword(RalKeyword *that)
+    : repr_(that->repr_), cachedShapeId_(0), cachedSlot_(0)
+{
+}
 
 RalKeyword::~RalKeyword() {}
 
@@ -321,6 +411,11 @@ bool RalKeyword::equal(RalTypePtr that)
     return repr_ == b->str(false);
 }
 
+size_t RalKeyword::hash()
+{
+    return hashCombine((size_t)kind(), std::hash<std::string>()(repr_));
+}
+
 std::string RalKeyword::asMapKey() { return char(255) + str(true); }
 
 // ================================================================================
@@ -330,6 +425,13 @@ RalList::RalList(char listStartChar)
     meta_ = std::make_shared<RalConstant>("nil");
 }
 
+RalList::RalList(char listStartChar, std::vector<RalTypePtr> values)
+    : values_(std::move(values))
+{
+    listStartChar_ = listStartChar;
+    meta_ = std::make_shared<RalConstant>("nil");
+}
+
 RalList::RalList(std::shared_ptr<RalList> that)
 {
     values_ = that->values_;
@@ -381,17 +483,13 @@ RalTypePtr RalList::eval(RalEnvPtr env)
 {
     // Evaluate all items in the list
     std::vector<RalTypePtr> evaluated;
+    evaluated.reserve(values_.size());
     for (auto &v : values_) {
         // NOTE EVAL, not v->eval().  This allows for apply()
         evaluated.push_back(EVAL(v, env));
     }
     // return new evaluated list
-    auto iter = evaluated.begin();
-    RalTypePtr mp = std::make_shared<RalList>(RalList(listStartChar_));
-    for (; iter != evaluated.end(); iter++) {
-        std::static_pointer_cast<RalList>(mp)->add(*iter);
-    }
-    return mp;
+    return std::make_shared<RalList>(listStartChar_, std::move(evaluated));
 }
 
 RalTypePtr RalList::get(size_t i)
@@ -427,18 +525,36 @@ bool RalList::equal(RalTypePtr that)
     return result;
 }
 
-// tried to move apply fully into main, but iterators made that troublesome.
-RalTypePtr RalList::apply()
+// lists & vectors with the same items are equal, so only hash the items
+size_t RalList::hash()
 {
-    // apply the first value as a function
-    auto iter = values_.begin();
-    auto fn = *iter++;
-    auto val = fn->apply(iter, values_.end());
-    return val;
+    size_t h = (size_t)RalKind::LIST;
+    for (auto &v : values_) {
+        h = hashCombine(h, v->hash());
+    }
+    return h;
 }
 
+
 void RalList::add(RalTypePtr mp) { values_.push_back(mp); }
 
+// builders that know their final size can avoid regrowing values_
+void RalList::reserve(size_t n) { values_.reserve(n); }
+
+// set an existing item or append when i is one past the end
+void RalList::set(size_t i, RalTypePtr mp)
+{
+    if (i < values_.size()) {
+        values_[i] = mp;
+    }
+    else if (i == values_.size()) {
+        values_.push_back(mp);
+    }
+    else {
+        throw RalIndexOutOfRange();
+    }
+}
+
 RalTypePtr RalList::count()
 {
     size_t n = values_.size();
@@ -570,6 +686,16 @@ bool RalMap::equal(RalTypePtr that)
     return result;
 }
 
+size_t RalMap::hash()
+{
+    size_t h = (size_t)RalKind::MAP;
+    for (auto &v : values_) {
+        h = hashCombine(h, std::hash<std::string>()(v.first));
+        h = hashCombine(h, v.second->hash());
+    }
+    return h;
+}
+
 void RalMap::add(std::string k, RalTypePtr v) { values_[k] = v; }
 
 RalTypePtr RalMap::get(RalTypePtr k)
@@ -627,129 +753,1931 @@ RalTypePtr RalMap::getVals()
     return mp;
 }
 
+size_t RalMap::size() { return values_.size(); }
+
 RalTypePtr RalMap::getMeta() { return meta_; }
 
 void RalMap::setMeta(RalTypePtr meta) { meta_ = meta; }
 
 // ================================================================================
-RalFunction::RalFunction()
+RalSet::RalSet() { meta_ = std::make_shared<RalConstant>("nil"); }
+
+RalSet::RalSet(std::shared_ptr<RalSet> that)
 {
-    name_ = "#<function>:null";
-    fn_ = nullptr;
-    meta_ = std::make_shared<RalConstant>("nil");
+    values_ = that->values_;
+    meta_ = that->meta_;
 }
 
-RalFunction::RalFunction(std::shared_ptr<RalFunction> that)
+RalSet::~RalSet() {}
+
+std::string RalSet::str(bool readable)
 {
-    name_ = that->name_;
-    fn_ = that->fn_;
-    meta_ = that->meta_;
+    std::string s = "#{";
+    bool afterFirst = false;
+    for (const auto &v : values_) {
+        if (afterFirst) {
+            s += " ";
+        }
+        s += v->str(readable);
+        afterFirst = true;
+    }
+    s += "}";
+    return s;
 }
 
-RalFunction::RalFunction(const std::string &name, RalFunctionSignature fn)
+RalTypePtr RalSet::eval(RalEnvPtr env)
 {
-    name_ = "#<function>:" + name;
-    fn_ = fn;
-    meta_ = std::make_shared<RalConstant>("nil");
+    auto mp = std::make_shared<RalSet>();
+    for (auto &v : values_) {
+        // note EVAL (allows for apply())
+        mp->add(EVAL(v, env));
+    }
+    return mp;
 }
 
-RalFunction::~RalFunction() {}
+bool RalSet::equal(RalTypePtr that)
+{
+    auto b = std::static_pointer_cast<RalSet>(that);
+    if (values_.size() != b->values_.size()) {
+        return false;
+    }
+    for (auto &v : values_) {
+        if (!b->contains(v)) {
+            return false;
+        }
+    }
+    return true;
+}
 
-std::string RalFunction::str(bool readable) { return name_; }
+// must not depend on the iteration order, so just add up the item hashes
+size_t RalSet::hash()
+{
+    size_t h = (size_t)RalKind::SET;
+    for (auto &v : values_) {
+        h += v->hash();
+    }
+    return h;
+}
 
-RalTypePtr RalFunction::eval(RalEnvPtr env) { return nullptr; /*FIXME*/ }
+void RalSet::add(RalTypePtr mp) { values_.insert(mp); }
 
-bool RalFunction::equal(RalTypePtr that)
+void RalSet::remove(RalTypePtr mp) { values_.erase(mp); }
+
+bool RalSet::contains(RalTypePtr mp) { return values_.count(mp) > 0; }
+
+// returns the item in the set that is equal to mp, or nil
+RalTypePtr RalSet::get(RalTypePtr mp)
 {
-    auto b = std::static_pointer_cast<RalFunction>(that);
-    return name_ == b->str(false);
+    auto pos = values_.find(mp);
+    if (pos == values_.end()) {
+        return std::make_shared<RalConstant>("nil");
+    }
+    return *pos;
 }
 
-RalTypePtr RalFunction::apply(RalTypeIter begin, RalTypeIter end)
+size_t RalSet::size() { return values_.size(); }
+
+RalTypePtr RalSet::getItems()
 {
-    return (fn_)(begin, end);
+    auto mp = std::make_shared<RalList>('(');
+    mp->reserve(values_.size());
+    for (const auto &v : values_) {
+        mp->add(v);
+    }
+    return mp;
 }
 
-RalTypePtr RalFunction::getMeta() { return meta_; }
+RalTypePtr RalSet::getMeta() { return meta_; }
 
-void RalFunction::setMeta(RalTypePtr meta) { meta_ = meta; }
+void RalSet::setMeta(RalTypePtr meta) { meta_ = meta; }
 
-// ================================================================================
-RalLambda::RalLambda(std::vector<RalTypePtr> binds, RalTypePtr &form,
-                     RalEnvPtr env)
+void RalSet::unionWith(std::shared_ptr<RalSet> that)
 {
-    binds_ = binds;
-    form_ = form;
-    env_ = env;
-    is_macro_ = false;
-    meta_ = std::make_shared<RalConstant>("nil");
+    values_.insert(that->values_.begin(), that->values_.end());
 }
 
-RalLambda::RalLambda(RalLambda *that)
+void RalSet::intersectWith(std::shared_ptr<RalSet> that)
 {
-    binds_ = that->binds_;
-    form_ = that->form_;
-    env_ = that->env_;
-    is_macro_ = that->is_macro_;
-    meta_ = that->meta_;
+    for (auto iter = values_.begin(); iter != values_.end();) {
+        if (that->values_.count(*iter) == 0) {
+            iter = values_.erase(iter);
+        }
+        else {
+            iter++;
+        }
+    }
 }
 
-RalLambda::RalLambda(std::shared_ptr<RalLambda> that)
+void RalSet::differenceWith(std::shared_ptr<RalSet> that)
 {
-    binds_ = that->binds_;
-    form_ = that->form_;
-    env_ = that->env_;
-    is_macro_ = that->is_macro_;
-    meta_ = that->meta_;
+    // walk whichever table is smaller
+    if (that->values_.size() < values_.size()) {
+        for (auto &v : that->values_) {
+            values_.erase(v);
+        }
+    }
+    else {
+        for (auto iter = values_.begin(); iter != values_.end();) {
+            if (that->values_.count(*iter) > 0) {
+                iter = values_.erase(iter);
+            }
+            else {
+                iter++;
+            }
+        }
+    }
 }
 
-RalLambda::~RalLambda() {}
+// ================================================================================
+// true for the nil constant
+bool isNil(const RalTypePtr &mp)
+{
+    return (mp->kind() == RalKind::CONSTANT) && (mp->str(true) == "nil");
+}
 
-std::string RalLambda::str(bool readable) { return "#<function>"; }
+// natural ordering for compare & sorted collections
+static bool isNumber(const RalTypePtr &mp)
+{
+    return isInteger(mp->kind()) || (mp->kind() == RalKind::DOUBLE);
+}
 
-RalTypePtr RalLambda::eval(RalEnvPtr env) { return nullptr; /*FIXME*/ }
+int ralCompare(RalTypePtr a, RalTypePtr b)
+{
+    if (isNil(a) || isNil(b)) {
+        return (isNil(a) ? 0 : 1) - (isNil(b) ? 0 : 1);
+    }
+    if (isNumber(a) && isNumber(b)) {
+        if ((a->kind() == RalKind::INTEGER) && (b->kind() == RalKind::INTEGER)) {
+            auto ai = a->asInt();
+            auto bi = b->asInt();
+            return (ai < bi) ? -1 : ((ai > bi) ? 1 : 0);
+        }
+        if (isInteger(a->kind()) && isInteger(b->kind())) {
+            return compare(bigValue(a), bigValue(b));
+        }
+        auto ad = a->asDouble();
+        auto bd = b->asDouble();
+        return (ad < bd) ? -1 : ((ad > bd) ? 1 : 0);
+    }
+    if (a->kind() == b->kind()) {
+        switch (a->kind()) {
+        case RalKind::STRING:
+        case RalKind::KEYWORD:
+        case RalKind::SYMBOL:
+            return a->str(false).compare(b->str(false));
+        case RalKind::CONSTANT: // only true & false are left
+            return (int)(a->asInt() - b->asInt());
+        case RalKind::LIST: {
+            // shorter sequences sort first, then compare item by item
+            auto al = std::static_pointer_cast<RalList>(a);
+            auto bl = std::static_pointer_cast<RalList>(b);
+            if (al->size() != bl->size()) {
+                return (al->size() < bl->size()) ? -1 : 1;
+            }
+            for (size_t i = 0; i < al->size(); i++) {
+                int c = ralCompare(al->get(i), bl->get(i));
+                if (c != 0) {
+                    return c;
+                }
+            }
+            return 0;
+        }
+        default:
+            break;
+        }
+    }
+    throw RalException("cannot compare " + a->str(true) + " and " +
+                       b->str(true));
+}
 
-bool RalLambda::equal(RalTypePtr that)
+int RalComparator::compare(const RalTypePtr &a, const RalTypePtr &b) const
 {
-    auto b = std::static_pointer_cast<RalLambda>(that);
-    return false; // FIXME?
+    if (fn_ == nullptr) {
+        return ralCompare(a, b);
+    }
+    RalTypePtr args[2] = {a, b};
+    auto result = invoke(fn_, args, args + 2);
+    if (isNumber(result)) {
+        auto d = result->asDouble();
+        return (d < 0) ? -1 : ((d > 0) ? 1 : 0);
+    }
+    // a boolean comparator answers "is a less than b?"
+    if (!result->isNilOrFalse()) {
+        return -1;
+    }
+    RalTypePtr swapped[2] = {b, a};
+    result = invoke(fn_, swapped, swapped + 2);
+    return result->isNilOrFalse() ? 0 : 1;
 }
 
-RalTypePtr RalLambda::apply(RalTypeIter begin, RalTypeIter end)
+// ================================================================================
+// persistent AVL tree helpers.  Every change builds new nodes along the path
+// to the change and shares everything else.
+static int nodeHeight(const RalSortedNodePtr &n) { return n ? n->height_ : 0; }
+
+static RalSortedNodePtr makeNode(const RalTypePtr &k, const RalTypePtr &v,
+                                 const RalSortedNodePtr &l,
+                                 const RalSortedNodePtr &r)
+{
+    auto n = std::make_shared<RalSortedNode>();
+    n->key_ = k;
+    n->val_ = v;
+    n->left_ = l;
+    n->right_ = r;
+    n->height_ = 1 + std::max(nodeHeight(l), nodeHeight(r));
+    return n;
+}
+
+static RalSortedNodePtr balanceNode(const RalTypePtr &k, const RalTypePtr &v,
+                                    const RalSortedNodePtr &l,
+                                    const RalSortedNodePtr &r)
 {
-    RalEnvPtr lambda_env = makeEnv(begin, end);
-    return EVAL(form_, lambda_env);
+    int hl = nodeHeight(l);
+    int hr = nodeHeight(r);
+    if (hl > hr + 1) {
+        if (nodeHeight(l->left_) >= nodeHeight(l->right_)) {
+            return makeNode(l->key_, l->val_, l->left_,
+                            makeNode(k, v, l->right_, r));
+        }
+        auto lr = l->right_;
+        return makeNode(lr->key_, lr->val_,
+                        makeNode(l->key_, l->val_, l->left_, lr->left_),
+                        makeNode(k, v, lr->right_, r));
+    }
+    if (hr > hl + 1) {
+        if (nodeHeight(r->right_) >= nodeHeight(r->left_)) {
+            return makeNode(r->key_, r->val_, makeNode(k, v, l, r->left_),
+                            r->right_);
+        }
+        auto rl = r->left_;
+        return makeNode(rl->key_, rl->val_, makeNode(k, v, l, rl->left_),
+                        makeNode(r->key_, r->val_, rl->right_, r->right_));
+    }
+    return makeNode(k, v, l, r);
 }
 
-RalEnvPtr RalLambda::makeEnv(RalTypeIter begin, RalTypeIter end)
+static RalSortedNodePtr insertNode(const RalSortedNodePtr &n,
+                                   const RalTypePtr &k, const RalTypePtr &v,
+                                   const RalComparator &cmp, bool &added)
 {
-    std::vector<RalTypePtr> exprs;
-    for (auto iter = begin; iter != end; iter++) {
-        exprs.push_back(*iter);
+    if (!n) {
+        added = true;
+        return makeNode(k, v, nullptr, nullptr);
+    }
+    int c = cmp.compare(k, n->key_);
+    if (c < 0) {
+        return balanceNode(n->key_, n->val_,
+                           insertNode(n->left_, k, v, cmp, added), n->right_);
     }
-    RalEnvPtr lambda_env = std::make_shared<RalEnv>(env_, binds_, exprs);
-    return lambda_env;
+    else if (c > 0) {
+        return balanceNode(n->key_, n->val_, n->left_,
+                           insertNode(n->right_, k, v, cmp, added));
+    }
+    return makeNode(n->key_, v, n->left_, n->right_);
 }
 
-RalTypePtr RalLambda::getMeta() { return meta_; }
+static RalSortedNodePtr removeMinNode(const RalSortedNodePtr &n)
+{
+    if (!n->left_) {
+        return n->right_;
+    }
+    return balanceNode(n->key_, n->val_, removeMinNode(n->left_), n->right_);
+}
 
-void RalLambda::setMeta(RalTypePtr meta) { meta_ = meta; }
+static RalSortedNodePtr removeNode(const RalSortedNodePtr &n,
+                                   const RalTypePtr &k,
+                                   const RalComparator &cmp, bool &removed)
+{
+    if (!n) {
+        return n;
+    }
+    int c = cmp.compare(k, n->key_);
+    if (c < 0) {
+        auto l = removeNode(n->left_, k, cmp, removed);
+        return removed ? balanceNode(n->key_, n->val_, l, n->right_) : n;
+    }
+    else if (c > 0) {
+        auto r = removeNode(n->right_, k, cmp, removed);
+        return removed ? balanceNode(n->key_, n->val_, n->left_, r) : n;
+    }
+    removed = true;
+    if (!n->left_) {
+        return n->right_;
+    }
+    if (!n->right_) {
+        return n->left_;
+    }
+    auto m = n->right_;
+    while (m->left_) {
+        m = m->left_;
+    }
+    return balanceNode(m->key_, m->val_, n->left_, removeMinNode(n->right_));
+}
 
 // ================================================================================
-RalAtom::RalAtom(RalTypePtr that) : value_(that) { }
-RalAtom::~RalAtom() {}
-std::string RalAtom::str(bool readable)
+RalSortedMap::RalSortedMap(RalTypePtr cmpFn) : size_(0)
 {
-    return "(atom " + value_->str(true) + ")";
+    cmp_.fn_ = cmpFn;
+    meta_ = std::make_shared<RalConstant>("nil");
 }
-RalTypePtr RalAtom::eval(RalEnvPtr env) { return nullptr; /*FIXME*/ }
-bool RalAtom::equal(RalTypePtr that)
+
+RalSortedMap::RalSortedMap(std::shared_ptr<RalSortedMap> that)
 {
-    return false; // FIXME
+    root_ = that->root_;
+    size_ = that->size_;
+    cmp_ = that->cmp_;
+    meta_ = that->meta_;
 }
-RalTypePtr RalAtom::value() { return value_; }
-RalTypePtr RalAtom::set(RalTypePtr that)
+
+RalSortedMap::~RalSortedMap() {}
+
+std::string RalSortedMap::str(bool readable)
 {
-    value_ = that;
-    return value_;
-}
\ No newline at end of file
+    std::string s = "{";
+    auto entries = std::static_pointer_cast<RalList>(getEntries());
+    for (size_t i = 0; i < entries->size(); i++) {
+        auto entry = std::static_pointer_cast<RalList>(entries->get(i));
+        if (i > 0) {
+            s += " ";
+        }
+        s += entry->get(0)->str(readable) + " " + entry->get(1)->str(readable);
+    }
+    s += "}";
+    return s;
+}
+
+// there is no reader syntax for sorted maps, so they only exist as values
+RalTypePtr RalSortedMap::eval(RalEnvPtr env) { return shared_from_this(); }
+
+bool RalSortedMap::equal(RalTypePtr that)
+{
+    auto b = std::static_pointer_cast<RalSortedMap>(that);
+    if (size_ != b->size_) {
+        return false;
+    }
+    auto ae = std::static_pointer_cast<RalList>(getEntries());
+    auto be = std::static_pointer_cast<RalList>(b->getEntries());
+    RalTypeEqual eq;
+    for (size_t i = 0; i < ae->size(); i++) {
+        if (!eq(ae->get(i), be->get(i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t RalSortedMap::hash() { return hashCombine(size_, getEntries()->hash()); }
+
+RalSortedNodePtr RalSortedMap::find(const RalTypePtr &k)
+{
+    auto n = root_;
+    while (n) {
+        int c = cmp_.compare(k, n->key_);
+        if (c == 0) {
+            break;
+        }
+        n = (c < 0) ? n->left_ : n->right_;
+    }
+    return n;
+}
+
+void RalSortedMap::add(RalTypePtr k, RalTypePtr v)
+{
+    bool added = false;
+    root_ = insertNode(root_, k, v, cmp_, added);
+    if (added) {
+        size_++;
+    }
+}
+
+void RalSortedMap::remove(RalTypePtr k)
+{
+    bool removed = false;
+    root_ = removeNode(root_, k, cmp_, removed);
+    if (removed) {
+        size_--;
+    }
+}
+
+RalTypePtr RalSortedMap::get(RalTypePtr k)
+{
+    auto n = find(k);
+    if (!n) {
+        return std::make_shared<RalConstant>("nil");
+    }
+    return n->val_;
+}
+
+bool RalSortedMap::hasKey(RalTypePtr k) { return find(k) != nullptr; }
+
+size_t RalSortedMap::size() { return size_; }
+
+RalTypePtr RalSortedMap::getKeys()
+{
+    auto mp = std::make_shared<RalList>('(');
+    auto entries = std::static_pointer_cast<RalList>(getEntries());
+    for (size_t i = 0; i < entries->size(); i++) {
+        mp->add(std::static_pointer_cast<RalList>(entries->get(i))->get(0));
+    }
+    return mp;
+}
+
+RalTypePtr RalSortedMap::getVals()
+{
+    auto mp = std::make_shared<RalList>('(');
+    auto entries = std::static_pointer_cast<RalList>(getEntries());
+    for (size_t i = 0; i < entries->size(); i++) {
+        mp->add(std::static_pointer_cast<RalList>(entries->get(i))->get(1));
+    }
+    return mp;
+}
+
+RalTypePtr RalSortedMap::getEntries()
+{
+    return range(nullptr, true, nullptr, true, false);
+}
+
+RalTypePtr RalSortedMap::firstKey()
+{
+    auto n = root_;
+    while (n && n->left_) {
+        n = n->left_;
+    }
+    return n ? n->key_ : std::make_shared<RalConstant>("nil");
+}
+
+RalTypePtr RalSortedMap::lastKey()
+{
+    auto n = root_;
+    while (n && n->right_) {
+        n = n->right_;
+    }
+    return n ? n->key_ : std::make_shared<RalConstant>("nil");
+}
+
+// walk the tree in order (or reverse order) starting at the first key inside
+// the bounds, so only O(log n) nodes outside the range are visited.
+RalTypePtr RalSortedMap::range(RalTypePtr lo, bool loInclusive, RalTypePtr hi,
+                               bool hiInclusive, bool reverse)
+{
+    auto mp = std::make_shared<RalList>('(');
+    // start & stop are the bounds in the direction of travel
+    auto start = reverse ? hi : lo;
+    auto stop = reverse ? lo : hi;
+    bool startInclusive = reverse ? hiInclusive : loInclusive;
+    bool stopInclusive = reverse ? loInclusive : hiInclusive;
+    int dir = reverse ? -1 : 1;
+    std::vector<RalSortedNodePtr> stack;
+    auto n = root_;
+    while (n) {
+        int c = (start == nullptr) ? 1 : dir * cmp_.compare(n->key_, start);
+        if ((c > 0) || ((c == 0) && startInclusive)) {
+            stack.push_back(n);
+            n = reverse ? n->right_ : n->left_;
+        }
+        else {
+            n = reverse ? n->left_ : n->right_;
+        }
+    }
+    while (!stack.empty()) {
+        n = stack.back();
+        stack.pop_back();
+        if (stop != nullptr) {
+            int c = dir * cmp_.compare(n->key_, stop);
+            if ((c > 0) || ((c == 0) && !stopInclusive)) {
+                break;
+            }
+        }
+        auto entry = std::make_shared<RalList>('[');
+        entry->add(n->key_);
+        entry->add(n->val_);
+        mp->add(entry);
+        n = reverse ? n->left_ : n->right_;
+        while (n) {
+            stack.push_back(n);
+            n = reverse ? n->right_ : n->left_;
+        }
+    }
+    return mp;
+}
+
+RalTypePtr RalSortedMap::getMeta() { return meta_; }
+
+void RalSortedMap::setMeta(RalTypePtr meta) { meta_ = meta; }
+
+// ================================================================================
+static uint64_t gNextRecordTypeId = 1; // 0 is never a valid id
+
+RalRecordType::RalRecordType(const std::string &name,
+                             std::vector<RalTypePtr> fields)
+    : name_(name), fields_(fields), id_(gNextRecordTypeId++)
+{
+    for (size_t i = 0; i < fields_.size(); i++) {
+        index_[fields_[i]->str(false)] = i;
+    }
+}
+
+RalRecordType::~RalRecordType() {}
+
+std::string RalRecordType::str(bool readable) { return name_; }
+
+RalTypePtr RalRecordType::eval(RalEnvPtr env) { return shared_from_this(); }
+
+bool RalRecordType::equal(RalTypePtr that) { return this == that.get(); }
+
+bool RalRecordType::slot(RalTypePtr k, size_t &slot)
+{
+    if (k->kind() != RalKind::KEYWORD) {
+        return false;
+    }
+    auto kp = std::static_pointer_cast<RalKeyword>(k);
+    if (kp->cachedShapeId_ == id_) {
+        slot = kp->cachedSlot_;
+        return true;
+    }
+    auto pos = index_.find(kp->str(false));
+    if (pos == index_.end()) {
+        return false;
+    }
+    kp->cachedShapeId_ = id_;
+    kp->cachedSlot_ = pos->second;
+    slot = pos->second;
+    return true;
+}
+
+// ================================================================================
+RalRecord::RalRecord(std::shared_ptr<RalRecordType> type,
+                     std::vector<RalTypePtr> slots)
+    : type_(type), slots_(slots), ext_(nullptr)
+{
+    meta_ = std::make_shared<RalConstant>("nil");
+}
+
+RalRecord::RalRecord(std::shared_ptr<RalRecord> that)
+{
+    type_ = that->type_;
+    slots_ = that->slots_;
+    ext_ = that->ext_;
+    meta_ = that->meta_;
+}
+
+RalRecord::~RalRecord() {}
+
+std::string RalRecord::str(bool readable)
+{
+    std::string s = "#" + type_->name() + "{";
+    for (size_t i = 0; i < slots_.size(); i++) {
+        if (i > 0) {
+            s += " ";
+        }
+        s += type_->field(i)->str(readable) + " " + slots_[i]->str(readable);
+    }
+    if (ext_ != nullptr) {
+        // reuse the map printing, without its braces
+        auto ext = ext_->str(readable);
+        if (ext.size() > 2) {
+            s += (slots_.size() > 0 ? " " : "") + ext.substr(1, ext.size() - 2);
+        }
+    }
+    s += "}";
+    return s;
+}
+
+// records are only made by functions, so they are already evaluated
+RalTypePtr RalRecord::eval(RalEnvPtr env) { return shared_from_this(); }
+
+bool RalRecord::equal(RalTypePtr that)
+{
+    auto b = std::static_pointer_cast<RalRecord>(that);
+    if (type_ != b->type_) {
+        return false;
+    }
+    RalTypeEqual eq;
+    for (size_t i = 0; i < slots_.size(); i++) {
+        if (!eq(slots_[i], b->slots_[i])) {
+            return false;
+        }
+    }
+    if ((ext_ == nullptr) || (b->ext_ == nullptr)) {
+        return size() == b->size();
+    }
+    return ext_->equal(b->ext_);
+}
+
+size_t RalRecord::hash()
+{
+    size_t h = std::hash<std::string>()(type_->name());
+    for (auto &v : slots_) {
+        h = hashCombine(h, v->hash());
+    }
+    if (ext_ != nullptr) {
+        h = hashCombine(h, ext_->hash());
+    }
+    return h;
+}
+
+RalTypePtr RalRecord::get(RalTypePtr k)
+{
+    size_t i;
+    if (type_->slot(k, i)) {
+        return slots_[i];
+    }
+    if (ext_ != nullptr) {
+        return ext_->get(k);
+    }
+    return std::make_shared<RalConstant>("nil");
+}
+
+bool RalRecord::hasKey(RalTypePtr k)
+{
+    size_t i;
+    if (type_->slot(k, i)) {
+        return true;
+    }
+    return (ext_ != nullptr) && ext_->hasKey(k);
+}
+
+RalTypePtr RalRecord::assoc(RalTypePtr k, RalTypePtr v)
+{
+    auto mp = std::make_shared<RalRecord>(
+        std::static_pointer_cast<RalRecord>(shared_from_this()));
+    size_t i;
+    if (type_->slot(k, i)) {
+        mp->slots_[i] = v;
+    }
+    else {
+        mp->ext_ = (ext_ == nullptr) ? std::make_shared<RalMap>()
+                                     : std::make_shared<RalMap>(ext_);
+        mp->ext_->add(k->asMapKey(), v);
+    }
+    return mp;
+}
+
+RalTypePtr RalRecord::dissoc(RalTypePtr k)
+{
+    size_t i;
+    if (type_->slot(k, i)) {
+        // without all of its fields this is no longer a record
+        auto mp = std::make_shared<RalMap>();
+        for (size_t j = 0; j < slots_.size(); j++) {
+            if (j != i) {
+                mp->add(type_->field(j)->asMapKey(), slots_[j]);
+            }
+        }
+        if (ext_ != nullptr) {
+            auto keys = std::static_pointer_cast<RalList>(ext_->getKeys());
+            for (size_t j = 0; j < keys->size(); j++) {
+                mp->add(keys->get(j)->asMapKey(), ext_->get(keys->get(j)));
+            }
+        }
+        return mp;
+    }
+    auto mp = std::make_shared<RalRecord>(
+        std::static_pointer_cast<RalRecord>(shared_from_this()));
+    if ((ext_ != nullptr) && ext_->hasKey(k)) {
+        mp->ext_ = std::make_shared<RalMap>(ext_);
+        mp->ext_->remove(k);
+        // so it equals & hashes like a record that never had extra keys
+        if (mp->ext_->size() == 0) {
+            mp->ext_ = nullptr;
+        }
+    }
+    return mp;
+}
+
+size_t RalRecord::size()
+{
+    return slots_.size() + ((ext_ != nullptr) ? ext_->size() : 0);
+}
+
+RalTypePtr RalRecord::getKeys()
+{
+    auto mp = std::make_shared<RalList>('(');
+    for (size_t i = 0; i < slots_.size(); i++) {
+        mp->add(type_->field(i));
+    }
+    if (ext_ != nullptr) {
+        auto keys = std::static_pointer_cast<RalList>(ext_->getKeys());
+        for (size_t i = 0; i < keys->size(); i++) {
+            mp->add(keys->get(i));
+        }
+    }
+    return mp;
+}
+
+RalTypePtr RalRecord::getVals()
+{
+    auto mp = std::make_shared<RalList>('(');
+    for (auto &v : slots_) {
+        mp->add(v);
+    }
+    if (ext_ != nullptr) {
+        auto vals = std::static_pointer_cast<RalList>(ext_->getVals());
+        for (size_t i = 0; i < vals->size(); i++) {
+            mp->add(vals->get(i));
+        }
+    }
+    return mp;
+}
+
+RalTypePtr RalRecord::getMeta() { return meta_; }
+
+void RalRecord::setMeta(RalTypePtr meta) { meta_ = meta; }
+
+// ================================================================================
+RalArray::RalArray(Elem elem, size_t n) : elem_(elem), size_(n)
+{
+    if (elem_ == F64) {
+        auto buffer = std::make_shared<RalF64Buffer>(n, 0.0);
+        data_ = buffer->data();
+        owner_ = buffer;
+    }
+    else {
+        auto buffer = std::make_shared<RalI64Buffer>(n, 0);
+        data_ = buffer->data();
+        owner_ = buffer;
+    }
+}
+
+RalArray::RalArray(Elem elem, std::shared_ptr<RalArray> that)
+    : RalArray(elem, that->size_)
+{
+    if ((elem_ == F64) && (that->elem_ == F64)) {
+        std::copy(that->f64(), that->f64() + size_, f64());
+    }
+    else if (elem_ == F64) {
+        std::copy(that->i64(), that->i64() + size_, f64());
+    }
+    else if (that->elem_ == I64) {
+        std::copy(that->i64(), that->i64() + size_, i64());
+    }
+    else {
+        for (size_t i = 0; i < size_; i++) {
+            i64()[i] = toI64("i64-array", that->f64()[i]);
+        }
+    }
+}
+
+int64_t RalArray::toI64(const char *name, double d)
+{
+    // -2^63 <= d < 2^63, which is false for NaN
+    if (!((d >= -9223372036854775808.0) && (d < 9223372036854775808.0))) {
+        throw RalException(std::string("'") + name +
+                           "' integer overflow in an i64 array.");
+    }
+    return (int64_t)d;
+}
+
+RalArray::RalArray(Elem elem, size_t n, void *data, std::shared_ptr<void> owner)
+    : elem_(elem), size_(n), data_(data), owner_(owner)
+{
+}
+
+RalArray::~RalArray() {}
+
+// #f64[1.000000 2.000000] or #i64[1 2]
+std::string RalArray::str(bool readable)
+{
+    std::string s = (elem_ == F64) ? "#f64[" : "#i64[";
+    for (size_t i = 0; i < size(); i++) {
+        if (i > 0) {
+            s += " ";
+        }
+        s += (elem_ == F64) ? std::to_string(f64()[i])
+                            : std::to_string(i64()[i]);
+    }
+    s += "]";
+    return s;
+}
+
+// arrays are only made by functions, so they are already evaluated
+RalTypePtr RalArray::eval(RalEnvPtr env) { return shared_from_this(); }
+
+bool RalArray::equal(RalTypePtr that)
+{
+    auto b = std::static_pointer_cast<RalArray>(that);
+    if (size_ != b->size_) {
+        return false;
+    }
+    return (elem_ == F64) ? std::equal(f64(), f64() + size_, b->f64())
+                          : std::equal(i64(), i64() + size_, b->i64());
+}
+
+size_t RalArray::hash()
+{
+    size_t h = (size_t)kind();
+    for (size_t i = 0; i < size(); i++) {
+        h = hashCombine(h, (elem_ == F64) ? std::hash<double>()(f64()[i])
+                                          : std::hash<int64_t>()(i64()[i]));
+    }
+    return h;
+}
+
+RalTypePtr RalArray::get(size_t i)
+{
+    if (elem_ == F64) {
+        return std::make_shared<RalDouble>(f64()[i]);
+    }
+    return std::make_shared<RalInteger>(i64()[i]);
+}
+
+std::shared_ptr<RalList> RalArray::toVector()
+{
+    auto mp = std::make_shared<RalList>('[');
+    mp->reserve(size());
+    for (size_t i = 0; i < size(); i++) {
+        mp->add(get(i));
+    }
+    return mp;
+}
+
+// ================================================================================
+RalMatrix::RalMatrix(size_t rows, size_t cols)
+    : data_(std::make_shared<RalF64Buffer>(rows * cols, 0.0)), offset_(0),
+      rows_(rows), cols_(cols), rowStride_(cols), colStride_(1)
+{
+}
+
+RalMatrix::RalMatrix(std::shared_ptr<RalF64Buffer> data, size_t offset,
+                     size_t rows, size_t cols, size_t rowStride,
+                     size_t colStride)
+    : data_(data), offset_(offset), rows_(rows), cols_(cols),
+      rowStride_(rowStride), colStride_(colStride)
+{
+}
+
+RalMatrix::~RalMatrix() {}
+
+// #matrix[[1.000000 2.000000] [3.000000 4.000000]]
+std::string RalMatrix::str(bool readable)
+{
+    std::string s = "#matrix[";
+    for (size_t i = 0; i < rows_; i++) {
+        s += (i > 0) ? " [" : "[";
+        for (size_t j = 0; j < cols_; j++) {
+            if (j > 0) {
+                s += " ";
+            }
+            s += std::to_string(at(i, j));
+        }
+        s += "]";
+    }
+    s += "]";
+    return s;
+}
+
+// matrices are only made by functions, so they are already evaluated
+RalTypePtr RalMatrix::eval(RalEnvPtr env) { return shared_from_this(); }
+
+bool RalMatrix::equal(RalTypePtr that)
+{
+    auto b = std::static_pointer_cast<RalMatrix>(that);
+    if ((rows_ != b->rows_) || (cols_ != b->cols_)) {
+        return false;
+    }
+    for (size_t i = 0; i < rows_; i++) {
+        for (size_t j = 0; j < cols_; j++) {
+            if (at(i, j) != b->at(i, j)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+size_t RalMatrix::hash()
+{
+    size_t h = hashCombine(rows_, cols_);
+    for (size_t i = 0; i < rows_; i++) {
+        for (size_t j = 0; j < cols_; j++) {
+            h = hashCombine(h, std::hash<double>()(at(i, j)));
+        }
+    }
+    return h;
+}
+
+std::shared_ptr<RalMatrix> RalMatrix::copy()
+{
+    auto mp = std::make_shared<RalMatrix>(rows_, cols_);
+    if (isContiguous()) {
+        std::copy(data(), data() + size(), mp->data());
+        return mp;
+    }
+    for (size_t i = 0; i < rows_; i++) {
+        for (size_t j = 0; j < cols_; j++) {
+            mp->at(i, j) = at(i, j);
+        }
+    }
+    return mp;
+}
+
+std::shared_ptr<RalMatrix> RalMatrix::row(size_t i)
+{
+    return std::make_shared<RalMatrix>(data_, offset_ + i * rowStride_, 1,
+                                       cols_, rowStride_, colStride_);
+}
+
+std::shared_ptr<RalMatrix> RalMatrix::col(size_t j)
+{
+    return std::make_shared<RalMatrix>(data_, offset_ + j * colStride_, rows_,
+                                       1, rowStride_, colStride_);
+}
+
+std::shared_ptr<RalMatrix> RalMatrix::transpose()
+{
+    return std::make_shared<RalMatrix>(data_, offset_, cols_, rows_,
+                                       colStride_, rowStride_);
+}
+
+// ================================================================================
+RalTable::RalTable(std::vector<RalTypePtr> names,
+                   std::vector<RalTypePtr> columns, size_t rows)
+    : names_(std::move(names)), columns_(std::move(columns)), rows_(rows)
+{
+}
+
+RalTable::~RalTable() {}
+
+std::string RalTable::str(bool readable)
+{
+    std::string s = "#table{";
+    for (size_t j = 0; j < columns_.size(); j++) {
+        if (j > 0) {
+            s += " ";
+        }
+        s += names_[j]->str(readable) + " " + columns_[j]->str(readable);
+    }
+    s += "}";
+    return s;
+}
+
+// tables are only made by functions, so they are already evaluated
+RalTypePtr RalTable::eval(RalEnvPtr env) { return shared_from_this(); }
+
+bool RalTable::equal(RalTypePtr that)
+{
+    if (that->kind() != RalKind::TABLE) {
+        return false;
+    }
+    auto t = std::static_pointer_cast<RalTable>(that);
+    if ((rows_ != t->rows_) || (columns_.size() != t->columns_.size())) {
+        return false;
+    }
+    for (size_t j = 0; j < columns_.size(); j++) {
+        if (!names_[j]->equal(t->names_[j]) ||
+            !columns_[j]->equal(t->columns_[j])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t RalTable::hash()
+{
+    size_t h = (size_t)kind();
+    for (size_t j = 0; j < columns_.size(); j++) {
+        h = hashCombine(h, names_[j]->hash());
+        h = hashCombine(h, columns_[j]->hash());
+    }
+    return h;
+}
+
+bool RalTable::find(RalTypePtr k, size_t &j)
+{
+    if ((k->kind() != RalKind::KEYWORD) && (k->kind() != RalKind::STRING)) {
+        return false;
+    }
+    for (j = 0; j < names_.size(); j++) {
+        if (names_[j]->equal(k)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+RalTypePtr RalTable::cell(size_t j, size_t i)
+{
+    if (isArray(columns_[j]->kind())) {
+        return std::static_pointer_cast<RalArray>(columns_[j])->get(i);
+    }
+    return std::static_pointer_cast<RalList>(columns_[j])->get(i);
+}
+
+std::shared_ptr<RalMap> RalTable::row(size_t i)
+{
+    auto mp = std::make_shared<RalMap>();
+    for (size_t j = 0; j < columns_.size(); j++) {
+        mp->add(names_[j]->asMapKey(), cell(j, i));
+    }
+    return mp;
+}
+
+std::shared_ptr<RalList> RalTable::toMaps(char listStartChar)
+{
+    auto mp = std::make_shared<RalList>(listStartChar);
+    mp->reserve(rows_);
+    for (size_t i = 0; i < rows_; i++) {
+        mp->add(row(i));
+    }
+    return mp;
+}
+
+std::shared_ptr<RalTable> RalTable::take(const std::vector<size_t> &indices)
+{
+    std::vector<RalTypePtr> columns;
+    for (auto &col : columns_) {
+        columns.push_back(takeColumn(col, indices));
+    }
+    return std::make_shared<RalTable>(names_, columns, indices.size());
+}
+
+RalTypePtr RalTable::makeColumn(const std::vector<RalTypePtr> &values)
+{
+    bool allInts = !values.empty(), allNumbers = !values.empty();
+    for (auto &v : values) {
+        allInts = allInts && (v->kind() == RalKind::INTEGER);
+        allNumbers = allNumbers && ((v->kind() == RalKind::INTEGER) ||
+                                    (v->kind() == RalKind::DOUBLE));
+    }
+    if (allInts) {
+        auto mp = std::make_shared<RalArray>(RalArray::I64, values.size());
+        for (size_t i = 0; i < values.size(); i++) {
+            mp->i64()[i] = values[i]->asInt();
+        }
+        return mp;
+    }
+    if (allNumbers) {
+        auto mp = std::make_shared<RalArray>(RalArray::F64, values.size());
+        for (size_t i = 0; i < values.size(); i++) {
+            mp->f64()[i] = values[i]->asDouble();
+        }
+        return mp;
+    }
+    auto mp = std::make_shared<RalList>('[');
+    mp->reserve(values.size());
+    for (auto &v : values) {
+        mp->add(v);
+    }
+    return mp;
+}
+
+RalTypePtr RalTable::takeColumn(RalTypePtr col,
+                                const std::vector<size_t> &indices)
+{
+    if (isArray(col->kind())) {
+        auto a = std::static_pointer_cast<RalArray>(col);
+        auto mp = std::make_shared<RalArray>(a->elem(), indices.size());
+        // both kinds of item are 8 bytes
+        auto src = a->i64();
+        auto dst = mp->i64();
+        for (size_t i = 0; i < indices.size(); i++) {
+            dst[i] = src[indices[i]];
+        }
+        return mp;
+    }
+    auto v = std::static_pointer_cast<RalList>(col);
+    auto mp = std::make_shared<RalList>('[');
+    mp->reserve(indices.size());
+    for (auto i : indices) {
+        mp->add(v->get(i));
+    }
+    return mp;
+}
+
+// ================================================================================
+// walks a list or vector for seqs built from them
+class RalListGen : public RalLazyGen {
+    std::shared_ptr<RalList> list_;
+    size_t index_;
+
+  public:
+    RalListGen(std::shared_ptr<RalList> list) : list_(list), index_(0) {}
+    bool next(std::vector<RalTypePtr> &items, size_t n) override
+    {
+        for (; (n > 0) && (index_ < list_->size()); n--) {
+            items.push_back(list_->get(index_++));
+        }
+        return index_ < list_->size();
+    }
+};
+
+RalLazyCell::RalLazyCell() : realized_(false) {}
+
+// a long chain of cells would otherwise be freed recursively
+RalLazyCell::~RalLazyCell()
+{
+    auto next = std::move(next_);
+    while ((next != nullptr) && (next.use_count() == 1)) {
+        auto after = std::move(next->next_);
+        next = std::move(after);
+    }
+}
+
+void RalLazyCell::realize()
+{
+    if (realized_) {
+        return;
+    }
+    if (thunk_ != nullptr) {
+        tail_ = invoke(thunk_, nullptr, nullptr);
+        thunk_ = nullptr;
+    }
+    if (tail_ != nullptr) {
+        auto tail = tail_;
+        switch (tail->kind()) {
+        case RalKind::LIST:
+            gen_ = std::make_shared<RalListGen>(
+                std::static_pointer_cast<RalList>(tail));
+            break;
+        case RalKind::LAZY_SEQ: {
+            // share the tail's cells rather than copying them one by one
+            auto lz = std::static_pointer_cast<RalLazySeq>(tail);
+            auto cell = lz->cell();
+            size_t offset = lz->offset();
+            if (seek(cell, offset)) {
+                items_.assign(cell->items_.begin() + offset,
+                              cell->items_.end());
+                next_ = cell->next_;
+            }
+            break;
+        }
+        case RalKind::CONSTANT:
+            if (tail->str(false) == "nil") {
+                break;
+            }
+        default:
+            throw RalException("lazy-seq must return a list, vector, lazy seq "
+                               "or nil.");
+        }
+        tail_ = nullptr;
+    }
+    if (gen_ != nullptr) {
+        std::vector<RalTypePtr> items;
+        bool more = gen_->next(items, RAL_LAZY_CHUNK);
+        items_ = std::move(items);
+        if (more) {
+            next_ = std::make_shared<RalLazyCell>();
+            next_->gen_ = gen_;
+        }
+        gen_ = nullptr;
+    }
+    realized_ = true;
+}
+
+bool RalLazyCell::seek(RalLazyCellPtr &cell, size_t &offset)
+{
+    while (cell != nullptr) {
+        cell->realize();
+        if (offset < cell->items_.size()) {
+            return true;
+        }
+        offset -= cell->items_.size();
+        cell = cell->next_;
+    }
+    return false;
+}
+
+RalTypePtr makeLazySeq(std::shared_ptr<RalLazyGen> gen)
+{
+    auto cell = std::make_shared<RalLazyCell>();
+    cell->gen_ = gen;
+    return std::make_shared<RalLazySeq>(cell, 0);
+}
+
+// ================================================================================
+RalLazySeq::RalLazySeq(RalLazyCellPtr cell, size_t offset)
+    : cell_(cell), offset_(offset)
+{
+}
+
+RalLazySeq::~RalLazySeq() {}
+
+std::string RalLazySeq::str(bool readable)
+{
+    return toList()->str(readable);
+}
+
+RalTypePtr RalLazySeq::eval(RalEnvPtr env) { return shared_from_this(); }
+
+bool RalLazySeq::equal(RalTypePtr that)
+{
+    if ((that->kind() != RalKind::LIST) &&
+        (that->kind() != RalKind::LAZY_SEQ)) {
+        return false;
+    }
+    RalSeqCursor a("=", shared_from_this());
+    RalSeqCursor b("=", that);
+    RalTypeEqual eq;
+    RalTypePtr ai, bi;
+    while (true) {
+        bool more = a.next(ai);
+        if (more != b.next(bi)) {
+            return false;
+        }
+        if (!more) {
+            return true;
+        }
+        if (!eq(ai, bi)) {
+            return false;
+        }
+    }
+}
+
+// hashes like a list with the same items
+size_t RalLazySeq::hash() { return toList()->hash(); }
+
+bool RalLazySeq::isEmpty()
+{
+    // moving our own position forward does not change our items
+    return !RalLazyCell::seek(cell_, offset_);
+}
+
+RalTypePtr RalLazySeq::first()
+{
+    if (isEmpty()) {
+        return std::make_shared<RalConstant>("nil");
+    }
+    return cell_->items_[offset_];
+}
+
+RalTypePtr RalLazySeq::rest()
+{
+    if (isEmpty()) {
+        return std::make_shared<RalLazySeq>(nullptr, 0);
+    }
+    return std::make_shared<RalLazySeq>(cell_, offset_ + 1);
+}
+
+RalTypePtr RalLazySeq::nth(size_t i)
+{
+    auto cell = cell_;
+    size_t offset = offset_ + i;
+    if (!RalLazyCell::seek(cell, offset)) {
+        return nullptr;
+    }
+    return cell->items_[offset];
+}
+
+size_t RalLazySeq::size()
+{
+    size_t n = 0;
+    RalSeqCursor cursor("count", shared_from_this());
+    RalTypePtr item;
+    while (cursor.next(item)) {
+        n++;
+    }
+    return n;
+}
+
+std::shared_ptr<RalList> RalLazySeq::toList()
+{
+    auto mp = std::make_shared<RalList>('(');
+    RalSeqCursor cursor("seq", shared_from_this());
+    RalTypePtr item;
+    while (cursor.next(item)) {
+        mp->add(item);
+    }
+    return mp;
+}
+
+// ================================================================================
+RalSeqCursor::RalSeqCursor(const char *name, RalTypePtr coll) : index_(0)
+{
+    switch (coll->kind()) {
+    case RalKind::LIST:
+        list_ = std::static_pointer_cast<RalList>(coll);
+        break;
+    case RalKind::LAZY_SEQ: {
+        auto lz = std::static_pointer_cast<RalLazySeq>(coll);
+        cell_ = lz->cell();
+        index_ = lz->offset();
+        break;
+    }
+    case RalKind::SET:
+        list_ = std::static_pointer_cast<RalList>(
+            std::static_pointer_cast<RalSet>(coll)->getItems());
+        break;
+    case RalKind::SORTED_MAP:
+        list_ = std::static_pointer_cast<RalList>(
+            std::static_pointer_cast<RalSortedMap>(coll)->getEntries());
+        break;
+    case RalKind::F64_ARRAY:
+    case RalKind::I64_ARRAY:
+        list_ = std::static_pointer_cast<RalArray>(coll)->toVector();
+        break;
+    case RalKind::TABLE:
+        list_ = std::static_pointer_cast<RalTable>(coll)->toMaps('[');
+        break;
+    case RalKind::CONSTANT:
+        if (coll->str(false) == "nil") {
+            break;
+        }
+    default:
+        throw RalException(std::string("'") + name +
+                           "' requires a list, vector or lazy seq.");
+    }
+}
+
+bool RalSeqCursor::next(RalTypePtr &item)
+{
+    if (list_ != nullptr) {
+        if (index_ < list_->size()) {
+            item = list_->get(index_++);
+            return true;
+        }
+        return false;
+    }
+    if (!RalLazyCell::seek(cell_, index_)) {
+        return false;
+    }
+    item = cell_->items_[index_++];
+    return true;
+}
+
+// ================================================================================
+RalTransducer::RalTransducer(std::vector<RalXformStage> stages)
+    : stages_(stages)
+{
+}
+
+RalTransducer::~RalTransducer() {}
+
+std::string RalTransducer::str(bool readable) { return "#<transducer>"; }
+
+RalTypePtr RalTransducer::eval(RalEnvPtr env) { return shared_from_this(); }
+
+bool RalTransducer::equal(RalTypePtr that) { return this == that.get(); }
+
+// ================================================================================
+RalFunction::RalFunction()
+{
+    name_ = "#<function>:null";
+    fn_ = nullptr;
+    meta_ = std::make_shared<RalConstant>("nil");
+}
+
+RalFunction::RalFunction(std::shared_ptr<RalFunction> that)
+{
+    name_ = that->name_;
+    fn_ = that->fn_;
+    meta_ = that->meta_;
+}
+
+RalFunction::RalFunction(const std::string &name, RalFunctionSignature fn)
+{
+    name_ = "#<function>:" + name;
+    fn_ = fn;
+    meta_ = std::make_shared<RalConstant>("nil");
+}
+
+RalFunction::~RalFunction() {}
+
+std::string RalFunction::str(bool readable) { return name_; }
+
+RalTypePtr RalFunction::eval(RalEnvPtr env) { return nullptr; /*FIXME*/ }
+
+bool RalFunction::equal(RalTypePtr that)
+{
+    auto b = std::static_pointer_cast<RalFunction>(that);
+    return name_ == b->str(false);
+}
+
+RalTypePtr RalFunction::apply(RalTypeIter begin, RalTypeIter end)
+{
+    return (fn_)(begin, end);
+}
+
+RalTypePtr RalFunction::getMeta() { return meta_; }
+
+void RalFunction::setMeta(RalTypePtr meta) { meta_ = meta; }
+
+// ================================================================================
+size_t RalMemoCache::ArgsHash::operator()(
+    const std::vector<RalTypePtr> &args) const
+{
+    size_t h = args.size();
+    for (auto &v : args) {
+        h = hashCombine(h, v->hash());
+    }
+    return h;
+}
+
+bool RalMemoCache::ArgsEqual::operator()(const std::vector<RalTypePtr> &a,
+                                         const std::vector<RalTypePtr> &b) const
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    RalTypeEqual eq;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (!eq(a[i], b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+RalMemoCache::RalMemoCache(RalTypePtr fn, size_t maxEntries, int64_t ttlMs)
+    : fn_(fn), maxEntries_(maxEntries), ttl_(ttlMs), hits_(0), misses_(0),
+      evictions_(0)
+{
+}
+
+RalTypePtr RalMemoCache::call(RalTypeIter begin, RalTypeIter end)
+{
+    std::vector<RalTypePtr> args(begin, end);
+    auto now = std::chrono::steady_clock::now();
+    auto pos = index_.find(args);
+    if (pos != index_.end()) {
+        auto entry = pos->second;
+        if ((ttl_.count() > 0) && (now - entry->time_ > ttl_)) {
+            index_.erase(pos);
+            lru_.erase(entry);
+            evictions_++;
+        }
+        else {
+            hits_++;
+            lru_.splice(lru_.begin(), lru_, entry);
+            return entry->result_;
+        }
+    }
+    misses_++;
+    auto result = invoke(fn_, begin, end);
+    // a recursive call may have stored these args while we were computing
+    pos = index_.find(args);
+    if (pos != index_.end()) {
+        pos->second->result_ = result;
+        pos->second->time_ = now;
+        lru_.splice(lru_.begin(), lru_, pos->second);
+        return result;
+    }
+    lru_.push_front(Entry{args, result, now});
+    index_.emplace(std::move(args), lru_.begin());
+    while ((maxEntries_ > 0) && (lru_.size() > maxEntries_)) {
+        index_.erase(lru_.back().args_);
+        lru_.pop_back();
+        evictions_++;
+    }
+    return result;
+}
+
+// ================================================================================
+RalMemoFunction::RalMemoFunction(std::shared_ptr<RalMemoCache> cache)
+    : RalFunction("memoize",
+                  [cache](RalTypeIter begin, RalTypeIter end) {
+                      return cache->call(begin, end);
+                  }),
+      cache_(cache)
+{
+}
+
+RalMemoFunction::RalMemoFunction(std::shared_ptr<RalMemoFunction> that)
+    : RalFunction(that), cache_(that->cache_)
+{
+}
+
+// ================================================================================
+RalArity::RalArity(std::shared_ptr<RalList> params, RalTypePtr form)
+    : variadic_(false), form_(form)
+{
+    for (size_t i = 0; i < params->size(); i++) {
+        auto name = params->get(i)->str(false);
+        if (name == "&") {
+            if (i + 2 != params->size()) {
+                throw RalException("'fn*' requires one parameter after &.");
+            }
+            variadic_ = true;
+            rest_ = params->get(i + 1)->str(false);
+            break;
+        }
+        names_.push_back(name);
+    }
+}
+
+const size_t RalArities::npos;
+
+RalArities::RalArities(std::vector<RalArity> arities, bool lenient)
+    : arities_(std::move(arities)), lenient_(lenient), variadic_(npos)
+{
+    for (size_t i = 0; i < arities_.size(); i++) {
+        auto num = arities_[i].names_.size();
+        if (arities_[i].variadic_) {
+            if (variadic_ != npos) {
+                throw RalException("'fn*' can only have one variadic arity.");
+            }
+            variadic_ = i;
+            continue;
+        }
+        if (num >= byCount_.size()) {
+            byCount_.resize(num + 1, npos);
+        }
+        if (byCount_[num] != npos) {
+            throw RalException("'fn*' can't have two arities with " +
+                               std::to_string(num) + " parameters.");
+        }
+        byCount_[num] = i;
+    }
+}
+
+// ================================================================================
+RalLambda::RalLambda(RalAritiesPtr arities, RalEnvPtr env)
+{
+    arities_ = arities;
+    env_ = env;
+    is_macro_ = false;
+    meta_ = std::make_shared<RalConstant>("nil");
+}
+
+RalLambda::RalLambda(RalLambda *that)
+{
+    arities_ = that->arities_;
+    env_ = that->env_;
+    is_macro_ = that->is_macro_;
+    meta_ = that->meta_;
+}
+
+RalLambda::RalLambda(std::shared_ptr<RalLambda> that)
+{
+    arities_ = that->arities_;
+    env_ = that->env_;
+    is_macro_ = that->is_macro_;
+    meta_ = that->meta_;
+}
+
+RalLambda::~RalLambda() {}
+
+std::string RalLambda::str(bool readable) { return "#<function>"; }
+
+RalTypePtr RalLambda::eval(RalEnvPtr env) { return nullptr; /*FIXME*/ }
+
+bool RalLambda::equal(RalTypePtr that)
+{
+    auto b = std::static_pointer_cast<RalLambda>(that);
+    return false; // FIXME?
+}
+
+RalTypePtr RalLambda::apply(RalTypeIter begin, RalTypeIter end)
+{
+    auto &a = arity(end - begin);
+    RalEnvPtr lambda_env = makeEnv(a, begin, end, false);
+    return EVAL(a.form_, lambda_env);
+}
+
+const RalArity &RalLambda::arity(size_t num)
+{
+    auto a = arities_->find(num);
+    if (a == nullptr) {
+        throw RalException("wrong number of arguments (" + std::to_string(num) +
+                           ") passed to function.");
+    }
+    return *a;
+}
+
+RalEnvPtr RalLambda::makeEnv(const RalArity &a, RalTypeIter begin,
+                             RalTypeIter end, bool moveArgs)
+{
+    return std::make_shared<RalEnv>(env_, a, begin, end, moveArgs);
+}
+
+// ================================================================================
+RalTypePtr invoke(RalTypePtr fn, RalTypeIter begin, RalTypeIter end)
+{
+    if (fn->kind() == RalKind::FUNCTION) {
+        return std::static_pointer_cast<RalFunction>(fn)->signature()(begin,
+                                                                      end);
+    }
+    // lambdas, or RalNotApplicable for anything else
+    return fn->apply(begin, end);
+}
+
+RalTypePtr RalLambda::getMeta() { return meta_; }
+
+void RalLambda::setMeta(RalTypePtr meta) { meta_ = meta; }
+
+// ================================================================================
+RalAtom::RalAtom(RalTypePtr that) : value_(that) { }
+RalAtom::~RalAtom() {}
+std::string RalAtom::str(bool readable)
+{
+    return "(atom " + value_->str(true) + ")";
+}
+RalTypePtr RalAtom::eval(RalEnvPtr env) { return nullptr; /*FIXME*/ }
+bool RalAtom::equal(RalTypePtr that)
+{
+    return false; // FIXME
+}
+RalTypePtr RalAtom::value() { return value_; }
+RalTypePtr RalAtom::set(RalTypePtr that)
+{
+    value_ = that;
+    return value_;
+}
+
+// ================================================================================
+// xoshiro256** by David Blackman & Sebastiano Vigna, https://prng.di.unimi.it
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// splitmix64 spreads a seed over the whole state, as xoshiro recommends
+RalRng::RalRng(uint64_t seed)
+{
+    for (auto &s : s_) {
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        s = z ^ (z >> 31);
+    }
+}
+
+RalRng::RalRng(const uint64_t state[4])
+{
+    std::copy(state, state + 4, s_);
+}
+
+RalRng::~RalRng() {}
+
+std::string RalRng::str(bool readable) { return "#<rng>"; }
+
+RalTypePtr RalRng::eval(RalEnvPtr env) { return shared_from_this(); }
+
+bool RalRng::equal(RalTypePtr that) { return this == that.get(); }
+
+uint64_t RalRng::next()
+{
+    uint64_t result = rotl(s_[1] * 5, 7) * 9;
+    uint64_t t = s_[1] << 17;
+    s_[2] ^= s_[0];
+    s_[3] ^= s_[1];
+    s_[1] ^= s_[2];
+    s_[0] ^= s_[3];
+    s_[2] ^= t;
+    s_[3] = rotl(s_[3], 45);
+    return result;
+}
+
+uint64_t RalRng::nextBelow(uint64_t n)
+{
+    // reject the lowest (2^64 % n) values so every remainder is equally likely
+    uint64_t threshold = (0 - n) % n;
+    uint64_t x;
+    do {
+        x = next();
+    } while (x < threshold);
+    return x % n;
+}
+
+std::shared_ptr<RalRng> RalRng::split()
+{
+    auto child = std::make_shared<RalRng>(s_);
+    // the xoshiro256 jump polynomial, equivalent to 2^128 calls to next()
+    static const uint64_t JUMP[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                    0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+    uint64_t s[4] = {0, 0, 0, 0};
+    for (auto jump : JUMP) {
+        for (int b = 0; b < 64; b++) {
+            if (jump & (1ULL << b)) {
+                for (int i = 0; i < 4; i++) {
+                    s[i] ^= s_[i];
+                }
+            }
+            next();
+        }
+    }
+    std::copy(s, s + 4, s_);
+    return child;
+}
+
+// ================================================================================
+// type keys for the kinds that are split in two
+static const uint64_t VECTOR_TYPE_KEY = 64;
+static const uint64_t BOOLEAN_TYPE_KEY = 65;
+
+static const std::vector<std::pair<std::string, uint64_t>> &typeNames()
+{
+    static const std::vector<std::pair<std::string, uint64_t>> names = {
+        {":nil", (uint64_t)RalKind::CONSTANT},
+        {":boolean", BOOLEAN_TYPE_KEY},
+        {":integer", (uint64_t)RalKind::INTEGER},
+        {":bigint", (uint64_t)RalKind::BIGINT},
+        {":double", (uint64_t)RalKind::DOUBLE},
+        {":symbol", (uint64_t)RalKind::SYMBOL},
+        {":string", (uint64_t)RalKind::STRING},
+        {":keyword", (uint64_t)RalKind::KEYWORD},
+        {":list", (uint64_t)RalKind::LIST},
+        {":vector", VECTOR_TYPE_KEY},
+        {":map", (uint64_t)RalKind::MAP},
+        {":function", (uint64_t)RalKind::FUNCTION},
+        {":atom", (uint64_t)RalKind::ATOM},
+        {":transient", (uint64_t)RalKind::TRANSIENT},
+        {":set", (uint64_t)RalKind::SET},
+        {":sorted-map", (uint64_t)RalKind::SORTED_MAP},
+        {":record-type", (uint64_t)RalKind::RECORD_TYPE},
+        {":lazy-seq", (uint64_t)RalKind::LAZY_SEQ},
+        {":transducer", (uint64_t)RalKind::TRANSDUCER},
+        {":f64-array", (uint64_t)RalKind::F64_ARRAY},
+        {":i64-array", (uint64_t)RalKind::I64_ARRAY},
+        {":matrix", (uint64_t)RalKind::MATRIX},
+        {":table", (uint64_t)RalKind::TABLE},
+        {":rng", (uint64_t)RalKind::RNG},
+        {":multi-fn", (uint64_t)RalKind::MULTI_FN}};
+    return names;
+}
+
+static uint64_t recordTypeKey(RalRecordType *type)
+{
+    return (type->id() << 8) | 0xff;
+}
+
+uint64_t typeKey(RalTypePtr value)
+{
+    switch (value->kind()) {
+    case RalKind::RECORD:
+        return recordTypeKey(
+            static_cast<RalRecord *>(value.get())->type().get());
+    case RalKind::LIST:
+        return value->isVector() ? VECTOR_TYPE_KEY : (uint64_t)RalKind::LIST;
+    case RalKind::CONSTANT:
+        return (value->str(false) == "nil") ? (uint64_t)RalKind::CONSTANT
+                                            : BOOLEAN_TYPE_KEY;
+    case RalKind::LAMBDA:
+        return (uint64_t)RalKind::FUNCTION;
+    default:
+        return (uint64_t)value->kind();
+    }
+}
+
+RalTypePtr typeOf(RalTypePtr value)
+{
+    if (value->kind() == RalKind::RECORD) {
+        return std::static_pointer_cast<RalRecord>(value)->type();
+    }
+    auto key = typeKey(value);
+    for (auto &name : typeNames()) {
+        if (name.second == key) {
+            return std::make_shared<RalKeyword>(name.first);
+        }
+    }
+    return std::make_shared<RalConstant>("nil");
+}
+
+uint64_t typeKeyOf(RalTypePtr type)
+{
+    if (type->kind() == RalKind::RECORD_TYPE) {
+        return recordTypeKey(static_cast<RalRecordType *>(type.get()));
+    }
+    if (type->kind() == RalKind::KEYWORD) {
+        for (auto &name : typeNames()) {
+            if (name.first == type->str(false)) {
+                return name.second;
+            }
+        }
+    }
+    return 0;
+}
+
+// ================================================================================
+RalMultiFn::RalMultiFn(const std::string &name, RalTypePtr dispatch)
+    : name_(name), dispatch_(dispatch), version_(0)
+{
+}
+
+RalMultiFn::~RalMultiFn() {}
+
+std::string RalMultiFn::str(bool readable)
+{
+    return "#<multi-fn " + name_ + ">";
+}
+
+RalTypePtr RalMultiFn::eval(RalEnvPtr env) { return shared_from_this(); }
+
+bool RalMultiFn::equal(RalTypePtr that) { return this == that.get(); }
+
+RalTypePtr RalMultiFn::apply(RalTypeIter begin, RalTypeIter end)
+{
+    return invoke(method(begin, end), begin, end);
+}
+
+uint64_t RalMultiFn::dispatchKey(RalTypeIter begin, RalTypeIter end)
+{
+    if (!isProtocol()) {
+        return 0;
+    }
+    if (begin == end) {
+        throw RalException("'" + name_ + "' requires at least 1 argument.");
+    }
+    return typeKey(*begin);
+}
+
+RalTypePtr RalMultiFn::dispatchValue(RalTypeIter begin, RalTypeIter end)
+{
+    return invoke(dispatch_, begin, end);
+}
+
+RalTypePtr RalMultiFn::methodForType(uint64_t key, RalTypePtr arg)
+{
+    auto it = byType_.find(key);
+    if (it != byType_.end()) {
+        return it->second;
+    }
+    if (default_ == nullptr) {
+        throw RalException("'" + name_ + "' has no method for type " +
+                           typeOf(arg)->str(true) + ".");
+    }
+    return default_;
+}
+
+RalTypePtr RalMultiFn::methodForValue(RalTypePtr value)
+{
+    auto it = byValue_.find(value);
+    if (it != byValue_.end()) {
+        return it->second;
+    }
+    if (default_ == nullptr) {
+        throw RalException("'" + name_ + "' has no method for " +
+                           value->str(true) + ".");
+    }
+    return default_;
+}
+
+RalTypePtr RalMultiFn::method(RalTypeIter begin, RalTypeIter end)
+{
+    if (isProtocol()) {
+        return methodForType(dispatchKey(begin, end), *begin);
+    }
+    return methodForValue(dispatchValue(begin, end));
+}
+
+void RalMultiFn::addMethod(RalTypePtr value, RalTypePtr fn)
+{
+    if ((fn->kind() != RalKind::FUNCTION) && (fn->kind() != RalKind::LAMBDA) &&
+        (fn->kind() != RalKind::MULTI_FN)) {
+        throw RalException("a method of '" + name_ + "' must be a function.");
+    }
+    if ((value->kind() == RalKind::KEYWORD) &&
+        (value->str(false) == ":default")) {
+        default_ = fn;
+    }
+    else if (isProtocol()) {
+        auto key = typeKeyOf(value);
+        if (key == 0) {
+            throw RalException("'" + name_ +
+                               "' requires a type keyword or record type, not " +
+                               value->str(true) + ".");
+        }
+        byType_[key] = fn;
+    }
+    else {
+        byValue_[value] = fn;
+    }
+    version_++;
+}
+// ================================================================================
+// the transient owns a copy of coll, so updating it in place is never seen by
+// anyone holding the original.
+RalTransient::RalTransient(RalTypePtr coll)
+    : owner_(std::this_thread::get_id()), editable_(true)
+{
+    if (coll->kind() == RalKind::MAP) {
+        coll_ = std::make_shared<RalMap>(std::static_pointer_cast<RalMap>(coll));
+    }
+    else if (coll->kind() == RalKind::SET) {
+        coll_ = std::make_shared<RalSet>(std::static_pointer_cast<RalSet>(coll));
+    }
+    else if (coll->isVector()) {
+        coll_ =
+            std::make_shared<RalList>(std::static_pointer_cast<RalList>(coll));
+    }
+    else {
+        throw RalException("transient requires a vector, hash-map or set.");
+    }
+}
+RalTransient::~RalTransient() {}
+std::string RalTransient::str(bool readable)
+{
+    return editable_ ? "#<transient " + coll_->str(readable) + ">"
+                     : "#<transient>";
+}
+RalTypePtr RalTransient::eval(RalEnvPtr env) { return shared_from_this(); }
+bool RalTransient::equal(RalTypePtr that) { return this == that.get(); }
+// every use of a transient goes through here to check ownership
+RalTypePtr RalTransient::coll(const char *name)
+{
+    if (!editable_) {
+        throw RalException(std::string("'") + name +
+                           "' used a transient after persistent! was called.");
+    }
+    if (owner_ != std::this_thread::get_id()) {
+        throw RalException(std::string("'") + name +
+                           "' used a transient from a non-owner thread.");
+    }
+    return coll_;
+}
+RalTypePtr RalTransient::persistent()
+{
+    auto mp = coll("persistent!");
+    editable_ = false;
+    coll_ = nullptr;
+    return mp;
+}
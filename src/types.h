@@ -3,8 +3,10 @@
 // Copyright(C) 2020 Roger Allen
 //
 // types.h - All of the types handled by ral.
-// INTEGER, CONSTANT, SYMBOL, STRING, KEYWORD,
-// LIST, MAP, FUNCTION, LAMBDA, ATOM.
+// INTEGER, BIGINT, CONSTANT, SYMBOL, STRING, KEYWORD,
+// LIST, MAP, FUNCTION, LAMBDA, ATOM, TRANSIENT, SET, SORTED_MAP,
+// RECORD_TYPE, RECORD, LAZY_SEQ, TRANSDUCER, F64_ARRAY, I64_ARRAY, MATRIX,
+// TABLE, RNG, MULTI_FN.
 //
 // ======================================================================
 // This program is free software : you can redistribute it and/or modify
@@ -22,17 +24,26 @@
 // ======================================================================
 #pragma once
 
+#include "bigint.h"
+#include <chrono>
+#include <cstdlib>
 #include <exception>
 #include <functional>
+#include <list>
 #include <map>
 #include <memory>
+#include <new>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 // ================================================================================
 enum class RalKind {
     NONE,
     INTEGER,
+    BIGINT,
     DOUBLE,
     CONSTANT,
     SYMBOL,
@@ -42,13 +53,34 @@ enum class RalKind {
     MAP,
     FUNCTION,
     LAMBDA,
-    ATOM
+    ATOM,
+    TRANSIENT,
+    SET,
+    SORTED_MAP,
+    RECORD_TYPE,
+    RECORD,
+    LAZY_SEQ,
+    TRANSDUCER,
+    F64_ARRAY,
+    I64_ARRAY,
+    MATRIX,
+    TABLE,
+    RNG,
+    MULTI_FN
 };
 class RalType;
 class RalEnv;
 typedef std::shared_ptr<RalEnv> RalEnvPtr;
 typedef std::shared_ptr<RalType> RalTypePtr;
-typedef std::vector<RalTypePtr>::iterator RalTypeIter;
+typedef RalTypePtr *RalTypeIter;
+
+// Something EVAL works out from a form the first time it sees it & keeps on
+// the form's list, like the plan for a quasiquote template.
+class RalCompiled {
+  public:
+    virtual ~RalCompiled() {}
+};
+typedef std::shared_ptr<RalCompiled> RalCompiledPtr;
 class RalType : public std::enable_shared_from_this<RalType> {
   public:
     virtual ~RalType(){}; // remember to create a virtual destructor if you have
@@ -60,6 +92,7 @@ class RalType : public std::enable_shared_from_this<RalType> {
     // only some types implement the below functions -- they are NOT pure
     // virtual
     virtual RalTypePtr apply(RalTypeIter begin, RalTypeIter end);
+    virtual size_t hash();
     virtual std::string asMapKey();
     virtual int64_t asInt();
     virtual double asDouble();
@@ -70,14 +103,12 @@ class RalType : public std::enable_shared_from_this<RalType> {
     virtual bool isList();
     virtual bool isVector();
     virtual bool isEmptyList();
-    virtual RalTypePtr apply();
     virtual void setEnv(RalEnvPtr env);
     virtual bool is_macro_call(RalEnvPtr env);
 };
 
 // ================================================================================
 class RalInteger : public RalType {
-    const std::string repr_;
     const int64_t value_;
 
   public:
@@ -89,10 +120,40 @@ class RalInteger : public RalType {
     std::string str(bool readable) override;
     RalTypePtr eval(RalEnvPtr env) override;
     bool equal(RalTypePtr that) override;
+    size_t hash() override;
     int64_t asInt() override;
     double asDouble() override; // I'm not 100% sure.  90% sure this is right.
 };
 
+// ================================================================================
+// An integer too big for int64_t.  Integer arithmetic promotes to these when
+// it overflows and results that fit go back to INTEGER, so a BIGINT never
+// holds a value an INTEGER could.
+class RalBigInt : public RalType {
+    const RalBig value_;
+
+  public:
+    RalBigInt(const RalBig &value);
+    ~RalBigInt() override;
+    RalKind kind() override { return RalKind::BIGINT; }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    bool equal(RalTypePtr that) override;
+    size_t hash() override;
+    double asDouble() override;
+    const RalBig &value() { return value_; }
+};
+
+// an INTEGER if value fits in one, else a BIGINT
+RalTypePtr makeInteger(const RalBig &value);
+// the value of an INTEGER or BIGINT
+RalBig bigValue(const RalTypePtr &mp);
+// true for INTEGER or BIGINT
+inline bool isInteger(RalKind kind)
+{
+    return (kind == RalKind::INTEGER) || (kind == RalKind::BIGINT);
+}
+
 // ================================================================================
 class RalDouble : public RalType {
     const std::string repr_;
@@ -107,6 +168,7 @@ class RalDouble : public RalType {
     std::string str(bool readable) override;
     RalTypePtr eval(RalEnvPtr env) override;
     bool equal(RalTypePtr that) override;
+    size_t hash() override;
     double asDouble() override;
 };
 
@@ -122,6 +184,7 @@ class RalConstant : public RalType {
     std::string str(bool readable) override;
     RalTypePtr eval(RalEnvPtr env) override;
     bool equal(RalTypePtr that) override;
+    size_t hash() override;
     int64_t asInt() override;
     double asDouble() override;
     bool isNilOrFalse() override;
@@ -132,12 +195,18 @@ class RalSymbol : public RalType {
     const std::string repr_;
 
   public:
+    // The core primitive EVAL can run inline for calls through this symbol,
+    // worked out on the first call.  Symbols are read once, so this caches
+    // per call site.
+    int cachedPrim_;
+
     RalSymbol(const std::string &s);
     ~RalSymbol() override;
     RalKind kind() override { return RalKind::SYMBOL; }
     std::string str(bool readable) override;
     RalTypePtr eval(RalEnvPtr env) override;
     bool equal(RalTypePtr that) override;
+    size_t hash() override;
 };
 
 // ================================================================================
@@ -154,6 +223,7 @@ class RalString : public RalType {
     std::string str(bool readable) override;
     RalTypePtr eval(RalEnvPtr env) override;
     bool equal(RalTypePtr that) override;
+    size_t hash() override;
     std::string asMapKey() override;
 };
 
@@ -162,6 +232,11 @@ class RalKeyword : public RalType {
     const std::string repr_;
 
   public:
+    // Record field lookups remember the slot for the last record type they
+    // saw.  Keyword literals are read once, so this caches per call site.
+    uint64_t cachedShapeId_;
+    size_t cachedSlot_;
+
     RalKeyword(const std::string &s);
     RalKeyword(RalKeyword *that);
     ~RalKeyword() override;
@@ -169,6 +244,7 @@ class RalKeyword : public RalType {
     std::string str(bool readable) override;
     RalTypePtr eval(RalEnvPtr env) override;
     bool equal(RalTypePtr that) override;
+    size_t hash() override;
     std::string asMapKey() override;
 };
 
@@ -178,21 +254,25 @@ class RalList : public RalType {
     std::vector<RalTypePtr> values_;
     char listStartChar_; // ( for list, [ for vector
     RalTypePtr meta_;
+    RalCompiledPtr compiled_; // not copied
 
     std::string listStartStr();
     std::string listEndStr();
 
   public:
     RalList(char listStartChar);
+    RalList(char listStartChar, std::vector<RalTypePtr> values);
     RalList(std::shared_ptr<RalList> that);
     ~RalList() override;
     RalKind kind() override { return RalKind::LIST; }
     std::string str(bool readable) override;
     RalTypePtr eval(RalEnvPtr env) override;
     bool equal(RalTypePtr that) override;
-    RalTypePtr apply() override;
+    size_t hash() override;
     void add(RalTypePtr mp);
     RalTypePtr count();
+    void reserve(size_t n);
+    void set(size_t i, RalTypePtr mp);
     bool isList() override;
     bool isVector() override;
     bool isEmptyList() override;
@@ -200,8 +280,12 @@ class RalList : public RalType {
     virtual bool is_macro_call(RalEnvPtr env) override;
     RalTypePtr get(size_t i);
     size_t size();
+    // the items as an argument span: [data(), data() + size())
+    RalTypeIter data() { return values_.data(); }
     RalTypePtr getMeta() override;
     void setMeta(RalTypePtr meta) override;
+    const RalCompiledPtr &compiled() { return compiled_; }
+    void setCompiled(RalCompiledPtr compiled) { compiled_ = compiled; }
 };
 
 // ================================================================================
@@ -218,16 +302,471 @@ class RalMap : public RalType {
     std::string str(bool readable) override;
     RalTypePtr eval(RalEnvPtr env) override;
     bool equal(RalTypePtr that) override;
+    size_t hash() override;
     void add(std::string key, RalTypePtr val);
     RalTypePtr get(RalTypePtr k);
     void remove(RalTypePtr k);
     bool hasKey(RalTypePtr k);
     RalTypePtr getKeys();
     RalTypePtr getVals();
+    size_t size();
+    RalTypePtr getMeta() override;
+    void setMeta(RalTypePtr meta) override;
+};
+
+// ================================================================================
+// A transient wraps a private copy of a vector, map or set that can be updated
+// in place by conj!, assoc!, dissoc! & disj!.  Only the thread that created it may use
+// it and it may not be used at all after persistent! hands the collection back.
+class RalTransient : public RalType {
+    RalTypePtr coll_;
+    std::thread::id owner_;
+    bool editable_;
+
+  public:
+    RalTransient(RalTypePtr coll);
+    ~RalTransient() override;
+    RalKind kind() override { return RalKind::TRANSIENT; }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    bool equal(RalTypePtr that) override;
+    RalTypePtr coll(const char *name);
+    RalTypePtr persistent();
+};
+
+// ================================================================================
+// hash & equality functors so any ral value can be used as a key in the
+// std::unordered containers.
+struct RalTypeHash {
+    size_t operator()(const RalTypePtr &mp) const { return mp->hash(); }
+};
+struct RalTypeEqual {
+    bool operator()(const RalTypePtr &a, const RalTypePtr &b) const;
+};
+size_t hashCombine(size_t seed, size_t h);
+
+// ================================================================================
+class RalSet : public RalType {
+  protected:
+    std::unordered_set<RalTypePtr, RalTypeHash, RalTypeEqual> values_;
+    RalTypePtr meta_;
+
+  public:
+    RalSet();
+    RalSet(std::shared_ptr<RalSet> that);
+    ~RalSet() override;
+    RalKind kind() override { return RalKind::SET; }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    bool equal(RalTypePtr that) override;
+    size_t hash() override;
+    void add(RalTypePtr mp);
+    void remove(RalTypePtr mp);
+    bool contains(RalTypePtr mp);
+    RalTypePtr get(RalTypePtr mp);
+    size_t size();
+    RalTypePtr getItems();
+    RalTypePtr getMeta() override;
+    void setMeta(RalTypePtr meta) override;
+    // set algebra works directly on the hash tables
+    void unionWith(std::shared_ptr<RalSet> that);
+    void intersectWith(std::shared_ptr<RalSet> that);
+    void differenceWith(std::shared_ptr<RalSet> that);
+};
+
+// ================================================================================
+bool isNil(const RalTypePtr &mp);
+
+// natural ordering used by sorted collections (and compare).  nil sorts before
+// everything, numbers compare by value and strings, keywords & symbols compare
+// by name.  Returns <0, 0 or >0.
+int ralCompare(RalTypePtr a, RalTypePtr b);
+
+// a nullptr fn means the natural ordering.  Otherwise fn is a ral function
+// that either returns a number like compare or true when a is less than b.
+struct RalComparator {
+    RalTypePtr fn_;
+    int compare(const RalTypePtr &a, const RalTypePtr &b) const;
+};
+
+// nodes are never changed once they are built, so maps share the unchanged
+// parts of the tree.  The tree is kept AVL balanced.
+struct RalSortedNode;
+typedef std::shared_ptr<const RalSortedNode> RalSortedNodePtr;
+struct RalSortedNode {
+    RalTypePtr key_;
+    RalTypePtr val_;
+    RalSortedNodePtr left_;
+    RalSortedNodePtr right_;
+    int height_;
+};
+
+class RalSortedMap : public RalType {
+  protected:
+    RalSortedNodePtr root_;
+    size_t size_;
+    RalComparator cmp_;
+    RalTypePtr meta_;
+
+    RalSortedNodePtr find(const RalTypePtr &k);
+
+  public:
+    RalSortedMap(RalTypePtr cmpFn);
+    RalSortedMap(std::shared_ptr<RalSortedMap> that);
+    ~RalSortedMap() override;
+    RalKind kind() override { return RalKind::SORTED_MAP; }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    bool equal(RalTypePtr that) override;
+    size_t hash() override;
+    // add & remove update this map in place; only use them on a map that
+    // has not been shared yet.  The tree nodes are shared with copies.
+    void add(RalTypePtr k, RalTypePtr v);
+    void remove(RalTypePtr k);
+    RalTypePtr get(RalTypePtr k);
+    bool hasKey(RalTypePtr k);
+    size_t size();
+    RalTypePtr getKeys();
+    RalTypePtr getVals();
+    RalTypePtr getEntries();
+    RalTypePtr firstKey();
+    RalTypePtr lastKey();
+    // [key value] entries with keys between the bounds in O(log n + k).
+    // A nullptr bound is unbounded.
+    RalTypePtr range(RalTypePtr lo, bool loInclusive, RalTypePtr hi,
+                     bool hiInclusive, bool reverse);
     RalTypePtr getMeta() override;
     void setMeta(RalTypePtr meta) override;
 };
 
+// ================================================================================
+// A record type is the shared shape of all records made from it: the field
+// keywords and the slot each one is stored in.
+class RalRecordType : public RalType {
+    std::string name_;
+    std::vector<RalTypePtr> fields_;
+    std::map<std::string, size_t> index_;
+    uint64_t id_; // unique for every record type ever made
+
+  public:
+    RalRecordType(const std::string &name, std::vector<RalTypePtr> fields);
+    ~RalRecordType() override;
+    RalKind kind() override { return RalKind::RECORD_TYPE; }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    bool equal(RalTypePtr that) override;
+    const std::string &name() { return name_; }
+    uint64_t id() { return id_; }
+    size_t numFields() { return fields_.size(); }
+    RalTypePtr field(size_t i) { return fields_[i]; }
+    // returns false if k is not a field of this type
+    bool slot(RalTypePtr k, size_t &slot);
+};
+
+// ================================================================================
+// Records keep their fields in a fixed slot array described by their type.
+// Any keys that are not fields are kept in an extra map, so a record still
+// behaves like a map.
+class RalRecord : public RalType {
+    std::shared_ptr<RalRecordType> type_;
+    std::vector<RalTypePtr> slots_;
+    std::shared_ptr<RalMap> ext_;
+    RalTypePtr meta_;
+
+  public:
+    RalRecord(std::shared_ptr<RalRecordType> type,
+              std::vector<RalTypePtr> slots);
+    RalRecord(std::shared_ptr<RalRecord> that);
+    ~RalRecord() override;
+    RalKind kind() override { return RalKind::RECORD; }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    bool equal(RalTypePtr that) override;
+    size_t hash() override;
+    std::shared_ptr<RalRecordType> type() { return type_; }
+    RalTypePtr get(RalTypePtr k);
+    bool hasKey(RalTypePtr k);
+    // assoc & dissoc return a new value.  dissoc of a field returns a map.
+    RalTypePtr assoc(RalTypePtr k, RalTypePtr v);
+    RalTypePtr dissoc(RalTypePtr k);
+    size_t size();
+    RalTypePtr getKeys();
+    RalTypePtr getVals();
+    RalTypePtr getMeta() override;
+    void setMeta(RalTypePtr meta) override;
+};
+
+// ================================================================================
+// typed array buffers are aligned for the AVX2 kernels
+const size_t RAL_ARRAY_ALIGN = 32;
+
+template <typename T> struct RalAlignedAllocator {
+    typedef T value_type;
+    RalAlignedAllocator() {}
+    template <typename U> RalAlignedAllocator(const RalAlignedAllocator<U> &) {}
+    T *allocate(size_t n)
+    {
+#ifdef _WIN32
+        void *p = _aligned_malloc(n * sizeof(T), RAL_ARRAY_ALIGN);
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+#else
+        void *p = nullptr;
+        if (posix_memalign(&p, RAL_ARRAY_ALIGN, n * sizeof(T)) != 0) {
+            throw std::bad_alloc();
+        }
+#endif
+        return static_cast<T *>(p);
+    }
+    void deallocate(T *p, size_t n)
+    {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+};
+template <typename T, typename U>
+bool operator==(const RalAlignedAllocator<T> &, const RalAlignedAllocator<U> &)
+{
+    return true;
+}
+template <typename T, typename U>
+bool operator!=(const RalAlignedAllocator<T> &, const RalAlignedAllocator<U> &)
+{
+    return false;
+}
+typedef std::vector<double, RalAlignedAllocator<double>> RalF64Buffer;
+typedef std::vector<int64_t, RalAlignedAllocator<int64_t>> RalI64Buffer;
+
+// A typed array keeps its numbers unboxed in one contiguous buffer, either
+// all doubles (F64_ARRAY) or all integers (I64_ARRAY).  Arrays are values;
+// the arithmetic on them always makes a new array, so the buffer can also be
+// read-only memory, like a mapped file.
+class RalArray : public RalType {
+  public:
+    enum Elem { F64, I64 };
+
+  private:
+    const Elem elem_;
+    size_t size_;
+    void *data_;
+    std::shared_ptr<void> owner_; // keeps data_ alive
+
+  public:
+    RalArray(Elem elem, size_t n); // filled with zeros
+    // a copy of that, converted to elem.  Only i64-array converts f64 items
+    // to i64, & ones that don't fit throw.
+    RalArray(Elem elem, std::shared_ptr<RalArray> that);
+    // d as an i64, throwing for NaN & values out of range of one
+    static int64_t toI64(const char *name, double d);
+    // the n items at data, which owner keeps alive
+    RalArray(Elem elem, size_t n, void *data, std::shared_ptr<void> owner);
+    ~RalArray() override;
+    RalKind kind() override
+    {
+        return (elem_ == F64) ? RalKind::F64_ARRAY : RalKind::I64_ARRAY;
+    }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    bool equal(RalTypePtr that) override;
+    size_t hash() override;
+    Elem elem() { return elem_; }
+    size_t size() { return size_; }
+    double *f64() { return static_cast<double *>(data_); }
+    int64_t *i64() { return static_cast<int64_t *>(data_); }
+    RalTypePtr get(size_t i);
+    std::shared_ptr<RalList> toVector();
+};
+
+// true for either kind of typed array
+inline bool isArray(RalKind kind)
+{
+    return (kind == RalKind::F64_ARRAY) || (kind == RalKind::I64_ARRAY);
+}
+
+// ================================================================================
+// A row-major matrix of doubles.  Item (i, j) is at
+// offset + i * rowStride + j * colStride in a buffer that views like rows,
+// columns & transposes share with the matrix they came from.  Matrices are
+// values, so a shared buffer is never changed.
+class RalMatrix : public RalType {
+    std::shared_ptr<RalF64Buffer> data_;
+    size_t offset_;
+    size_t rows_;
+    size_t cols_;
+    size_t rowStride_;
+    size_t colStride_;
+
+  public:
+    RalMatrix(size_t rows, size_t cols); // filled with zeros
+    RalMatrix(std::shared_ptr<RalF64Buffer> data, size_t offset, size_t rows,
+              size_t cols, size_t rowStride, size_t colStride);
+    ~RalMatrix() override;
+    RalKind kind() override { return RalKind::MATRIX; }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    bool equal(RalTypePtr that) override;
+    size_t hash() override;
+    size_t rows() { return rows_; }
+    size_t cols() { return cols_; }
+    size_t size() { return rows_ * cols_; }
+    double &at(size_t i, size_t j)
+    {
+        return (*data_)[offset_ + i * rowStride_ + j * colStride_];
+    }
+    // true if the items are the size() doubles starting at data()
+    bool isContiguous()
+    {
+        return ((colStride_ == 1) || (cols_ <= 1)) &&
+               ((rowStride_ == cols_) || (rows_ <= 1));
+    }
+    double *data() { return data_->data() + offset_; }
+    // a contiguous copy
+    std::shared_ptr<RalMatrix> copy();
+    // views
+    std::shared_ptr<RalMatrix> row(size_t i);
+    std::shared_ptr<RalMatrix> col(size_t j);
+    std::shared_ptr<RalMatrix> transpose();
+};
+
+// ================================================================================
+// A table keeps its rows as named columns of the same length.  A column is a
+// typed array when all of its values are numbers & a vector otherwise.
+// Tables are values; operations on them make new tables, which share the
+// columns they don't change.
+class RalTable : public RalType {
+    std::vector<RalTypePtr> names_; // keywords or strings
+    std::vector<RalTypePtr> columns_;
+    size_t rows_;
+
+  public:
+    RalTable(std::vector<RalTypePtr> names, std::vector<RalTypePtr> columns,
+             size_t rows);
+    ~RalTable() override;
+    RalKind kind() override { return RalKind::TABLE; }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    bool equal(RalTypePtr that) override;
+    size_t hash() override;
+    size_t rows() { return rows_; }
+    size_t numColumns() { return columns_.size(); }
+    RalTypePtr name(size_t j) { return names_[j]; }
+    const RalTypePtr &column(size_t j) { return columns_[j]; }
+    // returns false if k is not a column name
+    bool find(RalTypePtr k, size_t &j);
+    RalTypePtr cell(size_t j, size_t i);
+    std::shared_ptr<RalMap> row(size_t i);
+    std::shared_ptr<RalList> toMaps(char listStartChar);
+    // a table of the rows at the indices, in that order
+    std::shared_ptr<RalTable> take(const std::vector<size_t> &indices);
+    // the best column for values: an i64 array if all are integers, an f64
+    // array if all are numbers & a vector otherwise
+    static RalTypePtr makeColumn(const std::vector<RalTypePtr> &values);
+    // the items of col at the indices
+    static RalTypePtr takeColumn(RalTypePtr col,
+                                 const std::vector<size_t> &indices);
+};
+
+// ================================================================================
+// native lazy sequences realize this many items at a time
+const size_t RAL_LAZY_CHUNK = 32;
+
+// A generator appends up to n more items each time it is called and returns
+// false once it is exhausted.
+class RalLazyGen {
+  public:
+    virtual ~RalLazyGen() {}
+    virtual bool next(std::vector<RalTypePtr> &items, size_t n) = 0;
+};
+
+// A lazy seq is a chain of cells.  Each cell is realized at most once, into a
+// chunk of items and the cell that follows them.  Before that it holds the
+// source of its items: a lazy-seq thunk, a generator, or another seq.
+struct RalLazyCell {
+    bool realized_;
+    std::vector<RalTypePtr> items_;
+    std::shared_ptr<RalLazyCell> next_; // nullptr at the end of the seq
+    RalTypePtr thunk_;
+    std::shared_ptr<RalLazyGen> gen_;
+    RalTypePtr tail_;
+
+    RalLazyCell();
+    ~RalLazyCell();
+    void realize();
+    // moves (cell, offset) forward to the next realized item. returns false
+    // at the end of the seq.
+    static bool seek(std::shared_ptr<RalLazyCell> &cell, size_t &offset);
+};
+typedef std::shared_ptr<RalLazyCell> RalLazyCellPtr;
+
+// ================================================================================
+class RalLazySeq : public RalType {
+    RalLazyCellPtr cell_;
+    size_t offset_;
+
+  public:
+    RalLazySeq(RalLazyCellPtr cell, size_t offset);
+    ~RalLazySeq() override;
+    RalKind kind() override { return RalKind::LAZY_SEQ; }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    // compares equal to lists & vectors with the same items
+    bool equal(RalTypePtr that) override;
+    size_t hash() override;
+    RalLazyCellPtr cell() { return cell_; }
+    size_t offset() { return offset_; }
+    bool isEmpty();
+    RalTypePtr first();
+    RalTypePtr rest();
+    RalTypePtr nth(size_t i); // nullptr if out of range
+    // the functions below realize the whole seq
+    size_t size();
+    std::shared_ptr<RalList> toList();
+};
+
+// makes a lazy seq whose items come from gen
+RalTypePtr makeLazySeq(std::shared_ptr<RalLazyGen> gen);
+
+// ================================================================================
+// Walks the items of a list, vector, lazy seq, set, sorted-map, typed array or
+// nil one at a time, without holding on to the lazy items already seen.
+class RalSeqCursor {
+    std::shared_ptr<RalList> list_;
+    RalLazyCellPtr cell_;
+    size_t index_;
+
+  public:
+    RalSeqCursor(const char *name, RalTypePtr coll);
+    bool next(RalTypePtr &item);
+};
+
+// ================================================================================
+// one step of a transducer pipeline
+struct RalXformStage {
+    enum Op { MAP, FILTER, REMOVE, KEEP, TAKE, DROP, TAKE_WHILE, PARTITION_ALL };
+    Op op_;
+    RalTypePtr fn_; // for the stages that call a function
+    int64_t n_;     // for take, drop & partition-all
+};
+
+// A transducer is a list of stages that items pass through in order.  It only
+// describes the pipeline; each use of it keeps its own counts and buffers.
+class RalTransducer : public RalType {
+    std::vector<RalXformStage> stages_;
+
+  public:
+    RalTransducer(std::vector<RalXformStage> stages);
+    ~RalTransducer() override;
+    RalKind kind() override { return RalKind::TRANSDUCER; }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    bool equal(RalTypePtr that) override;
+    const std::vector<RalXformStage> &stages() { return stages_; }
+};
+
 // ================================================================================
 typedef std::function<RalTypePtr(RalTypeIter, RalTypeIter)>
     RalFunctionSignature;
@@ -246,20 +785,108 @@ class RalFunction : public RalType {
     RalTypePtr eval(RalEnvPtr env) override;
     bool equal(RalTypePtr that) override;
     RalTypePtr apply(RalTypeIter begin, RalTypeIter end) override;
+    const RalFunctionSignature &signature() { return fn_; }
     RalTypePtr getMeta() override;
     void setMeta(RalTypePtr meta) override;
 };
 
 // ================================================================================
-class RalLambda : public RalType {
-    std::vector<RalTypePtr> binds_;
+// The results of a memoized function, keyed by the hashes of its arguments.
+// The least recently used results are evicted beyond maxEntries and results
+// older than ttl are recomputed.  Zero means no limit for either.
+class RalMemoCache {
+    struct Entry {
+        std::vector<RalTypePtr> args_;
+        RalTypePtr result_;
+        std::chrono::steady_clock::time_point time_;
+    };
+    struct ArgsHash {
+        size_t operator()(const std::vector<RalTypePtr> &args) const;
+    };
+    struct ArgsEqual {
+        bool operator()(const std::vector<RalTypePtr> &a,
+                        const std::vector<RalTypePtr> &b) const;
+    };
+    RalTypePtr fn_;
+    size_t maxEntries_;
+    std::chrono::milliseconds ttl_;
+    std::list<Entry> lru_; // most recently used first
+    std::unordered_map<std::vector<RalTypePtr>, std::list<Entry>::iterator,
+                       ArgsHash, ArgsEqual>
+        index_;
+
+  public:
+    uint64_t hits_, misses_, evictions_;
+
+    RalMemoCache(RalTypePtr fn, size_t maxEntries, int64_t ttlMs);
+    RalTypePtr call(RalTypeIter begin, RalTypeIter end);
+    size_t size() { return lru_.size(); }
+};
+
+// a builtin function that calls through a RalMemoCache
+class RalMemoFunction : public RalFunction {
+    std::shared_ptr<RalMemoCache> cache_;
+
+  public:
+    RalMemoFunction(std::shared_ptr<RalMemoCache> cache);
+    RalMemoFunction(std::shared_ptr<RalMemoFunction> that);
+    std::shared_ptr<RalMemoCache> cache() { return cache_; }
+};
+
+// ================================================================================
+// One parameter list & body of a fn*.  The parameter names are kept as
+// strings so calls don't rebuild them.
+struct RalArity {
+    std::vector<std::string> names_; // the fixed parameters
+    bool variadic_;
+    std::string rest_; // the parameter after &, when variadic_
     RalTypePtr form_;
+    RalArity(std::shared_ptr<RalList> params, RalTypePtr form);
+};
+
+// The arities of a fn* form, worked out once & shared by every closure made
+// from it.  (fn* [x] ...) has one lenient arity that binds missing arguments
+// to nil & ignores extra ones.  (fn* ([x] ...) ([x y & more] ...)) picks the
+// arity for the number of arguments.
+class RalArities : public RalCompiled {
+    std::vector<RalArity> arities_;
+    bool lenient_;
+    std::vector<size_t> byCount_; // the fixed arity for each count, or npos
+    size_t variadic_;             // the variadic arity, or npos
+
+  public:
+    static const size_t npos = (size_t)-1;
+    RalArities(std::vector<RalArity> arities, bool lenient);
+    // the arity of a (fn* [params] body), or nullptr
+    const RalArity *single() const
+    {
+        return lenient_ ? &arities_[0] : nullptr;
+    }
+    // the arity for num arguments, or nullptr if there is none
+    const RalArity *find(size_t num) const
+    {
+        if (lenient_) {
+            return &arities_[0];
+        }
+        if ((num < byCount_.size()) && (byCount_[num] != npos)) {
+            return &arities_[byCount_[num]];
+        }
+        if ((variadic_ != npos) && (num >= arities_[variadic_].names_.size())) {
+            return &arities_[variadic_];
+        }
+        return nullptr;
+    }
+};
+typedef std::shared_ptr<RalArities> RalAritiesPtr;
+
+class RalLambda : public RalType {
+    RalAritiesPtr arities_;
     RalEnvPtr env_;
     bool is_macro_;
     RalTypePtr meta_;
 
   public:
-    RalLambda(std::vector<RalTypePtr> binds, RalTypePtr &form, RalEnvPtr env);
+    RalLambda(RalAritiesPtr arities, RalEnvPtr env);
     RalLambda(RalLambda *that);
     RalLambda(std::shared_ptr<RalLambda> that);
     ~RalLambda() override;
@@ -268,14 +895,59 @@ class RalLambda : public RalType {
     RalTypePtr eval(RalEnvPtr env) override;
     bool equal(RalTypePtr that) override;
     RalTypePtr apply(RalTypeIter begin, RalTypeIter end) override;
-    RalEnvPtr makeEnv(RalTypeIter begin, RalTypeIter end);
-    RalTypePtr form() { return form_; }
+    // the arity for num arguments; throws if there is none
+    const RalArity &arity(size_t num);
+    // Binds the arguments in [begin, end) for arity a.  When moveArgs is
+    // true the caller is done with them & a variadic tail takes them over
+    // instead of copying.
+    RalEnvPtr makeEnv(const RalArity &a, RalTypeIter begin, RalTypeIter end,
+                      bool moveArgs);
+    const RalAritiesPtr &arities() { return arities_; }
+    const RalEnvPtr &env() { return env_; }
     void set_is_macro() { is_macro_ = true; }
     bool get_is_macro() { return is_macro_; }
     RalTypePtr getMeta() override;
     void setMeta(RalTypePtr meta) override;
 };
 
+// ================================================================================
+// Calls function or lambda fn with the arguments in [begin, end) without
+// building a list.  The span can be any contiguous storage, like a vector, the
+// items of a RalList or an array on the stack.
+RalTypePtr invoke(RalTypePtr fn, RalTypeIter begin, RalTypeIter end);
+inline RalTypePtr invoke(RalTypePtr fn, std::vector<RalTypePtr> &args)
+{
+    return invoke(fn, args.data(), args.data() + args.size());
+}
+
+// ================================================================================
+// Argument span for one call.  Up to RAL_ARGS_ON_STACK arguments are kept in
+// the buffer itself, more go in a vector.
+const size_t RAL_ARGS_ON_STACK = 4;
+
+class RalArgBuffer {
+    RalTypePtr small_[RAL_ARGS_ON_STACK];
+    std::vector<RalTypePtr> large_;
+    RalTypeIter data_;
+    size_t size_;
+
+  public:
+    RalArgBuffer(size_t size) : data_(small_), size_(size)
+    {
+        if (size_ > RAL_ARGS_ON_STACK) {
+            large_.resize(size_);
+            data_ = large_.data();
+        }
+    }
+    // data_ may point into small_, so a copy would share the original's
+    // storage
+    RalArgBuffer(const RalArgBuffer &) = delete;
+    RalArgBuffer &operator=(const RalArgBuffer &) = delete;
+    RalTypePtr &operator[](size_t i) { return data_[i]; }
+    RalTypeIter begin() { return data_; }
+    RalTypeIter end() { return data_ + size_; }
+};
+
 // ================================================================================
 class RalAtom : public RalType {
     RalTypePtr value_;
@@ -291,6 +963,82 @@ class RalAtom : public RalType {
     RalTypePtr set(RalTypePtr that);
 };
 
+// ================================================================================
+// A xoshiro256** random number generator.  Like an atom, it changes in place
+// each time it is used.
+class RalRng : public RalType {
+    uint64_t s_[4];
+
+  public:
+    RalRng(uint64_t seed); // the same seed always gives the same numbers
+    RalRng(const uint64_t state[4]);
+    ~RalRng() override;
+    RalKind kind() override { return RalKind::RNG; }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    bool equal(RalTypePtr that) override;
+    uint64_t next();
+    // uniform in [0, n) for n > 0, without modulo bias
+    uint64_t nextBelow(uint64_t n);
+    // uniform in [0, 1)
+    double nextDouble()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+    // returns a generator for the current stream & moves this one 2^128 steps
+    // ahead, so the two never overlap
+    std::shared_ptr<RalRng> split();
+};
+
+// ================================================================================
+// A function that picks one of its methods for each call.  A protocol method
+// picks by the type of its first argument & a multimethod by the value its
+// dispatch fn returns for the arguments.  version_ changes whenever a method
+// is added, so a call site can keep the methods it found & know when they
+// are stale.
+class RalMultiFn : public RalType {
+    std::string name_;
+    RalTypePtr dispatch_; // nullptr for a protocol method
+    std::unordered_map<uint64_t, RalTypePtr> byType_;
+    std::unordered_map<RalTypePtr, RalTypePtr, RalTypeHash, RalTypeEqual>
+        byValue_;
+    RalTypePtr default_;
+    uint64_t version_;
+
+  public:
+    RalMultiFn(const std::string &name, RalTypePtr dispatch);
+    ~RalMultiFn() override;
+    RalKind kind() override { return RalKind::MULTI_FN; }
+    std::string str(bool readable) override;
+    RalTypePtr eval(RalEnvPtr env) override;
+    bool equal(RalTypePtr that) override;
+    RalTypePtr apply(RalTypeIter begin, RalTypeIter end) override;
+    bool isProtocol() { return dispatch_ == nullptr; }
+    uint64_t version() { return version_; }
+    // the type key of the first argument for a protocol method, or 0
+    uint64_t dispatchKey(RalTypeIter begin, RalTypeIter end);
+    // what the dispatch fn of a multimethod returns for the arguments
+    RalTypePtr dispatchValue(RalTypeIter begin, RalTypeIter end);
+    // these throw if there is no method & no :default method.  key is the
+    // dispatch key of arg.
+    RalTypePtr methodForType(uint64_t key, RalTypePtr arg);
+    RalTypePtr methodForValue(RalTypePtr value);
+    // the method for the arguments, looked up without a call site
+    RalTypePtr method(RalTypeIter begin, RalTypeIter end);
+    // value is :default, or a type keyword or record type for a protocol
+    // method
+    void addMethod(RalTypePtr value, RalTypePtr fn);
+};
+
+// Protocol methods dispatch on a key for the type of a value.  Lists &
+// vectors, nil & booleans, and every record type have their own key, while
+// lambdas & builtins are both :function.  Keys are never 0.
+uint64_t typeKey(RalTypePtr value);
+// what (type value) returns: the record type of a record, or a keyword
+RalTypePtr typeOf(RalTypePtr value);
+// the key for a type keyword or record type, or 0 for anything else
+uint64_t typeKeyOf(RalTypePtr type);
+
 // ================================================================================
 // FIXME -- should clean up  these errors to accept params & be fewer in number.
 // Errors/Exceptions
@@ -392,8 +1140,11 @@ class RalIndexOutOfRange : public std::exception {
 
 class RalException : public std::exception {
     std::string msg_;
+    RalTypePtr value_; // the value of a ral throw, or nullptr
     virtual const char *what() const throw() { return msg_.c_str(); }
 
   public:
     RalException(std::string msg) { msg_ = msg; }
+    RalException(RalTypePtr value) : msg_(value->str(false)), value_(value) {}
+    RalTypePtr value() const { return value_; }
 };
\ No newline at end of file
@@ -1,7 +1,7 @@
 #/bin/bash
 LOGFILE=runall.log
 GOLDFILE=runall.gold
-STEPS="step2_eval step3_env step4_if_fn_do step5_tco step6_file step7_quote step8_macros step9_try stepA_mal ral_double ral_bugs"
+STEPS="step2_eval step3_env step4_if_fn_do step5_tco step6_file step7_quote step8_macros step9_try stepA_mal ral_double ral_bugs ral_transient ral_set ral_sorted ral_record ral_lazy ral_seqfn ral_xform ral_memo ral_sort ral_special ral_quasiquote ral_invoke ral_prim ral_native ral_loop ral_array ral_matrix ral_bigint ral_rng ral_mmap ral_table ral_arity ral_throw ral_inline ral_protocol"
 
 # FIXME -- determine python or python3
 PYTHON=python3